@@ -0,0 +1,147 @@
+/*
+alloc_profile.c - allocation counts per site and per phase
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#include <malloc.h>
+
+#include "alloc_profile.h"
+
+static const char * site_names[NUM_ALLOC_SITES] = {
+    "line", "node", "conn"
+};
+
+//the stats.h phases, then ALLOC_PHASE_OTHER
+static const char * phase_names[NUM_PHASES + 1] = {
+    "accept", "send", "recv", "parse", "insert", "output", "other"
+};
+
+//updated with __atomic builtins: the ingest threads allocate lines
+//at the same time as the event loop
+static struct alloc_counter sites[NUM_ALLOC_SITES];
+static struct alloc_counter phases[NUM_PHASES + 1];
+static struct alloc_counter total;
+
+static __thread int current_phase = ALLOC_PHASE_OTHER;
+
+//raise *peak to live if it is higher
+static void update_peak(int64_t * peak, int64_t live)
+{
+    int64_t seen = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while(live > seen &&
+          !__atomic_compare_exchange_n(peak, &seen, live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void count_alloc(struct alloc_counter * counter, size_t bytes)
+{
+    __atomic_fetch_add(&counter->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counter->bytes, bytes, __ATOMIC_RELAXED);
+    int64_t live = __atomic_add_fetch(&counter->live, (int64_t) bytes, __ATOMIC_RELAXED);
+    update_peak(&counter->peak, live);
+}
+
+static void count_free(struct alloc_counter * counter, size_t bytes)
+{
+    __atomic_fetch_add(&counter->frees, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&counter->live, (int64_t) bytes, __ATOMIC_RELAXED);
+}
+
+//a phase only sees what is allocated in it; frees happen in
+//whatever phase is done with the memory, so they go to sites alone
+static void counted(enum alloc_site site, size_t bytes)
+{
+    count_alloc(&sites[site], bytes);
+    count_alloc(&phases[current_phase], bytes);
+    count_alloc(&total, bytes);
+}
+
+static void uncounted(enum alloc_site site, size_t bytes)
+{
+    count_free(&sites[site], bytes);
+    count_free(&total, bytes);
+}
+
+void * alloc_profile_malloc(enum alloc_site site, size_t size)
+{
+    void * ptr = malloc(size);
+    if(ptr != NULL)
+    {
+        counted(site, malloc_usable_size(ptr));
+    }
+    return ptr;
+}
+
+//counted as a free of the old block and an allocation of the new one
+void * alloc_profile_realloc(enum alloc_site site, void * ptr, size_t size)
+{
+    size_t old_bytes = ptr != NULL ? malloc_usable_size(ptr) : 0;
+    void * grown = realloc(ptr, size);
+    if(grown == NULL)
+    {
+        return NULL;
+    }
+    if(ptr != NULL)
+    {
+        uncounted(site, old_bytes);
+    }
+    counted(site, malloc_usable_size(grown));
+    return grown;
+}
+
+void alloc_profile_free(enum alloc_site site, void * ptr)
+{
+    if(ptr == NULL)
+    {
+        return;
+    }
+    uncounted(site, malloc_usable_size(ptr));
+    free(ptr);
+}
+
+void alloc_profile_phase(int phase)
+{
+    current_phase = phase;
+}
+
+//phases have no frees, so no peak either
+static void write_counter(FILE * out, const char * kind, const char * name,
+                          struct alloc_counter * counter, int has_peak, uint64_t lines)
+{
+    uint64_t calls = __atomic_load_n(&counter->calls, __ATOMIC_RELAXED);
+    uint64_t bytes = __atomic_load_n(&counter->bytes, __ATOMIC_RELAXED);
+    int64_t peak = __atomic_load_n(&counter->peak, __ATOMIC_RELAXED);
+    fprintf(out, "alloc %s %-6s %10llu calls %12llu bytes", kind, name,
+            (unsigned long long) calls, (unsigned long long) bytes);
+    if(has_peak)
+    {
+        fprintf(out, " %12lld peak live", (long long) peak);
+    }
+    if(lines > 0)
+    {
+        fprintf(out, "  %8.1f bytes/line", (double) bytes / lines);
+        if(has_peak)
+        {
+            fprintf(out, " %8.1f peak/line", (double) peak / lines);
+        }
+    }
+    fprintf(out, "\n");
+}
+
+void alloc_profile_report(FILE * out, const char * program, uint64_t lines)
+{
+    fprintf(out, "alloc profile of %s, %llu lines\n", program, (unsigned long long) lines);
+    for(int s = 0; s < NUM_ALLOC_SITES; s++)
+    {
+        write_counter(out, "site ", site_names[s], &sites[s], 1, lines);
+    }
+    for(int p = 0; p <= NUM_PHASES; p++)
+    {
+        if(phases[p].calls > 0)
+        {
+            write_counter(out, "phase", phase_names[p], &phases[p], 0, lines);
+        }
+    }
+    write_counter(out, "total", "", &total, 1, lines);
+}
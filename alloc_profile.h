@@ -0,0 +1,82 @@
+/*
+alloc_profile.h - opt-in counts of the allocations that grow with the
+number of lines: the line buffers, the tree nodes and the server's
+per-connection state.
+
+prof_malloc, prof_realloc and prof_free compile to plain malloc,
+realloc and free unless ALLOC_PROFILE_ENABLED is defined (make
+alloc-profile). With it, every call counts towards its site, and
+allocations towards the phase the calling thread is in. Sizes come
+from malloc_usable_size, so nothing is stored next to the block and a
+pointer from plain malloc can still be freed with prof_free.
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#ifndef ALLOC_PROFILE_H
+#define ALLOC_PROFILE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "stats.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//what is being allocated, named by the caller at every call
+enum alloc_site
+{
+    ALLOC_SITE_LINE,
+    ALLOC_SITE_NODE,
+    ALLOC_SITE_CONN,
+    NUM_ALLOC_SITES
+};
+
+//allocations made outside any of the stats.h phases
+#define ALLOC_PHASE_OTHER NUM_PHASES
+
+struct alloc_counter
+{
+    uint64_t calls;
+    uint64_t frees;
+    //allocated over the run, and allocated and not freed
+    uint64_t bytes;
+    int64_t live;
+    int64_t peak;
+};
+
+void * alloc_profile_malloc(enum alloc_site site, size_t size);
+void * alloc_profile_realloc(enum alloc_site site, void * ptr, size_t size);
+void alloc_profile_free(enum alloc_site site, void * ptr);
+
+//the phase the calling thread's allocations count towards, a stats.h
+//phase or ALLOC_PHASE_OTHER
+void alloc_profile_phase(int phase);
+
+//write the counts per site and per phase, and the bytes per line
+//for a job of 'lines' lines
+void alloc_profile_report(FILE * out, const char * program, uint64_t lines);
+
+#ifdef ALLOC_PROFILE_ENABLED
+#define prof_malloc(site, size) alloc_profile_malloc(site, size)
+#define prof_realloc(site, ptr, size) alloc_profile_realloc(site, ptr, size)
+#define prof_free(site, ptr) alloc_profile_free(site, ptr)
+#define prof_phase(phase) alloc_profile_phase(phase)
+#define prof_report(out, program, lines) alloc_profile_report(out, program, lines)
+#else
+#define prof_malloc(site, size) malloc(size)
+#define prof_realloc(site, ptr, size) realloc(ptr, size)
+#define prof_free(site, ptr) free(ptr)
+#define prof_phase(phase) ((void) 0)
+#define prof_report(out, program, lines) ((void) 0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,640 @@
+/*
+bench.c - end to end benchmark driver. For every combination
+of corpus size, fragment count and client count it
+
+    1. generates a corpus with corpus_gen (once per size)
+    2. splits it with file_shuffle_cut --stream (plus --indexed)
+    3. starts the server and keeps N clients running on
+       localhost until every fragment has been handled
+    4. checks the server's output against the corpus
+
+and prints one JSON object per run with the wall time of each
+phase, throughput (lines/s, MB/s) and the peak RSS of the
+splitter, the server and the largest client.
+
+Example:
+    ./bench --lines 100000,1000000 --fragments 4,16 --clients 1,4
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define FALSE 0
+#define TRUE 1
+
+//main function return values
+#define SUCCESS 0
+#define INCORRECT_CMD_ARGS 1
+#define SETUP_FAILED 2
+#define RUN_FAILED 3
+
+#define DECIMAL_NUM 10
+
+#define MAX_SWEEP 32
+#define PATH_LEN 4096
+#define NUM_LEN 32
+#define MAX_CHILD_ARGS 32
+
+#define DEFAULT_SEED 1
+#define DEFAULT_PORT 16000
+#define DEFAULT_TIMEOUT_S 600
+
+//how long to wait for the server to start listening
+#define LISTEN_WAIT_MS 10000
+#define LISTEN_POLL_US 1000
+
+//LISTEN state in /proc/net/tcp
+#define TCP_LISTEN_STATE 0x0A
+
+#define NS_PER_S 1000000000.0
+#define BYTES_PER_MB (1024.0 * 1024.0)
+
+struct bench_options
+{
+    long lines[MAX_SWEEP];
+    int num_lines;
+    long fragments[MAX_SWEEP];
+    int num_fragments;
+    long clients[MAX_SWEEP];
+    int num_clients;
+    long seed;
+    int port;
+    int indexed;
+    int timeout_s;
+    char * bin_dir;
+    char * work_dir;
+    char * corpus_args;
+};
+
+//what one child run cost
+struct run_cost
+{
+    double seconds;
+    long peak_rss_kb;
+    int status;
+};
+
+static volatile sig_atomic_t timed_out = 0;
+
+void on_alarm(int sig)
+{
+    (void) sig;
+    timed_out = 1;
+}
+
+int usage(char * message)
+{
+    printf("Expected ./bench [--lines a,b,..] [--fragments a,b,..] [--clients a,b,..]\n"
+           "                 [--seed n] [--indexed] [--port n] [--timeout s]\n"
+           "                 [--bin-dir dir] [--work-dir dir] [--corpus-args \"...\"]\n%s\n", message);
+    return INCORRECT_CMD_ARGS;
+}
+
+int string_to_long(long * num, char * str)
+{
+    char *end;
+    errno = 0;
+    *num = strtol(str, &end, DECIMAL_NUM);
+
+    if(end == str || *end != '\0' || errno == ERANGE)
+    {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//parse "a,b,c" into at most MAX_SWEEP positive numbers
+int parse_list(char * str, long * list, int * count)
+{
+    char * copy = strdup(str);
+    char * save = NULL;
+    *count = 0;
+
+    for(char * tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+        if(*count == MAX_SWEEP || !string_to_long(&list[*count], tok) || list[*count] <= 0)
+        {
+            free(copy);
+            return FALSE;
+        }
+        (*count)++;
+    }
+
+    free(copy);
+    return *count > 0;
+}
+
+long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+//start a child with stdout and stderr sent to /dev/null
+pid_t spawn(char ** argv)
+{
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        int devnull = open("/dev/null", O_WRONLY);
+        if(devnull != -1)
+        {
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+            close(devnull);
+        }
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+//run a child to completion and record its wall time and peak RSS
+int run_to_completion(char ** argv, struct run_cost * cost)
+{
+    long long start = now_ns();
+    pid_t pid = spawn(argv);
+    if(pid == -1)
+    {
+        printf("Error forking: %s\n", strerror(errno));
+        return FALSE;
+    }
+
+    struct rusage ru;
+    int status;
+    while(wait4(pid, &status, 0, &ru) == -1)
+    {
+        if(errno != EINTR)
+        {
+            return FALSE;
+        }
+    }
+
+    cost->seconds = (now_ns() - start) / NS_PER_S;
+    cost->peak_rss_kb = ru.ru_maxrss;
+    cost->status = status;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+//check /proc/net/tcp{,6} for a socket listening on port
+int port_listening(int port)
+{
+    char * tables[] = { "/proc/net/tcp", "/proc/net/tcp6" };
+
+    for(int t = 0; t < 2; t++)
+    {
+        FILE * f = fopen(tables[t], "r");
+        if(f == NULL)
+        {
+            continue;
+        }
+
+        char * line = NULL;
+        size_t size = 0;
+        while(getline(&line, &size, f) != -1)
+        {
+            char local[128];
+            unsigned int state;
+            if(sscanf(line, "%*d: %127s %*s %x", local, &state) != 2)
+            {
+                continue;
+            }
+            char * colon = strrchr(local, ':');
+            if(colon && strtol(colon + 1, NULL, 16) == port && state == TCP_LISTEN_STATE)
+            {
+                free(line);
+                fclose(f);
+                return TRUE;
+            }
+        }
+        free(line);
+        fclose(f);
+    }
+    return FALSE;
+}
+
+//byte compare two files
+int files_equal(char * a, char * b)
+{
+    FILE * fa = fopen(a, "r");
+    FILE * fb = fopen(b, "r");
+    int equal = fa && fb;
+    char ba[1 << 16];
+    char bb[1 << 16];
+
+    while(equal)
+    {
+        size_t na = fread(ba, 1, sizeof(ba), fa);
+        size_t nb = fread(bb, 1, sizeof(bb), fb);
+        if(na != nb || memcmp(ba, bb, na) != 0)
+        {
+            equal = FALSE;
+        }
+        if(na == 0)
+        {
+            break;
+        }
+    }
+
+    if(fa) fclose(fa);
+    if(fb) fclose(fb);
+    return equal;
+}
+
+long file_size(char * path)
+{
+    struct stat st;
+    return stat(path, &st) == -1 ? -1 : st.st_size;
+}
+
+//kill and reap every child still running
+void kill_children(pid_t server, pid_t * clients, int n)
+{
+    if(server > 0)
+    {
+        kill(server, SIGKILL);
+        waitpid(server, NULL, 0);
+    }
+    for(int i = 0; i < n; i++)
+    {
+        if(clients[i] > 0)
+        {
+            kill(clients[i], SIGKILL);
+            waitpid(clients[i], NULL, 0);
+        }
+    }
+}
+
+//start the server on the manifest and keep up to 'concurrency'
+//clients running while it is up, one per fragment and one more for
+//each client that fails
+int run_job(struct bench_options * opt, char * manifest, int port,
+            long num_fragments, long concurrency,
+            struct run_cost * server_cost, long * client_peak_rss_kb, int * failed_clients)
+{
+    char server_path[PATH_LEN];
+    char client_path[PATH_LEN];
+    char port_str[NUM_LEN];
+    snprintf(server_path, PATH_LEN, "%s/server", opt->bin_dir);
+    snprintf(client_path, PATH_LEN, "%s/client", opt->bin_dir);
+    snprintf(port_str, NUM_LEN, "%d", port);
+
+    char * server_argv[] = { server_path, manifest, port_str, NULL };
+    char * client_argv[] = { client_path, "127.0.0.1", port_str, NULL };
+
+    pid_t * clients = calloc(concurrency, sizeof(pid_t));
+    *client_peak_rss_kb = 0;
+    *failed_clients = 0;
+
+    long long start = now_ns();
+    pid_t server = spawn(server_argv);
+    if(server == -1)
+    {
+        free(clients);
+        return FALSE;
+    }
+
+    for(long waited_us = 0; !port_listening(port); waited_us += LISTEN_POLL_US)
+    {
+        if(waited_us >= LISTEN_WAIT_MS * 1000L || waitpid(server, NULL, WNOHANG) == server)
+        {
+            printf("Server did not start listening on port %d\n", port);
+            kill_children(server, clients, 0);
+            free(clients);
+            return FALSE;
+        }
+        usleep(LISTEN_POLL_US);
+    }
+
+    timed_out = 0;
+    alarm(opt->timeout_s);
+
+    long launched = 0;
+    long running = 0;
+    int server_done = FALSE;
+    int ok = TRUE;
+
+    while(!server_done || running > 0)
+    {
+        //a client that fails puts its fragment back in the queue, so it
+        //gets a replacement; any more would only wait for the server
+        //to exit and fail then
+        while(!server_done && running < concurrency && launched < num_fragments + *failed_clients)
+        {
+            int slot = 0;
+            while(clients[slot] != 0)
+            {
+                slot++;
+            }
+            clients[slot] = spawn(client_argv);
+            launched++;
+            running++;
+        }
+
+        struct rusage ru;
+        int status;
+        pid_t pid = wait4(-1, &status, 0, &ru);
+        if(pid == -1)
+        {
+            if(errno == EINTR && timed_out)
+            {
+                printf("Run timed out after %d s\n", opt->timeout_s);
+                kill_children(server_done ? 0 : server, clients, concurrency);
+                ok = FALSE;
+                break;
+            }
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            ok = FALSE;
+            break;
+        }
+
+        if(pid == server)
+        {
+            server_done = TRUE;
+            server_cost->seconds = (now_ns() - start) / NS_PER_S;
+            server_cost->peak_rss_kb = ru.ru_maxrss;
+            server_cost->status = status;
+            if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            {
+                ok = FALSE;
+            }
+            continue;
+        }
+
+        for(int i = 0; i < concurrency; i++)
+        {
+            if(clients[i] == pid)
+            {
+                clients[i] = 0;
+                running--;
+                if(ru.ru_maxrss > *client_peak_rss_kb)
+                {
+                    *client_peak_rss_kb = ru.ru_maxrss;
+                }
+                if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                {
+                    (*failed_clients)++;
+                }
+            }
+        }
+
+    }
+
+    alarm(0);
+    free(clients);
+    return ok;
+}
+
+//write a manifest for the fragments of 'corpus'
+int write_manifest(char * manifest, char * corpus, char * output, long num_fragments)
+{
+    FILE * f = fopen(manifest, "w");
+    if(f == NULL)
+    {
+        return FALSE;
+    }
+    fprintf(f, "%s\n", output);
+    for(long i = 1; i <= num_fragments; i++)
+    {
+        fprintf(f, "%s_%ld\n", corpus, i);
+    }
+    return fclose(f) == 0;
+}
+
+//split a string of extra arguments on spaces into argv
+int split_args(char * str, char ** argv, int max)
+{
+    int n = 0;
+    char * save = NULL;
+    for(char * tok = strtok_r(str, " ", &save); tok && n < max; tok = strtok_r(NULL, " ", &save))
+    {
+        argv[n++] = tok;
+    }
+    return n;
+}
+
+int main(int argc, char ** argv)
+{
+    struct bench_options opt;
+    memset(&opt, 0, sizeof(opt));
+    opt.lines[0] = 100000;
+    opt.num_lines = 1;
+    opt.fragments[0] = 4;
+    opt.num_fragments = 1;
+    opt.clients[0] = 4;
+    opt.num_clients = 1;
+    opt.seed = DEFAULT_SEED;
+    opt.port = DEFAULT_PORT;
+    opt.timeout_s = DEFAULT_TIMEOUT_S;
+    opt.bin_dir = ".";
+    opt.work_dir = "bench_work";
+    opt.corpus_args = "";
+
+    for(int i = 1; i < argc; i++)
+    {
+        char * arg = argv[i];
+        char * value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        long num;
+
+        if(strcmp(arg, "--indexed") == 0)
+        {
+            opt.indexed = TRUE;
+            continue;
+        }
+        if(value == NULL)
+        {
+            return usage("missing option value");
+        }
+        i++;
+
+        if(strcmp(arg, "--lines") == 0)
+        {
+            if(!parse_list(value, opt.lines, &opt.num_lines)) return usage("bad --lines list");
+        }
+        else if(strcmp(arg, "--fragments") == 0)
+        {
+            if(!parse_list(value, opt.fragments, &opt.num_fragments)) return usage("bad --fragments list");
+        }
+        else if(strcmp(arg, "--clients") == 0)
+        {
+            if(!parse_list(value, opt.clients, &opt.num_clients)) return usage("bad --clients list");
+        }
+        else if(strcmp(arg, "--seed") == 0)
+        {
+            if(!string_to_long(&opt.seed, value)) return usage("bad --seed");
+        }
+        else if(strcmp(arg, "--port") == 0)
+        {
+            if(!string_to_long(&num, value) || num <= 0 || num > 65535) return usage("bad --port");
+            opt.port = num;
+        }
+        else if(strcmp(arg, "--timeout") == 0)
+        {
+            if(!string_to_long(&num, value) || num <= 0) return usage("bad --timeout");
+            opt.timeout_s = num;
+        }
+        else if(strcmp(arg, "--bin-dir") == 0)
+        {
+            opt.bin_dir = value;
+        }
+        else if(strcmp(arg, "--work-dir") == 0)
+        {
+            opt.work_dir = value;
+        }
+        else if(strcmp(arg, "--corpus-args") == 0)
+        {
+            opt.corpus_args = value;
+        }
+        else
+        {
+            return usage("unknown option");
+        }
+    }
+
+    if(mkdir(opt.work_dir, 0777) == -1 && errno != EEXIST)
+    {
+        printf("Could not create work dir %s: %s\n", opt.work_dir, strerror(errno));
+        return SETUP_FAILED;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_alarm;
+    sigaction(SIGALRM, &sa, NULL);
+
+    char corpus_gen[PATH_LEN];
+    char splitter[PATH_LEN];
+    snprintf(corpus_gen, PATH_LEN, "%s/corpus_gen", opt.bin_dir);
+    snprintf(splitter, PATH_LEN, "%s/file_shuffle_cut", opt.bin_dir);
+
+    char seed_str[NUM_LEN];
+    snprintf(seed_str, NUM_LEN, "%ld", opt.seed);
+
+    int port = opt.port;
+    int all_ok = TRUE;
+    int first = TRUE;
+
+    printf("[\n");
+
+    for(int l = 0; l < opt.num_lines; l++)
+    {
+        char source[PATH_LEN];
+        char lines_str[NUM_LEN];
+        snprintf(source, PATH_LEN, "%s/corpus_%ld", opt.work_dir, opt.lines[l]);
+        snprintf(lines_str, NUM_LEN, "%ld", opt.lines[l]);
+
+        //phase 1: corpus, shared by every run of this size
+        char * extra = strdup(opt.corpus_args);
+        char * gen_argv[MAX_CHILD_ARGS] = { corpus_gen, "--lines", lines_str, "--seed", seed_str, "--out", source };
+        int gen_argc = 7;
+        gen_argc += split_args(extra, gen_argv + gen_argc, MAX_CHILD_ARGS - gen_argc - 1);
+        gen_argv[gen_argc] = NULL;
+
+        struct run_cost gen_cost;
+        int gen_ok = run_to_completion(gen_argv, &gen_cost);
+        free(extra);
+        if(!gen_ok)
+        {
+            fprintf(stderr, "corpus_gen failed for %ld lines\n", opt.lines[l]);
+            all_ok = FALSE;
+            continue;
+        }
+        long bytes = file_size(source);
+        double mb = bytes / BYTES_PER_MB;
+
+        for(int f = 0; f < opt.num_fragments; f++)
+        {
+            for(int c = 0; c < opt.num_clients; c++)
+            {
+                long num_fragments = opt.fragments[f];
+                long concurrency = opt.clients[c];
+                char output[PATH_LEN + NUM_LEN];
+                char manifest[PATH_LEN + NUM_LEN];
+                char frag_str[NUM_LEN];
+                snprintf(output, sizeof(output), "%s.sorted", source);
+                snprintf(manifest, sizeof(manifest), "%s.manifest", source);
+                snprintf(frag_str, NUM_LEN, "%ld", num_fragments);
+
+                fprintf(stderr, "bench: %ld lines, %ld fragments, %ld clients\n",
+                        opt.lines[l], num_fragments, concurrency);
+
+                //phase 2: split; runs are sequential so each one
+                //simply overwrites the previous run's fragments
+                char * split_argv[MAX_CHILD_ARGS] = { splitter, "--stream", "--seed", seed_str };
+                int split_argc = 4;
+                if(opt.indexed)
+                {
+                    split_argv[split_argc++] = "--indexed";
+                }
+                split_argv[split_argc++] = source;
+                split_argv[split_argc++] = frag_str;
+                split_argv[split_argc] = NULL;
+
+                struct run_cost split_cost;
+                if(!run_to_completion(split_argv, &split_cost) ||
+                   !write_manifest(manifest, source, output, num_fragments))
+                {
+                    fprintf(stderr, "split failed\n");
+                    all_ok = FALSE;
+                    continue;
+                }
+
+                //phase 3: server and clients
+                struct run_cost sort_cost;
+                memset(&sort_cost, 0, sizeof(sort_cost));
+                long client_rss = 0;
+                int failed_clients = 0;
+                int run_ok = run_job(&opt, manifest, port++, num_fragments, concurrency,
+                                     &sort_cost, &client_rss, &failed_clients);
+
+                //phase 4: verify
+                long long verify_start = now_ns();
+                int verified = run_ok && files_equal(source, output);
+                double verify_s = (now_ns() - verify_start) / NS_PER_S;
+                all_ok = all_ok && verified;
+
+                printf("%s  {\"lines\": %ld, \"bytes\": %ld, \"fragments\": %ld, \"clients\": %ld, "
+                       "\"indexed\": %s, \"seed\": %ld,\n"
+                       "   \"generate_s\": %.6f, \"split_s\": %.6f, \"sort_s\": %.6f, \"verify_s\": %.6f,\n"
+                       "   \"split_lines_per_s\": %.1f, \"split_mb_per_s\": %.3f, "
+                       "\"sort_lines_per_s\": %.1f, \"sort_mb_per_s\": %.3f,\n"
+                       "   \"splitter_peak_rss_kb\": %ld, \"server_peak_rss_kb\": %ld, "
+                       "\"client_peak_rss_kb\": %ld, \"failed_clients\": %d, \"verified\": %s}",
+                       first ? "" : ",\n",
+                       opt.lines[l], bytes, num_fragments, concurrency,
+                       opt.indexed ? "true" : "false", opt.seed,
+                       gen_cost.seconds, split_cost.seconds, sort_cost.seconds, verify_s,
+                       opt.lines[l] / split_cost.seconds, mb / split_cost.seconds,
+                       sort_cost.seconds > 0 ? opt.lines[l] / sort_cost.seconds : 0.0,
+                       sort_cost.seconds > 0 ? mb / sort_cost.seconds : 0.0,
+                       split_cost.peak_rss_kb, sort_cost.peak_rss_kb,
+                       client_rss, failed_clients, verified ? "true" : "false");
+                fflush(stdout);
+                first = FALSE;
+            }
+        }
+    }
+
+    printf("\n]\n");
+
+    return all_ok ? SUCCESS : RUN_FAILED;
+}
@@ -0,0 +1,195 @@
+/*
+btree.c - AVL-balanced binary tree keyed by line number
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "alloc_profile.h"
+#include "btree.h"
+#include "log.h"
+
+//Balanced AVL Tree created partly by me and partly by chatgpt
+
+// Get height of a node (NULL -> 0)
+static int height(struct btree *n) {
+    return n ? n->height : 0;
+}
+
+// Return max of two ints
+static int max(int a, int b) {
+    return (a > b) ? a : b;
+}
+
+// Right rotate subtree rooted at y
+static struct btree *right_rotate(struct btree *y) {
+    struct btree *x = y->left;
+    struct btree *T2 = x->right;
+
+    x->right = y;
+    y->left  = T2;
+
+    // Update heights
+    y->height = max(height(y->left), height(y->right)) + 1;
+    x->height = max(height(x->left), height(x->right)) + 1;
+
+    return x;
+}
+
+// Left rotate subtree rooted at x
+static struct btree *left_rotate(struct btree *x) {
+    struct btree *y = x->right;
+    struct btree *T2 = y->left;
+
+    y->left  = x;
+    x->right = T2;
+
+    // Update heights
+    x->height = max(height(x->left), height(x->right)) + 1;
+    y->height = max(height(y->left), height(y->right)) + 1;
+
+    return y;
+}
+
+// Compute balance factor of n: left height - right height
+static int get_balance(struct btree *n) {
+    return n ? height(n->left) - height(n->right) : 0;
+}
+
+// Rebalance node if unbalanced, using child's balance
+static struct btree *rebalance(struct btree *node) {
+    int balance = get_balance(node);
+    
+    // Left heavy
+    if (balance > 1) {
+        if (get_balance(node->left) >= 0) {
+            // LL case
+            return right_rotate(node);
+        } else {
+            // LR case
+            node->left = left_rotate(node->left);
+            return right_rotate(node);
+        }
+    }
+    // Right heavy
+    if (balance < -1) {
+        if (get_balance(node->right) <= 0) {
+            // RR case
+            return left_rotate(node);
+        } else {
+            // RL case
+            node->right = right_rotate(node->right);
+            return left_rotate(node);
+        }
+    }
+    return node;
+}
+
+// Create new node, taking ownership of 'line'
+struct btree *new_node(int line_num, char *line, int line_length) {
+    struct btree *n = prof_malloc(ALLOC_SITE_NODE, sizeof(*n));
+    if (!n) return NULL;
+    n->line_num = line_num;
+    n->line     = line;
+    n->left = n->right = NULL;
+    n->line_length = line_length;
+    n->height = 1;
+    return n;
+}
+
+// Insert a node, rebalance along the way
+struct btree *add(struct btree *root, int line_num, char *line, int line_length) {
+    return add_checked(root, line_num, line, line_length, NULL);
+}
+
+// Insert a node, rebalance along the way, and tell the caller about duplicates
+struct btree *add_checked(struct btree *root, int line_num, char *line, int line_length, int *duplicate) {
+    if (!root)
+        return new_node(line_num, line, line_length);
+
+    if (line_num < root->line_num) {
+        root->left  = add_checked(root->left,  line_num, line, line_length, duplicate);
+    } else if (line_num > root->line_num) {
+        root->right = add_checked(root->right, line_num, line, line_length, duplicate);
+    } else {
+        log_limited(LOG_WARN, "Duplicate line number (%d) given. Skipping this node\n", line_num);
+        prof_free(ALLOC_SITE_LINE, line);
+        if (duplicate)
+            *duplicate = 1;
+        return root;
+    }
+
+    // update height
+    root->height = 1 + max(height(root->left), height(root->right));
+    // rebalance
+    return rebalance(root);
+}
+
+// Find node with minimum key
+struct btree *find_min(struct btree *root) {
+    while (root && root->left)
+        root = root->left;
+    return root;
+}
+
+// Delete node by key, rebalance, free line and node
+struct btree *delete_node(struct btree *root, struct btree *node) {
+    if (!root || !node) return root;
+
+    if (node->line_num < root->line_num) {
+        root->left = delete_node(root->left, node);
+    }
+    else if (node->line_num > root->line_num) {
+        root->right = delete_node(root->right, node);
+    }
+    else {
+        if (!root->left || !root->right) {
+            struct btree *temp = root->left ? root->left : root->right;
+            prof_free(ALLOC_SITE_LINE, root->line);
+            prof_free(ALLOC_SITE_NODE, root);
+            return temp;
+        }
+        else {
+            struct btree *succ = find_min(root->right);
+            if (root->line) {
+                prof_free(ALLOC_SITE_LINE, root->line);
+                // No need to set root->line = NULL yet, it's about to be overwritten
+            }
+
+            // 2. Copy the inorder successor's data to this node
+            root->line_num    = succ->line_num;
+            root->line        = succ->line;        // Take ownership of successor's line pointer
+            root->line_length = succ->line_length; // Copy length too
+
+            // 3. IMPORTANT: Nullify the original successor's line pointer.
+            //    This prevents the recursive delete call below from freeing
+            //    the memory that 'root' now points to.
+            succ->line        = NULL;
+            succ->line_length = 0; // Also reset length for consistency
+
+            root->right = delete_node(root->right, succ);
+        }
+    }
+
+    root->height = 1 + max(height(root->left), height(root->right));
+    return rebalance(root);
+}
+
+//if there is an error we want to free the tree
+void free_tree(struct btree * root)
+{
+    if(root == NULL)
+    {
+        return;
+    }
+    free_tree(root->left);
+    free_tree(root->right);
+    if(root->line)
+    {
+        prof_free(ALLOC_SITE_LINE, root->line);
+    }
+    prof_free(ALLOC_SITE_NODE, root);
+}
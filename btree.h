@@ -0,0 +1,50 @@
+/*
+btree.h - AVL-balanced binary tree keyed by line number,
+used by the server and the client to put received lines
+back in order.
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#ifndef BTREE_H
+#define BTREE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// AVL-balanced binary tree node. 'line' is caller-allocated; tree takes ownership.
+struct btree {
+    struct btree *left;
+    struct btree *right;
+    int line_num;
+    char *line;
+    int line_length;
+    int height;
+};
+
+// Create new node, taking ownership of 'line'
+struct btree *new_node(int line_num, char *line, int line_length);
+
+// Insert a node, rebalance along the way
+// duplicates are reported and their line is freed
+struct btree *add(struct btree *root, int line_num, char *line, int line_length);
+
+// Same as add, but sets *duplicate (if not NULL) when line_num was already present
+struct btree *add_checked(struct btree *root, int line_num, char *line, int line_length, int *duplicate);
+
+// Find node with minimum key
+struct btree *find_min(struct btree *root);
+
+// Delete node by key, rebalance, free line and node
+struct btree *delete_node(struct btree *root, struct btree *node);
+
+//if there is an error we want to free the tree
+void free_tree(struct btree * root);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
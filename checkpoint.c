@@ -0,0 +1,210 @@
+/*
+checkpoint.c - spill files and the done journal for resuming a job
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "alloc_profile.h"
+#include "checkpoint.h"
+#include "log.h"
+
+#define JOURNAL_NAME "journal"
+//bigger stdio buffers so spills are written in large sequential chunks
+#define SPILL_BUFFER_SIZE 65536
+
+static void part_path(char * path, struct checkpoint * cp, int manifest_index, int client_id)
+{
+    snprintf(path, PATH_MAX, "%s/fragment_%d.%d.part", cp->dir, manifest_index, client_id);
+}
+
+static void results_path(char * path, struct checkpoint * cp, int manifest_index)
+{
+    snprintf(path, PATH_MAX, "%s/fragment_%d.results", cp->dir, manifest_index);
+}
+
+//read the journal's entries, keeping only complete lines
+//returns 0 if it was written for another job
+static int read_journal(struct checkpoint * cp, FILE * journal, int num_fragments)
+{
+    int journal_fragments;
+    if(fscanf(journal, "checkpoint %d\n", &journal_fragments) != 1 ||
+       journal_fragments != num_fragments)
+    {
+        return 0;
+    }
+
+    struct checkpoint_entry entry;
+    unsigned long long fragment_bytes;
+    unsigned long long result_bytes;
+    while(fscanf(journal, "done %d %llu %llu\n", &entry.manifest_index, &fragment_bytes, &result_bytes) == 3)
+    {
+        if(entry.manifest_index < 0 || entry.manifest_index >= num_fragments)
+        {
+            continue;
+        }
+        entry.fragment_bytes = fragment_bytes;
+        entry.result_bytes = result_bytes;
+        cp->entries = realloc(cp->entries, sizeof(struct checkpoint_entry) * (cp->num_entries + 1));
+        cp->entries[cp->num_entries++] = entry;
+    }
+    return 1;
+}
+
+int checkpoint_open(struct checkpoint * cp, char * dir, int num_fragments)
+{
+    memset(cp, 0, sizeof(*cp));
+    cp->dir = dir;
+
+    if(mkdir(dir, 0777) == -1 && errno != EEXIST)
+    {
+        printf("Could not create checkpoint dir %s: %s\n", dir, strerror(errno));
+        return 0;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/%s", dir, JOURNAL_NAME);
+
+    int fresh = 1;
+    FILE * old = fopen(path, "r");
+    if(old != NULL)
+    {
+        fresh = !read_journal(cp, old, num_fragments);
+        fclose(old);
+        if(fresh)
+        {
+            printf("Checkpoint in %s is for a different job, starting over\n", dir);
+        }
+    }
+
+    cp->journal = fopen(path, fresh ? "w" : "a");
+    if(cp->journal == NULL)
+    {
+        printf("Could not open checkpoint journal %s: %s\n", path, strerror(errno));
+        free(cp->entries);
+        cp->entries = NULL;
+        return 0;
+    }
+
+    if(fresh)
+    {
+        fprintf(cp->journal, "checkpoint %d\n", num_fragments);
+        fflush(cp->journal);
+        fsync(fileno(cp->journal));
+    }
+    return 1;
+}
+
+void checkpoint_close(struct checkpoint * cp)
+{
+    if(cp->journal != NULL)
+    {
+        fclose(cp->journal);
+        cp->journal = NULL;
+    }
+    free(cp->entries);
+    cp->entries = NULL;
+    cp->num_entries = 0;
+}
+
+FILE * checkpoint_spill_open(struct checkpoint * cp, int manifest_index, int client_id)
+{
+    char path[PATH_MAX];
+    part_path(path, cp, manifest_index, client_id);
+
+    FILE * spill = fopen(path, "w");
+    if(spill == NULL)
+    {
+        log_warn("Could not open spill file %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    setvbuf(spill, NULL, _IOFBF, SPILL_BUFFER_SIZE);
+    return spill;
+}
+
+void checkpoint_spill_abort(struct checkpoint * cp, FILE * spill, int manifest_index, int client_id)
+{
+    char path[PATH_MAX];
+    part_path(path, cp, manifest_index, client_id);
+    fclose(spill);
+    unlink(path);
+}
+
+int checkpoint_commit(struct checkpoint * cp, FILE * spill, int manifest_index, int client_id,
+                      uint64_t fragment_bytes)
+{
+    char part[PATH_MAX];
+    char results[PATH_MAX];
+    part_path(part, cp, manifest_index, client_id);
+    results_path(results, cp, manifest_index);
+
+    //the results have to be on disk before the journal says so
+    //ferror catches a write that failed while the spill was filled
+    long result_bytes = ftell(spill);
+    int ok = !ferror(spill) && fflush(spill) == 0 && fsync(fileno(spill)) == 0;
+    ok = (fclose(spill) == 0) && ok;
+    if(!ok || rename(part, results) == -1)
+    {
+        log_warn("Could not save results for fragment %d: %s\n", manifest_index, strerror(errno));
+        unlink(part);
+        return 0;
+    }
+
+    fprintf(cp->journal, "done %d %llu %llu\n", manifest_index,
+            (unsigned long long) fragment_bytes, (unsigned long long) result_bytes);
+    if(fflush(cp->journal) != 0 || fsync(fileno(cp->journal)) != 0)
+    {
+        log_warn("Could not update checkpoint journal: %s\n", strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+int checkpoint_load(struct checkpoint * cp, struct checkpoint_entry * entry,
+                    struct line_index * index, uint64_t * lines)
+{
+    char path[PATH_MAX];
+    results_path(path, cp, entry->manifest_index);
+
+    FILE * results = fopen(path, "r");
+    if(results == NULL)
+    {
+        return 0;
+    }
+
+    struct stat st;
+    if(fstat(fileno(results), &st) == -1 || (uint64_t) st.st_size != entry->result_bytes)
+    {
+        fclose(results);
+        return 0;
+    }
+
+    char * line = NULL;
+    size_t size = 0;
+    ssize_t nread;
+    while((nread = getline(&line, &size, results)) != -1)
+    {
+        int line_num;
+        if(strcmp(line, "EOF\n") == 0 || sscanf(line, "%d", &line_num) != 1)
+        {
+            continue;
+        }
+
+        //the index keeps the line, so it gets its own copy
+        char * copy = prof_malloc(ALLOC_SITE_LINE, nread + 1);
+        memcpy(copy, line, nread + 1);
+        line_index_add(index, line_num, copy, nread);
+        (*lines)++;
+    }
+    free(line);
+    fclose(results);
+    return 1;
+}
@@ -0,0 +1,67 @@
+/*
+checkpoint.h - lets a restarted server skip fragments it already
+has results for.
+
+While a client sends results they are appended to a spill file in
+the checkpoint directory. When the client's "EOF\n" arrives the file
+is synced, renamed to fragment_<n>.results and a line is appended to
+the journal, so the journal only ever names complete result files:
+
+    checkpoint <number of fragments>
+    done <manifest index> <fragment bytes> <result bytes>
+
+On start up the journal is replayed: entries whose fragment size
+still matches are loaded straight into the line index and not dispatched.
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "line_index.h"
+
+struct checkpoint_entry
+{
+    int manifest_index;
+    uint64_t fragment_bytes;
+    uint64_t result_bytes;
+};
+
+struct checkpoint
+{
+    char * dir;
+    FILE * journal;
+    //entries found in the journal when it was opened
+    struct checkpoint_entry * entries;
+    int num_entries;
+};
+
+//create the directory if needed and read the journal
+//a journal written for a different number of fragments is started over
+//returns 1 on success
+int checkpoint_open(struct checkpoint * cp, char * dir, int num_fragments);
+
+void checkpoint_close(struct checkpoint * cp);
+
+//spill file for one client's results
+FILE * checkpoint_spill_open(struct checkpoint * cp, int manifest_index, int client_id);
+
+//throw away a spill file whose client did not finish
+void checkpoint_spill_abort(struct checkpoint * cp, FILE * spill, int manifest_index, int client_id);
+
+//make a finished spill file durable and record it in the journal
+//returns 1 on success
+int checkpoint_commit(struct checkpoint * cp, FILE * spill, int manifest_index, int client_id,
+                      uint64_t fragment_bytes);
+
+//add the results saved for a fragment to the index
+//*lines is increased by the number of lines read; returns 1 on success
+int checkpoint_load(struct checkpoint * cp, struct checkpoint_entry * entry,
+                    struct line_index * index, uint64_t * lines);
+
+#endif
@@ -8,6 +8,18 @@ into this tree, the client sends back all of these
 lines in order and then the client merges all these
 client sorted lines into the full original file
 
+With --persistent the client stays connected after sending
+"EOF\n" and sorts fragment after fragment until the server
+closes the connection, as workers of a server in daemon mode do
+
+With --permutation the client sends back where each line is in the
+fragment instead of the line itself (see result_format.h), and the
+server copies the text out of its own copy of the fragment
+
+With --unix the client connects to a server on the same host over a
+Unix socket instead of TCP, and takes its fragment out of shared
+memory when the server offers it a ring (see shm_ring.h)
+
 Jeremy Robin - j.i.robin@wustl.edu
 Shawn Fong - f.shawn@wustl.edu
 
@@ -25,6 +37,17 @@ Shawn Fong - f.shawn@wustl.edu
 #include <sys/epoll.h>
 #include <netdb.h>
 #include <sys/types.h>
+#include <getopt.h>
+#include <sys/un.h>
+
+#include "alloc_profile.h"
+#include "fragment_format.h"
+#include "permutation.h"
+#include "btree.h"
+#include "line_util.h"
+#include "log.h"
+#include "shm_ring.h"
+#include "trace.h"
 
 #define FALSE 0
 #define TRUE 1
@@ -38,9 +61,12 @@ Shawn Fong - f.shawn@wustl.edu
 #define FAILED_TO_CLOSE_FD 2
 #define FAILED_TO_READ_FD 3
 #define SOCKET_ISSUE 5
+//not returned from main: the server closed between fragments
+#define SERVER_DONE 6
 #define FAILED_TO_CLOSE_SOCKET 10
 
 #define EXPECTED_ARGS 2
+#define UNIX_EXPECTED_ARGS 0
 
 #define IP_ARG 1
 #define PORT_ARG 2
@@ -51,337 +77,202 @@ Shawn Fong - f.shawn@wustl.edu
 
 #define DELIMITER '\n'
 
-//Balanced AVL Tree created partly by me and partly by chatgpt
+//lines sorted over every fragment, for the allocation profile
+static uint64_t lines_sorted = 0;
 
-// AVL-balanced binary tree node. 'line' is caller-allocated; tree takes ownership.
-struct btree {
-    struct btree *left;
-    struct btree *right;
-    int line_num;
-    char *line;
-    int line_length;
-    int height;
+//where a fragment is read from: the socket, or the shared memory ring
+//a server on the same host offered at its start
+struct source
+{
+    int fd;
+    int unix_socket;
+    //whether the start of the current fragment was looked at for a ring
+    int checked;
+    int attached;
+    struct shm_ring ring;
 };
 
-// Get height of a node (NULL -> 0)
-static int height(struct btree *n) {
-    return n ? n->height : 0;
-}
-
-// Return max of two ints
-static int max(int a, int b) {
-    return (a > b) ? a : b;
-}
-
-// Right rotate subtree rooted at y
-static struct btree *right_rotate(struct btree *y) {
-    struct btree *x = y->left;
-    struct btree *T2 = x->right;
-
-    x->right = y;
-    y->left  = T2;
-
-    // Update heights
-    y->height = max(height(y->left), height(y->right)) + 1;
-    x->height = max(height(x->left), height(x->right)) + 1;
-
-    return x;
-}
-
-// Left rotate subtree rooted at x
-static struct btree *left_rotate(struct btree *x) {
-    struct btree *y = x->right;
-    struct btree *T2 = y->left;
-
-    y->left  = x;
-    x->right = T2;
-
-    // Update heights
-    x->height = max(height(x->left), height(x->right)) + 1;
-    y->height = max(height(y->left), height(y->right)) + 1;
-
-    return y;
-}
-
-// Compute balance factor of n: left height - right height
-static int get_balance(struct btree *n) {
-    return n ? height(n->left) - height(n->right) : 0;
-}
-
-// Rebalance node if unbalanced, using child's balance
-static struct btree *rebalance(struct btree *node) {
-    int balance = get_balance(node);
-    
-    // Left heavy
-    if (balance > 1) {
-        if (get_balance(node->left) >= 0) {
-            // LL case
-            return right_rotate(node);
-        } else {
-            // LR case
-            node->left = left_rotate(node->left);
-            return right_rotate(node);
+//like read(), from wherever the current fragment comes from
+ssize_t source_read(struct source * src, char * buf, size_t n)
+{
+    if(src->unix_socket && !src->checked)
+    {
+        src->checked = TRUE;
+        ssize_t got = shm_ring_accept(&src->ring, src->fd, buf, n, &src->attached);
+        if(!src->attached)
+        {
+            return got;
         }
+        log_info("Reading fragment from shared memory\n");
     }
-    // Right heavy
-    if (balance < -1) {
-        if (get_balance(node->right) <= 0) {
-            // RR case
-            return left_rotate(node);
-        } else {
-            // RL case
-            node->right = right_rotate(node->right);
-            return left_rotate(node);
-        }
+    if(src->attached)
+    {
+        return shm_ring_read(&src->ring, buf, n);
     }
-    return node;
-}
-
-// Create new node, taking ownership of 'line'
-struct btree *new_node(int line_num, char *line, int line_length) {
-    struct btree *n = malloc(sizeof(*n));
-    if (!n) return NULL;
-    n->line_num = line_num;
-    n->line     = line;
-    n->left = n->right = NULL;
-    n->line_length = line_length;
-    n->height = 1;
-    return n;
+    return read(src->fd, buf, n);
 }
 
-// Insert a node, rebalance along the way
-struct btree *add(struct btree *root, int line_num, char *line, int line_length) {
-    if (!root)
-        return new_node(line_num, line, line_length);
-
-    if (line_num < root->line_num) {
-        root->left  = add(root->left,  line_num, line, line_length);
-    } else if (line_num > root->line_num) {
-        root->right = add(root->right, line_num, line, line_length);
-    } else {
-        printf("Duplicate line number (%d) given. Skipping this node\n", line_num);
-        free(line);
-        return root;
-    }
-
-    // update height
-    root->height = 1 + max(height(root->left), height(root->right));
-    // rebalance
-    return rebalance(root);
-}
-
-// Find node with minimum key
-struct btree *find_min(struct btree *root) {
-    while (root && root->left)
-        root = root->left;
-    return root;
+//the next fragment may come with a ring of its own
+void source_end_fragment(struct source * src)
+{
+    if(src->attached)
+    {
+        shm_ring_close(&src->ring);
+    }
+    src->attached = FALSE;
+    src->checked = FALSE;
 }
 
-// Delete node by key, rebalance, free line and node
-struct btree *delete_node(struct btree *root, struct btree *node) {
-    if (!root || !node) return root;
-
-    if (node->line_num < root->line_num) {
-        root->left = delete_node(root->left, node);
-    }
-    else if (node->line_num > root->line_num) {
-        root->right = delete_node(root->right, node);
-    }
-    else {
-        if (!root->left || !root->right) {
-            struct btree *temp = root->left ? root->left : root->right;
-            free(root->line);
-            free(root);
-            return temp;
-        }
-        else {
-            struct btree *succ = find_min(root->right);
-            if (root->line) {
-                free(root->line);
-                // No need to set root->line = NULL yet, it's about to be overwritten
+//read exactly n bytes, retrying on interruption
+//fails if the other end closes first
+int read_all(struct source * src, char * buf, size_t n)
+{
+    size_t total = 0;
+    while(total != n)
+    {
+        ssize_t got = source_read(src, buf + total, n - total);
+        if(got == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
             }
-
-            // 2. Copy the inorder successor's data to this node
-            root->line_num    = succ->line_num;
-            root->line        = succ->line;        // Take ownership of successor's line pointer
-            root->line_length = succ->line_length; // Copy length too
-
-            // 3. IMPORTANT: Nullify the original successor's line pointer.
-            //    This prevents the recursive delete call below from freeing
-            //    the memory that 'root' now points to.
-            succ->line        = NULL;
-            succ->line_length = 0; // Also reset length for consistency
-
-            root->right = delete_node(root->right, succ);
+            return FALSE;
+        }
+        if(got == 0)
+        {
+            return FALSE;
         }
+        total += got;
     }
-
-    root->height = 1 + max(height(root->left), height(root->right));
-    return rebalance(root);
+    return TRUE;
 }
 
-//if there is an error we want to free the tree
-void free_tree(struct btree * root)
+//send the lines in 'entries', sorted by line number, as a permutation
+//result; 'base' is added to each offset to make it relative to the
+//start of the fragment. "EOF\n" is left to the caller
+int send_permutation(int sfd, struct fragment_index_entry * entries, uint64_t count, uint64_t base)
 {
-    if(root == NULL)
+    size_t len;
+    unsigned char * out = encode_permutation(entries, count, base, &len);
+    if(!out)
     {
-        return;
+        log_error("Could not allocate the result for %llu lines\n", (unsigned long long) count);
+        return SOCKET_ISSUE;
     }
-    free_tree(root->left);
-    free_tree(root->right);
-    if(root->line)
+
+    int ok = write_all(sfd, (char *) out, len);
+    free(out);
+    if(!ok)
     {
-        free(root->line);
+        log_error("Error Writing to Client: %s\n", strerror(errno));
+        return SOCKET_ISSUE;
     }
-    free(root);
+    return SUCCESS;
 }
 
-
-//get position of delim for messages
-int position_delim(char * str, int len, char delim)
+//handle a fragment sent in the indexed format
+//'have' bytes of it are already in 'buf'. The table is sorted by
+//line number and the records are written back straight out of the
+//text block, so none of the text is parsed
+//'trace_start' is when the current trace span began
+int sort_indexed_fragment(struct source * src, char * buf, size_t have, int permutation, uint64_t * trace_start)
 {
-	for(int i = 0; i < len; i++)
-	{
-		if(str[i] == delim)
-		{
-			return i;
-		}
-	}
-	return -1;
-}
+    int sfd = src->fd;
+    struct fragment_header header;
+    char * dst = (char *) &header;
+    size_t from_buf = have < sizeof(header) ? have : sizeof(header);
 
-//for writing to a string with a current length 
-//and an index where writing will happen (line_index)
-void get_mem_for_line(char ** line, int * line_index, int * curr_len_line, int amount)
-{
-    //case 1: line has nothing in it rn
-    if(*line == NULL)
+    memcpy(dst, buf, from_buf);
+    if(!read_all(src, dst + from_buf, sizeof(header) - from_buf))
     {
-        *line_index = 0;
-        *curr_len_line = amount;
-
-        //1 additional char for end string '\0'
-        *line = malloc((*curr_len_line + 1) * sizeof(char));
-        
+        log_error("Server closed while sending fragment header\n");
+        return SOCKET_ISSUE;
     }
-    //case 2: line has something in it already
-    else
+    buf += from_buf;
+    have -= from_buf;
+
+    //table and text block arrive back to back, then "EOF\n"; the sizes
+    //are checked before any sum of them, which could wrap
+    size_t end_len = strlen("EOF\n");
+    if(header.line_count > FRAGMENT_MAX_LINES ||
+       FRAGMENT_DATA_OFFSET(header.line_count) > SIZE_MAX - end_len - 1 ||
+       header.text_bytes > SIZE_MAX - end_len - 1 - FRAGMENT_DATA_OFFSET(header.line_count))
     {
-        *line_index = *curr_len_line;
-        *curr_len_line += amount;
-
-        //1 additional char for end string '\0'
-        *line = realloc(*line, (*curr_len_line + 1) * sizeof(char));
-
+        log_error("Fragment header sizes are too large\n");
+        return SOCKET_ISSUE;
     }
-}
-
-
-int usage(char * message)
-{
-    printf("Expected ./client <ip> <port>\n%s\n", message);
-    return INCORRECT_CMD_ARGS;
-}
-
-int string_to_int(int * num, char * str)
-{
-    char *end;
-    *num = strtol(str, &end, DECIMAL_NUM);
-
-    //TODO: maybe make sure num is not too long?
-
-    if(end == str || *end != '\0')
+    size_t table_bytes = header.line_count * sizeof(struct fragment_index_entry);
+    size_t data_bytes = table_bytes + header.text_bytes;
+    char * data = prof_malloc(ALLOC_SITE_LINE, data_bytes + end_len + 1);
+    if(!data)
     {
-        return FALSE;
+        log_error("Could not allocate %zu bytes for fragment\n", data_bytes);
+        return SOCKET_ISSUE;
     }
 
-    return TRUE;
-}
-
-//Generated by chat
-void print_host_network_info()
-{
-	char hostname[HOST_MAX_LEN];
-	memset(hostname, 0, HOST_MAX_LEN);
+    if(have > data_bytes + end_len)
+    {
+        have = data_bytes + end_len;
+    }
+    memcpy(data, buf, have);
+    if(!read_all(src, data + have, data_bytes + end_len - have))
+    {
+        log_error("Server closed while sending fragment data\n");
+        prof_free(ALLOC_SITE_LINE, data);
+        return SOCKET_ISSUE;
+    }
+    trace_span("recv fragment", "client", 0, *trace_start, "bytes", data_bytes);
+    *trace_start = trace_now_us();
 
-    //make sure last char is '\0'
-	gethostname(hostname, HOST_MAX_LEN - 1);
+    struct fragment_index_entry * table = (struct fragment_index_entry *) data;
+    char * text = data + table_bytes;
 
-    struct addrinfo hints, *res, *p;
-    int status;
+    qsort(table, header.line_count, sizeof(struct fragment_index_entry), compare_index_entry);
+    trace_span("sort", "client", 0, *trace_start, "lines", header.line_count);
+    lines_sorted += header.line_count;
+    *trace_start = trace_now_us();
 
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;        // IPv4
-    hints.ai_socktype = SOCK_STREAM;  // TCP
+    log_info("read all lines!\n");
 
-    if ((status = getaddrinfo(hostname, NULL, &hints, &res)) != 0) {
-        printf("getaddrinfo: %s\n", gai_strerror(status));
-        return;
+    //keep only the entries that point inside the text block
+    uint64_t count = 0;
+    for(uint64_t i = 0; i < header.line_count; i++)
+    {
+        if(!FRAGMENT_ENTRY_FITS(table[i], header.text_bytes))
+        {
+            log_limited(LOG_WARN, "received badly formatted index entry (skipping)\n");
+            continue;
+        }
+        table[count++] = table[i];
     }
 
-    for (p = res; p != NULL; p = p->ai_next) {
-        char ipstr[INET_ADDRSTRLEN];
-        struct sockaddr_in *ipv4 = (struct sockaddr_in *)p->ai_addr;
-        void *addr = &(ipv4->sin_addr);
-
-        inet_ntop(p->ai_family, addr, ipstr, sizeof(ipstr));
-        printf("Hostname: %s\n", hostname);
-        printf("IP Address: %s\n", ipstr);
+    if(permutation)
+    {
+        int ret = send_permutation(sfd, table, count, FRAGMENT_DATA_OFFSET(header.line_count));
+        prof_free(ALLOC_SITE_LINE, data);
+        return ret;
     }
 
-    freeaddrinfo(res);
+    for(uint64_t i = 0; i < count; i++)
+    {
+        if(!write_all(sfd, text + table[i].offset, table[i].length))
+        {
+            log_error("Error Writing to Client: %s\n", strerror(errno));
+            prof_free(ALLOC_SITE_LINE, data);
+            return SOCKET_ISSUE;
+        }
+    }
 
+    prof_free(ALLOC_SITE_LINE, data);
+    return SUCCESS;
 }
 
-int main(int argc, char ** argv)
+//receive one fragment, sort it and send the lines back followed by "EOF\n"
+//returns SERVER_DONE if the server closed before sending anything
+int sort_fragment(struct source * src, int permutation, uint64_t * trace_start)
 {
-	
-	int quit = 0;
-	int num_args = argc - 1;
-	if(num_args != EXPECTED_ARGS)
-	{
-		return usage("You can only have 2 argument");
-	}
-
-	char * server_ip = argv[IP_ARG];
-	
-    int port;
-	if(!string_to_int(&port, argv[PORT_ARG]))
-	{
-		return usage("you did not give a number for the port");
-	}
-
-    int sfd = socket(AF_INET, SOCK_STREAM, 0);
-
-	//check if valid socket file descriptor
-	if(sfd == -1)
-	{
-		printf("Error Creating Socket: %s\n", strerror(errno));
-		return SOCKET_ISSUE;
-	}
-	
-    struct sockaddr_in addr;
-    //clear struct
-    memset(&addr, 0, sizeof(struct sockaddr_in));
-    //AF_INET domain address
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    if(inet_aton(server_ip, &addr.sin_addr) == -1)
-	{
-        close(sfd);
-		printf("Error Setting IP: %s\n", strerror(errno));
-		return SOCKET_ISSUE;
-	}
-
-	if(connect(sfd, (struct sockaddr *) &addr, sizeof(struct sockaddr_in)) == -1)
-	{
-        close(sfd);
-		printf("Error Connecting: %s\n", strerror(errno));
-		return SOCKET_ISSUE;
-	}
-	
-    print_host_network_info();
-
+    int sfd = src->fd;
     char buf [BUFFER_RW_SIZE];
     memset(buf, 0, BUFFER_RW_SIZE);
 
@@ -390,12 +281,76 @@ int main(int argc, char ** argv)
     int curr_len_line = 0;
     struct btree *root = NULL;
 
-    ssize_t bytes_read;
+    ssize_t bytes_read = 0;
     int cont = 1;
+
+    //for a permutation: where each line is instead of the tree, and
+    //the offset of the line being read from the start of the fragment
+    struct fragment_index_entry * entries = NULL;
+    uint64_t num_entries = 0;
+    uint64_t entries_capacity = 0;
+    uint64_t line_offset = 0;
+
+    //look at the start of the stream to tell an indexed fragment
+    //from a plain one; stop as soon as the bytes stop matching the
+    //magic so that short plain fragments (even just "EOF\n") work
+    while(bytes_read < FRAGMENT_MAGIC_LEN &&
+          memcmp(buf, FRAGMENT_MAGIC, bytes_read) == 0)
+    {
+        ssize_t got = source_read(src, buf + bytes_read, BUFFER_RW_SIZE - bytes_read);
+        if(got == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if(got == 0 && bytes_read == 0)
+        {
+            return SERVER_DONE;
+        }
+        if(got <= 0)
+        {
+            log_error("Client can't continue reading: %s\n", got == 0 ? "server closed" : strerror(errno));
+            return SOCKET_ISSUE;
+        }
+        bytes_read += got;
+    }
+
+    int indexed = memcmp(buf, FRAGMENT_MAGIC, FRAGMENT_MAGIC_LEN) == 0;
+    if(indexed)
+    {
+        cont = 0;
+        int ret = sort_indexed_fragment(src, buf, bytes_read, permutation, trace_start);
+        if(ret != SUCCESS)
+        {
+            return ret;
+        }
+    }
+
+    //the sniffed bytes are handled by the first pass of the loop
+    int primed = 1;
     
     while(cont)
     {
-        bytes_read = read(sfd, buf, BUFFER_RW_SIZE);
+        if(primed)
+        {
+            primed = 0;
+        }
+        else
+        {
+            bytes_read = source_read(src, buf, BUFFER_RW_SIZE);
+        }
+
+        if(bytes_read == 0)
+        {
+            log_error("Server closed before sending EOF\n");
+            if(line)
+            {
+                prof_free(ALLOC_SITE_LINE, line);
+            }
+            free_tree(root);
+            free(entries);
+            return SOCKET_ISSUE;
+        }
+
         //failed to read bytes so trying again
         if(bytes_read == -1)
         {
@@ -406,15 +361,19 @@ int main(int argc, char ** argv)
             }
 
             //otherwise we want to safely end program
-            printf("Client can't continue reading: %s\n", strerror(errno));
+            log_error("Client can't continue reading: %s\n", strerror(errno));
             if(line)
             {
-                free(line);
+                prof_free(ALLOC_SITE_LINE, line);
             }
             free_tree(root);
-            close(sfd);
+            free(entries);
             return SOCKET_ISSUE;
         }
+        trace_span("recv chunk", "client", 0, *trace_start, "bytes", bytes_read);
+        *trace_start = trace_now_us();
+        int chunk_lines = 0;
+
         int index;
         int last_index = 0;
 
@@ -435,30 +394,48 @@ int main(int argc, char ** argv)
 
             if(strcmp(line, "EOF\n") == 0)
             {
-                free(line);
+                prof_free(ALLOC_SITE_LINE, line);
                 line = NULL;
                 cont = 0;
                 break;
             }
 
             int line_num;
-            if(sscanf(line, "%d", &line_num) == 1)
+            if(permutation && sscanf(line, "%d", &line_num) == 1 && line_num >= 0)
+            {
+                //only where the line is goes back, so the text can go
+                if(num_entries == entries_capacity)
+                {
+                    entries_capacity = entries_capacity ? entries_capacity * 2 : BUFFER_RW_SIZE;
+                    entries = realloc(entries, sizeof(struct fragment_index_entry) * entries_capacity);
+                }
+                entries[num_entries].line_num = line_num;
+                entries[num_entries].offset = line_offset;
+                entries[num_entries].length = curr_len_line;
+                num_entries++;
+                prof_free(ALLOC_SITE_LINE, line);
+                line = NULL;
+                chunk_lines++;
+            }
+            else if(!permutation && sscanf(line, "%d", &line_num) == 1)
             {
                 //add the line to the tree data structure
                 root = add(root, line_num, line, curr_len_line);
                 line = NULL;
+                chunk_lines++;
                 
             }
             else
             {
                 //badly formatted input
-                printf("received badly formatted line (skipping): %s\n", line);
-                free(line);
+                log_limited(LOG_WARN, "received badly formatted line (skipping): %s\n", line);
+                prof_free(ALLOC_SITE_LINE, line);
                 line = NULL;
             }
 
             // Reset for a new message.
             line_index = 0;
+            line_offset += curr_len_line;
 
             //move past the delim
             last_index = index + 1;
@@ -499,12 +476,33 @@ int main(int argc, char ** argv)
             }
         }
         
+        trace_span("insert", "client", 0, *trace_start, "lines", chunk_lines);
+        lines_sorted += chunk_lines;
+        *trace_start = trace_now_us();
+
         //set the buf back to '\0' chars
         memset(buf, 0, BUFFER_RW_SIZE);
     }
 
 
-    printf("read all lines!\n");
+    if(!indexed)
+    {
+        log_info("read all lines!\n");
+    }
+
+    if(permutation && !indexed)
+    {
+        qsort(entries, num_entries, sizeof(struct fragment_index_entry), compare_index_entry);
+        trace_span("sort", "client", 0, *trace_start, "lines", num_entries);
+        *trace_start = trace_now_us();
+
+        int ret = send_permutation(sfd, entries, num_entries, 0);
+        free(entries);
+        if(ret != SUCCESS)
+        {
+            return ret;
+        }
+    }
 
     //write sorted lines back to server
     while(root != NULL)
@@ -529,9 +527,8 @@ int main(int argc, char ** argv)
                 {
                     continue;
                 }
-                printf("Error Writing to Client: %s\n", strerror(errno));
+                log_error("Error Writing to Client: %s\n", strerror(errno));
                 free_tree(root);
-                close(sfd);
                 return SOCKET_ISSUE;
             }
 
@@ -555,23 +552,258 @@ int main(int argc, char ** argv)
             {
                 continue;
             }
-            printf("Error Writing to Client: %s\n", strerror(errno));
+            log_error("Error Writing to Client: %s\n", strerror(errno));
             free_tree(root);
-            close(sfd);
             return SOCKET_ISSUE;
         }
 
         bytesWrittenTotal += bytesWritten;
     }
 
-    printf("Finished Writing back to Server\n");
+    log_info("Finished Writing back to Server\n");
+    trace_span("send back", "client", 0, *trace_start, NULL, 0);
+    *trace_start = trace_now_us();
+    return SUCCESS;
+}
+
+int usage(char * message)
+{
+    printf("Expected ./client [--trace <trace file>] [--persistent] [--permutation] <ip> <port>\n"
+           "      or ./client [--trace <trace file>] [--persistent] [--permutation] --unix <socket path>\n%s\n", message);
+    return INCORRECT_CMD_ARGS;
+}
+
+int string_to_int(int * num, char * str)
+{
+    char *end;
+    *num = strtol(str, &end, DECIMAL_NUM);
+
+    //TODO: maybe make sure num is not too long?
+
+    if(end == str || *end != '\0')
+    {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//Generated by chat
+void print_host_network_info()
+{
+	char hostname[HOST_MAX_LEN];
+	memset(hostname, 0, HOST_MAX_LEN);
+
+    //make sure last char is '\0'
+	gethostname(hostname, HOST_MAX_LEN - 1);
+
+    struct addrinfo hints, *res, *p;
+    int status;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;        // IPv4
+    hints.ai_socktype = SOCK_STREAM;  // TCP
+
+    if ((status = getaddrinfo(hostname, NULL, &hints, &res)) != 0) {
+        printf("getaddrinfo: %s\n", gai_strerror(status));
+        return;
+    }
+
+    for (p = res; p != NULL; p = p->ai_next) {
+        char ipstr[INET_ADDRSTRLEN];
+        struct sockaddr_in *ipv4 = (struct sockaddr_in *)p->ai_addr;
+        void *addr = &(ipv4->sin_addr);
+
+        inet_ntop(p->ai_family, addr, ipstr, sizeof(ipstr));
+        printf("Hostname: %s\n", hostname);
+        printf("IP Address: %s\n", ipstr);
+    }
+
+    freeaddrinfo(res);
+
+}
+
+//connect to a server on this host over a Unix socket
+//returns -1 if it could not
+int connect_unix(char * path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        printf("Unix socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(sfd == -1)
+    {
+        printf("Error Creating Socket: %s\n", strerror(errno));
+        return -1;
+    }
+    if(connect(sfd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+    {
+        close(sfd);
+        printf("Error Connecting: %s\n", strerror(errno));
+        return -1;
+    }
+    return sfd;
+}
+
+//connect to a server over TCP; returns -1 if it could not
+int connect_tcp(char * server_ip, int port)
+{
+    int sfd = socket(AF_INET, SOCK_STREAM, 0);
+
+	//check if valid socket file descriptor
+	if(sfd == -1)
+	{
+		printf("Error Creating Socket: %s\n", strerror(errno));
+		return -1;
+	}
+	
+    struct sockaddr_in addr;
+    //clear struct
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    //AF_INET domain address
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if(inet_aton(server_ip, &addr.sin_addr) == -1)
+	{
+        close(sfd);
+		printf("Error Setting IP: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if(connect(sfd, (struct sockaddr *) &addr, sizeof(struct sockaddr_in)) == -1)
+	{
+        close(sfd);
+		printf("Error Connecting: %s\n", strerror(errno));
+		return -1;
+	}
+    return sfd;
+}
+
+int main(int argc, char ** argv)
+{
+    char * trace_path = NULL;
+    int persistent = FALSE;
+    int permutation = FALSE;
+    char * unix_path = NULL;
+
+    static struct option long_options[] = {
+        {"trace", required_argument, NULL, 't'},
+        {"persistent", no_argument, NULL, 'p'},
+        {"permutation", no_argument, NULL, 'r'},
+        {"unix", required_argument, NULL, 'u'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while((opt = getopt_long(argc, argv, "t:pru:", long_options, NULL)) != -1)
+    {
+        switch(opt)
+        {
+            case 't':
+                trace_path = optarg;
+                break;
+            case 'p':
+                persistent = TRUE;
+                break;
+            case 'r':
+                permutation = TRUE;
+                break;
+            case 'u':
+                unix_path = optarg;
+                break;
+            default:
+                return usage("unknown option");
+        }
+    }
+
+    //positional arguments keep their original indexes
+	int num_args = argc - optind;
+    argv += optind - 1;
+
+	if(unix_path != NULL && num_args != UNIX_EXPECTED_ARGS)
+	{
+		return usage("--unix takes the place of the ip and port");
+	}
+	if(unix_path == NULL && num_args != EXPECTED_ARGS)
+	{
+		return usage("You can only have 2 argument");
+	}
+
+    //drains and stops itself at exit
+    log_init();
+
+    if(trace_path != NULL && !trace_open(trace_path, "client"))
+    {
+        printf("Could not open trace file %s: %s\n", trace_path, strerror(errno));
+        return usage("bad trace file");
+    }
+    uint64_t job_start = trace_now_us();
+	
+    int sfd;
+    if(unix_path != NULL)
+    {
+        sfd = connect_unix(unix_path);
+    }
+    else
+    {
+        int port;
+        if(!string_to_int(&port, argv[PORT_ARG]))
+        {
+            return usage("you did not give a number for the port");
+        }
+        sfd = connect_tcp(argv[IP_ARG], port);
+    }
+    if(sfd == -1)
+    {
+        return SOCKET_ISSUE;
+    }
+    trace_span("connect", "client", 0, job_start, NULL, 0);
+    uint64_t trace_start = trace_now_us();
+	
+    print_host_network_info();
+
+    struct source src;
+    memset(&src, 0, sizeof(src));
+    src.fd = sfd;
+    src.unix_socket = unix_path != NULL;
+
+    //a persistent worker takes fragments until the server closes
+    int ret;
+    do
+    {
+        ret = sort_fragment(&src, permutation, &trace_start);
+        source_end_fragment(&src);
+    } while(persistent && ret == SUCCESS);
+
+    if(ret == SERVER_DONE)
+    {
+        if(!persistent)
+        {
+            log_error("Client can't continue reading: server closed\n");
+            close(sfd);
+            return SOCKET_ISSUE;
+        }
+        ret = SUCCESS;
+    }
+    if(ret != SUCCESS)
+    {
+        close(sfd);
+        return ret;
+    }
+    trace_span("job", "client", 0, job_start, NULL, 0);
+    prof_report(stderr, "client", lines_sorted);
 
-    free_tree(root);
 	if(close(sfd) == -1)
     {
-        printf("Everything was sent, but failed to close sfd: %s\n", strerror(errno));
+        log_error("Everything was sent, but failed to close sfd: %s\n", strerror(errno));
         return FAILED_TO_CLOSE_SOCKET;
     }
 	return SUCCESS;
 }
-
@@ -0,0 +1,322 @@
+// Program: corpus_gen.cpp
+// Purpose: generates deterministic synthetic text corpora for scale testing,
+//          so that 10M-1B line runs can be reproduced from a handful of
+//          parameters instead of shipping large files around.
+//
+//          The same seed and options always produce the same bytes.  The
+//          corpus is written to <out> (unless --no-source is given), and with
+//          --fragments <n> it is also split on the fly, exactly as
+//          file_shuffle_cut --stream would split <out>, into <out>_1 ..
+//          <out>_n plus a server manifest <out>.manifest whose output file
+//          is <out>.sorted.  Comparing <out>.sorted with <out> checks a run.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "shuffle_engine.h"
+#include "fragment_writer.h"
+using namespace std;
+
+// return codes for success or failure
+const int success = 0;
+const int bad_option = -1;
+const int output_file_open_failed = -3;
+
+// defaults for the line length distribution
+const size_t default_min_len = 0;
+const size_t default_max_len = 120;
+const double default_empty_fraction = 0.02;
+const double default_long_fraction = 0.001;
+const size_t default_long_len = 4096;
+const size_t default_buffer_bytes = 64 * 1024;
+
+// generator stream used for line content, kept apart from the streams the
+// fragment scatter draws from
+const uint64_t content_stream = ~static_cast<uint64_t>(0);
+
+// bytes written to the corpus file per write call
+const size_t write_batch_bytes = 1 << 20;
+
+// multi-byte characters mixed into the utf8 character set
+const char * const utf8_samples[] = {
+    "\xc3\xa9", "\xc3\xb1", "\xc3\xbc", "\xce\xbb", "\xd0\x96",
+    "\xe2\x80\x94", "\xe2\x80\x9c", "\xe2\x80\x9d", "\xe2\x82\xac",
+    "\xe3\x81\x82", "\xe4\xb8\xad" };
+const size_t num_utf8_samples = sizeof(utf8_samples) / sizeof(utf8_samples[0]);
+
+// everything that decides the content of the corpus
+struct corpus_options {
+    corpus_options()
+        : lines(0), min_len(default_min_len), max_len(default_max_len),
+          skewed(false), empty_fraction(default_empty_fraction),
+          long_fraction(default_long_fraction), long_len(default_long_len),
+          charset("text"), seed(0), out("corpus"), fragments(0),
+          write_source(true), bucket_shuffle(true), indexed(false),
+          buffer_bytes(default_buffer_bytes), threads(1) {}
+    uint64_t lines;
+    size_t min_len;
+    size_t max_len;
+    bool skewed;
+    double empty_fraction;
+    double long_fraction;
+    size_t long_len;
+    string charset;
+    uint64_t seed;
+    string out;
+    int fragments;
+    bool write_source;
+    bool bucket_shuffle;
+    bool indexed;
+    size_t buffer_bytes;
+    // fragments shuffled at once, each held in memory
+    unsigned threads;
+};
+
+// outputs proper usage syntax for the program
+int usage (const char *program_name, int result) {
+    cout << "usage: " << program_name << " --lines <n> [options]\n"
+         << "  --min-len <n> --max-len <n>   body line length in bytes ("
+         << default_min_len << "-" << default_max_len << ")\n"
+         << "  --dist uniform|skewed         body length distribution\n"
+         << "  --empty-frac <p>              fraction of empty lines ("
+         << default_empty_fraction << ")\n"
+         << "  --long-frac <p> --long-len <n> fraction of multi-KB lines and"
+         << " their mean length (" << default_long_fraction << ", "
+         << default_long_len << ")\n"
+         << "  --charset text|alnum|printable|utf8\n"
+         << "  --seed <n>                    (0)\n"
+         << "  --out <file>                  (corpus)\n"
+         << "  --no-source                   do not write <out> itself\n"
+         << "  --fragments <n>               also write <out>_1..n and"
+         << " <out>.manifest\n"
+         << "  --indexed --no-bucket-shuffle --buffer-bytes <n> --threads <n>"
+         << "  fragment options, as for file_shuffle_cut" << endl;
+    return result;
+}
+
+// produces line bodies; one generator drives lengths and characters so that
+// a corpus depends only on its options
+class line_generator {
+public:
+    explicit line_generator (const corpus_options & options)
+        : options_ (options),
+          rng_ (xoshiro256::stream(options.seed, content_stream)) {
+        if (options.charset == "alnum") {
+            alphabet_ = "abcdefghijklmnopqrstuvwxyz"
+                        "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+        } else if (options.charset == "printable") {
+            for (char c = ' '; c <= '~'; ++c) alphabet_ += c;
+        } else {
+            // text and utf8: word-like runs separated by spaces
+            alphabet_ = "etaoinshrdlucmfwypvbgkjqxz      ,.";
+        }
+        utf8_ = options.charset == "utf8";
+    }
+
+    // fills 'text' with the next line body (without a newline)
+    void next (string & text) {
+        text.clear();
+        size_t len = next_length();
+
+        while (text.size() < len) {
+            // eight characters per draw; the byte-to-index mapping is
+            // slightly biased, which does not matter for test data
+            uint64_t r = rng_.next();
+            for (int k = 0; k < 8 && text.size() < len; ++k, r >>= 8) {
+                if (utf8_ && (r & 0xff) < 12) {
+                    text += utf8_samples[(r >> 8) % num_utf8_samples];
+                    continue;
+                }
+                text += alphabet_[((r & 0xff) * alphabet_.size()) >> 8];
+            }
+        }
+    }
+
+private:
+    size_t next_length () {
+        const double unit = 1.0 / 18446744073709551616.0;
+        double p = rng_.next() * unit;
+        if (p < options_.empty_fraction) {
+            return 0;
+        }
+        if (p < options_.empty_fraction + options_.long_fraction) {
+            // long lines vary between half and one and a half times long_len
+            return options_.long_len / 2 + rng_.bounded(options_.long_len + 1);
+        }
+
+        size_t span = options_.max_len - options_.min_len;
+        if (!options_.skewed) {
+            return options_.min_len + rng_.bounded(span + 1);
+        }
+        // skewed: mostly short lines with a long tail toward max_len
+        double u = rng_.next() * unit;
+        return options_.min_len + static_cast<size_t>(span * u * u * u);
+    }
+
+    const corpus_options & options_;
+    xoshiro256 rng_;
+    string alphabet_;
+    bool utf8_;
+};
+
+// writes the manifest the server reads: output file, then fragments
+int write_manifest (const corpus_options & options,
+                    const fragment_scatter & scatter) {
+    string name = options.out + ".manifest";
+    ofstream ofs (name.c_str());
+    if (!ofs) {
+        cout << "Could not open output file " << name << endl;
+        return output_file_open_failed;
+    }
+    ofs << options.out << ".sorted" << '\n';
+    for (int fragment = 0; fragment < options.fragments; ++fragment) {
+        ofs << scatter.name(fragment) << '\n';
+    }
+    return success;
+}
+
+// parses one numeric option value, returning false on junk
+template <typename T>
+bool parse_value (const char * text, T & value) {
+    istringstream iss (text);
+    return static_cast<bool>(iss >> value) && iss.eof();
+}
+
+int main (int argc, char *argv[]) {
+    // one fragment in memory at a time unless --threads asks for more,
+    // as in file_shuffle_cut --stream
+    corpus_options options;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        bool ok = true;
+
+        if (arg == "--no-source") {
+            options.write_source = false;
+        } else if (arg == "--indexed") {
+            options.indexed = true;
+        } else if (arg == "--no-bucket-shuffle") {
+            options.bucket_shuffle = false;
+        } else if (!has_value) {
+            ok = false;
+        } else if (arg == "--lines") {
+            ok = parse_value(argv[++i], options.lines);
+        } else if (arg == "--min-len") {
+            ok = parse_value(argv[++i], options.min_len);
+        } else if (arg == "--max-len") {
+            ok = parse_value(argv[++i], options.max_len);
+        } else if (arg == "--dist") {
+            string dist = argv[++i];
+            ok = dist == "uniform" || dist == "skewed";
+            options.skewed = dist == "skewed";
+        } else if (arg == "--empty-frac") {
+            ok = parse_value(argv[++i], options.empty_fraction);
+        } else if (arg == "--long-frac") {
+            ok = parse_value(argv[++i], options.long_fraction);
+        } else if (arg == "--long-len") {
+            ok = parse_value(argv[++i], options.long_len);
+        } else if (arg == "--charset") {
+            options.charset = argv[++i];
+            ok = options.charset == "text" || options.charset == "alnum"
+                 || options.charset == "printable" || options.charset == "utf8";
+        } else if (arg == "--seed") {
+            ok = parse_value(argv[++i], options.seed);
+        } else if (arg == "--out") {
+            options.out = argv[++i];
+        } else if (arg == "--fragments") {
+            ok = parse_value(argv[++i], options.fragments)
+                 && options.fragments > 0;
+        } else if (arg == "--buffer-bytes") {
+            ok = parse_value(argv[++i], options.buffer_bytes)
+                 && options.buffer_bytes > 0;
+        } else if (arg == "--threads") {
+            ok = parse_value(argv[++i], options.threads) && options.threads > 0;
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            cout << "Bad option " << arg << endl;
+            return usage(argv[0], bad_option);
+        }
+    }
+
+    if (options.lines == 0 || options.min_len > options.max_len
+        || options.empty_fraction + options.long_fraction > 1.0
+        || (!options.write_source && options.fragments == 0)) {
+        return usage(argv[0], bad_option);
+    }
+
+    ofstream source;
+    if (options.write_source) {
+        source.open(options.out.c_str(), ios::out | ios::trunc | ios::binary);
+        if (!source) {
+            cout << "Could not open output file " << options.out << endl;
+            return output_file_open_failed;
+        }
+    }
+
+    // the scatter uses the file_shuffle_cut --stream seed so that splitting
+    // the written corpus with the same seed gives the same fragments
+    fragment_scatter * scatter = NULL;
+    if (options.fragments > 0) {
+        scatter = new fragment_scatter (options.out.c_str(), options.fragments,
+                                        options.buffer_bytes, options.seed);
+    }
+
+    line_generator generator (options);
+    string text;
+    string batch;
+    uint64_t bytes = 0;
+    for (uint64_t number = 0; number < options.lines; ++number) {
+        generator.next(text);
+        bytes += text.size() + 1;
+
+        if (options.write_source) {
+            batch += text;
+            batch += '\n';
+            if (batch.size() >= write_batch_bytes) {
+                source << batch;
+                batch.clear();
+            }
+        }
+        if (scatter && !scatter->add(number, text)) {
+            delete scatter;
+            return output_file_open_failed;
+        }
+    }
+    if (options.write_source) {
+        source << batch;
+        if (!source.flush()) {
+            cout << "Could not write output file " << options.out << endl;
+            delete scatter;
+            return output_file_open_failed;
+        }
+    }
+
+    int result = success;
+    if (scatter) {
+        if (!scatter->finish(options.bucket_shuffle, options.indexed,
+                             options.threads)) {
+            result = output_file_open_failed;
+        } else {
+            result = write_manifest(options, *scatter);
+        }
+    }
+
+    // report statistics for what was done
+    cout << options.lines << " lines" << endl;
+    cout << bytes << " bytes" << endl;
+    if (scatter) {
+        cout << options.fragments << " fragments" << endl;
+        cout << scatter->min_lines() << "-" << scatter->max_lines()
+             << " lines_per_fragment" << endl;
+    }
+    cout << options.seed << " seed" << endl;
+
+    delete scatter;
+    return result;
+}
@@ -0,0 +1,94 @@
+// File: counting_allocator.h
+// Purpose: allocation counts for the splitter's containers, the C++ side
+//          of alloc_profile.h.  With ALLOC_PROFILE_ENABLED (make
+//          alloc-profile) splitter_allocator counts every allocation of
+//          the containers that use it: calls, bytes, and the peak bytes
+//          live at once.  Otherwise it is plain std::allocator and the
+//          containers are the usual types.
+
+#ifndef COUNTING_ALLOCATOR_H
+#define COUNTING_ALLOCATOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <ostream>
+
+// totals shared by every container of every element type; the
+// splitter allocates on several threads at once
+struct allocation_totals {
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> bytes;
+    std::atomic<int64_t> live;
+    std::atomic<int64_t> peak;
+};
+
+inline allocation_totals & splitter_allocations () {
+    static allocation_totals totals = {{0}, {0}, {0}, {0}};
+    return totals;
+}
+
+// std::allocator with a count kept on the side
+template <typename T>
+struct counting_allocator {
+    typedef T value_type;
+
+    counting_allocator () {}
+    template <typename U>
+    counting_allocator (const counting_allocator<U> &) {}
+
+    T * allocate (size_t n) {
+        allocation_totals & totals = splitter_allocations();
+        int64_t bytes = n * sizeof(T);
+        totals.calls++;
+        totals.bytes += bytes;
+        int64_t live = totals.live += bytes;
+        int64_t peak = totals.peak.load();
+        while (live > peak && !totals.peak.compare_exchange_weak(peak, live)) {
+        }
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate (T * p, size_t n) {
+        splitter_allocations().live -= n * sizeof(T);
+        std::allocator<T>().deallocate(p, n);
+    }
+};
+
+template <typename T, typename U>
+bool operator== (const counting_allocator<T> &, const counting_allocator<U> &) {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!= (const counting_allocator<T> &, const counting_allocator<U> &) {
+    return false;
+}
+
+#ifdef ALLOC_PROFILE_ENABLED
+template <typename T>
+using splitter_allocator = counting_allocator<T>;
+#else
+template <typename T>
+using splitter_allocator = std::allocator<T>;
+#endif
+
+typedef std::basic_string<char, std::char_traits<char>, splitter_allocator<char> >
+    splitter_string;
+
+// what the containers allocated, per line of the input
+inline void report_splitter_allocations (std::ostream & out, uint64_t lines) {
+    allocation_totals & totals = splitter_allocations();
+    out << "alloc containers " << totals.calls << " calls "
+        << totals.bytes << " bytes " << totals.peak << " peak live";
+    if (lines > 0) {
+        out << " " << static_cast<double>(totals.bytes) / lines << " bytes/line "
+            << static_cast<double>(totals.peak) / lines << " peak/line";
+    }
+    out << std::endl;
+}
+
+#endif // COUNTING_ALLOCATOR_H
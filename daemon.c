@@ -0,0 +1,1065 @@
+/*
+daemon.c - job queue, worker pool and scheduler of the server's
+daemon mode
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+#include "daemon.h"
+#include "fragment.h"
+#include "fragment_cache.h"
+#include "ingest.h"
+#include "line_index.h"
+#include "line_util.h"
+#include "log.h"
+#include "stats.h"
+
+#define FALSE 0
+#define TRUE 1
+
+#define RW_ACCCESS 0666
+
+#define CONTROL_BACKLOG 16
+//longest command line accepted on the control socket
+#define COMMAND_MAX (PATH_MAX + 64)
+#define REPLY_MAX (PATH_MAX + 128)
+#define DAEMON_MAX_EVENTS 64
+#define DEFAULT_PRIORITY 1
+
+#define BUFFER_RW_SIZE 1024
+
+#define END_MESSAGE "EOF\n"
+#define END_MESSAGE_LEN 4
+
+#define STATS_SUFFIX ".stats.json"
+
+//fragment files held open across all jobs; opening one more closes
+//the one opened longest ago
+#define FD_CACHE_SIZE 64
+
+//what each epoll registration is
+enum conn_kind
+{
+    CONN_WORKER_LISTENER,
+    CONN_CONTROL_LISTENER,
+    CONN_COMMAND,
+    CONN_WORKER
+};
+
+//how a job ended, kept by job id for WAIT
+#define JOB_RUNNING 0
+#define JOB_DONE 1
+#define JOB_FAILED 2
+
+struct job
+{
+    int id;
+    int priority;
+    char * manifest;
+    char * output_path;
+    int out_fd;
+    struct fragment_info * fragments;
+    int num_fragments;
+    int num_done;
+    struct fragment_queue pending;
+    //fragments out on workers now, and handed out so far
+    int running;
+    uint64_t dispatched;
+    //a fragment could not be read: nothing more is handed out
+    //and the job ends once its running fragments are back
+    int failed;
+    //one shard, since only the event loop inserts
+    struct line_index index;
+    //bytes of the lines in index
+    uint64_t buffered;
+    struct server_stats stats;
+    //one entry per fragment handed out
+    struct client_stats * runs;
+    int num_runs;
+    //command connections waiting for the job to end
+    int * waiters;
+    int num_waiters;
+};
+
+struct conn
+{
+    enum conn_kind kind;
+    int fd;
+
+    //workers: the job and fragment being sorted, job is NULL when idle
+    int worker_id;
+    struct job * job;
+    int fragment;
+    int run;
+    //the worker shut its end, so it gets no more fragments
+    int closing;
+    struct line_reader reader;
+    //bytes of the fragment and its "EOF\n" written so far; worker
+    //sockets do not block, so the rest goes out on EPOLLOUT
+    int sending;
+    uint64_t sent;
+    //EPOLLOUT is on, and the time spent writing the fragment so far
+    int polling_out;
+    uint64_t send_ns;
+
+    //command connections: an unfinished command line
+    char command[COMMAND_MAX];
+    int command_len;
+};
+
+struct daemon_state
+{
+    int epfd;
+    enum daemon_policy policy;
+    int shutting_down;
+
+    //active jobs in submission order
+    struct job ** jobs;
+    int num_jobs;
+    //JOB_* of every job submitted, by id
+    int * job_results;
+    int next_job_id;
+
+    struct conn ** workers;
+    int num_workers;
+    int next_worker_id;
+
+    //open control connections
+    struct conn ** commands;
+    int num_commands;
+
+    //fragment contents shared by all jobs, NULL when disabled
+    struct fragment_cache * cache;
+    //fragment files open for all jobs
+    struct fd_cache fds;
+
+    //connections closed during this batch of events, freed after it
+    struct conn ** dead;
+    int num_dead;
+};
+
+//replies are short, so a failed write is left for the read side to notice
+static void reply(int fd, const char * format, ...)
+{
+    char message[REPLY_MAX];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    if(len >= (int) sizeof(message))
+    {
+        len = sizeof(message) - 1;
+    }
+    write_all(fd, message, len);
+}
+
+static struct conn * new_conn(struct daemon_state * d, enum conn_kind kind, int fd)
+{
+    struct conn * conn = calloc(1, sizeof(struct conn));
+    conn->kind = kind;
+    conn->fd = fd;
+    line_reader_init(&conn->reader);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (kind == CONN_WORKER || kind == CONN_COMMAND ? EPOLLRDHUP : 0);
+    ev.data.ptr = conn;
+    if(epoll_ctl(d->epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+    {
+        log_error("Error Adding to EPOLL: %s\n", strerror(errno));
+        close(fd);
+        free(conn);
+        return NULL;
+    }
+    return conn;
+}
+
+static void drop_conn(struct daemon_state * d, struct conn * conn)
+{
+    epoll_ctl(d->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->fd = -1;
+    line_reader_free(&conn->reader);
+
+    d->dead = realloc(d->dead, sizeof(struct conn *) * (d->num_dead + 1));
+    d->dead[d->num_dead++] = conn;
+}
+
+//write a finished job's output and stats, tell its waiters and free it
+static void finish_job(struct daemon_state * d, struct job * job)
+{
+    int ok = !job->failed;
+    if(ok)
+    {
+        uint64_t output_start = stats_now();
+        ok = write_output(&job->index, job->out_fd, &job->stats.lines_written, &job->stats.bytes_written);
+        stats_phase_end(&job->stats, PHASE_OUTPUT, output_start);
+        if(!ok)
+        {
+            log_error("Job %d: error writing %s: %s\n", job->id, job->output_path, strerror(errno));
+        }
+    }
+    if(close(job->out_fd) == -1)
+    {
+        ok = FALSE;
+    }
+
+    char stats_path[PATH_MAX];
+    snprintf(stats_path, PATH_MAX, "%s%s", job->output_path, STATS_SUFFIX);
+    FILE * out = fopen(stats_path, "w");
+    if(out != NULL)
+    {
+        struct client_stats ** runs = malloc(sizeof(struct client_stats *) * (job->num_runs + 1));
+        for(int r = 0; r < job->num_runs; r++)
+        {
+            runs[r] = &job->runs[r];
+        }
+        stats_write_json(out, &job->stats, runs, job->num_runs);
+        free(runs);
+        fclose(out);
+    }
+
+    log_info("Job %d %s: %s, %d fragments\n", job->id, ok ? "done" : "failed",
+             job->output_path, job->num_fragments);
+    d->job_results[job->id] = ok ? JOB_DONE : JOB_FAILED;
+    for(int w = 0; w < job->num_waiters; w++)
+    {
+        reply(job->waiters[w], "%s %d\n", ok ? "DONE" : "FAILED", job->id);
+    }
+
+    //keep the rest in submission order for the priority tie break
+    int j = 0;
+    while(d->jobs[j] != job)
+    {
+        j++;
+    }
+    memmove(&d->jobs[j], &d->jobs[j + 1], sizeof(struct job *) * (d->num_jobs - j - 1));
+    d->num_jobs--;
+
+    line_index_free(&job->index);
+    for(int f = 0; f < job->num_fragments; f++)
+    {
+        if(job->fragments[f].fd != -1)
+        {
+            fd_cache_remove(&d->fds, &job->fragments[f]);
+        }
+    }
+    close_fragments(job->num_fragments, job->fragments);
+    free(job->pending.items);
+    free(job->runs);
+    free(job->waiters);
+    free(job->manifest);
+    free(job->output_path);
+    free(job);
+}
+
+static int job_finished(struct job * job)
+{
+    return job->num_done == job->num_fragments || (job->failed && job->running == 0);
+}
+
+//a worker went away: its fragment, if any, goes back in its job's queue
+//lines it already sent stay in the index and come back as duplicates
+static void close_worker(struct daemon_state * d, struct conn * worker)
+{
+    struct job * job = worker->job;
+    if(job != NULL)
+    {
+        struct fragment_info * fragment = &job->fragments[worker->fragment];
+        log_warn("Worker %d died before finishing fragment %d of job %d, requeueing it\n",
+                 worker->worker_id, fragment->manifest_index, job->id);
+        job->runs[worker->run].failed = 1;
+        fragment->running--;
+        job->running--;
+        if(!job->failed)
+        {
+            queue_fragment(&job->pending, job->fragments, worker->fragment);
+            job->stats.requeued++;
+        }
+        worker->job = NULL;
+    }
+    else
+    {
+        log_info("Worker %d disconnected\n", worker->worker_id);
+    }
+
+    int w = 0;
+    while(d->workers[w] != worker)
+    {
+        w++;
+    }
+    d->workers[w] = d->workers[--d->num_workers];
+    drop_conn(d, worker);
+
+    if(job != NULL && job_finished(job))
+    {
+        finish_job(d, job);
+    }
+}
+
+//the job the next free worker should work on, NULL if none has a
+//fragment waiting
+static struct job * pick_job(struct daemon_state * d)
+{
+    struct job * best = NULL;
+    for(int j = 0; j < d->num_jobs; j++)
+    {
+        struct job * job = d->jobs[j];
+        if(job->failed || job->pending.count == 0)
+        {
+            continue;
+        }
+        if(best == NULL)
+        {
+            best = job;
+            continue;
+        }
+
+        if(d->policy == POLICY_PRIORITY)
+        {
+            if(job->priority > best->priority)
+            {
+                best = job;
+            }
+            continue;
+        }
+
+        //fair share: fewest running fragments per unit of priority,
+        //then fewest handed out so far, compared without division
+        long long ours = (long long) job->running * best->priority;
+        long long theirs = (long long) best->running * job->priority;
+        if(ours < theirs ||
+           (ours == theirs && job->dispatched * best->priority < best->dispatched * job->priority))
+        {
+            best = job;
+        }
+    }
+    return best;
+}
+
+//a fragment of the worker's job could not be read: no worker can do
+//better, so the whole job fails and the worker goes back to idle
+static void fail_fragment(struct daemon_state * d, struct conn * worker)
+{
+    struct job * job = worker->job;
+    struct fragment_info * fragment = &job->fragments[worker->fragment];
+    log_error("Job %d: could not read fragment %d\n", job->id, fragment->manifest_index);
+    job->failed = TRUE;
+    fragment->running--;
+    job->running--;
+    worker->job = NULL;
+    worker->sending = FALSE;
+    if(job_finished(job))
+    {
+        finish_job(d, job);
+    }
+}
+
+//watch a worker for room to write, or stop; returns FALSE if epoll failed
+static int poll_out(struct daemon_state * d, struct conn * worker, int on)
+{
+    if(worker->polling_out == on)
+    {
+        return TRUE;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | (on ? EPOLLOUT : 0);
+    ev.data.ptr = worker;
+    if(epoll_ctl(d->epfd, EPOLL_CTL_MOD, worker->fd, &ev) == -1)
+    {
+        log_error("Error Modifying EPOLL: %s\n", strerror(errno));
+        return FALSE;
+    }
+    worker->polling_out = on;
+    return TRUE;
+}
+
+//write as much of the worker's fragment and "EOF\n" as its socket
+//takes now, so a slow worker never holds up the loop, and wait for
+//EPOLLOUT for the rest. Returns FALSE if the worker was closed or the
+//job failed
+static int send_pending(struct daemon_state * d, struct conn * worker)
+{
+    struct job * job = worker->job;
+    struct fragment_info * fragment = &job->fragments[worker->fragment];
+    uint64_t total = fragment->size + END_MESSAGE_LEN;
+    uint64_t start = stats_now();
+    char buffer[BUFFER_RW_SIZE];
+
+    while(worker->sent < total)
+    {
+        const char * from;
+        size_t want;
+        if(worker->sent >= fragment->size)
+        {
+            from = END_MESSAGE + (worker->sent - fragment->size);
+            want = total - worker->sent;
+        }
+        else if(fragment->data != NULL)
+        {
+            from = fragment->data + worker->sent;
+            want = fragment->size - worker->sent;
+        }
+        else
+        {
+            //not mapped, and its file may have been closed to make room
+            //for another since the last write
+            if(!open_fragment(fragment, &d->fds))
+            {
+                fail_fragment(d, worker);
+                return FALSE;
+            }
+            //what a short write leaves is read again
+            want = BUFFER_RW_SIZE;
+            if(fragment->size - worker->sent < want)
+            {
+                want = fragment->size - worker->sent;
+            }
+            ssize_t bytesRead = pread(fragment->fd, buffer, want, worker->sent);
+            if(bytesRead == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if(bytesRead <= 0)
+            {
+                fail_fragment(d, worker);
+                return FALSE;
+            }
+            from = buffer;
+            want = bytesRead;
+        }
+
+        ssize_t written = write(worker->fd, from, want);
+        if(written == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                worker->send_ns += stats_now() - start;
+                if(!poll_out(d, worker, TRUE))
+                {
+                    close_worker(d, worker);
+                    return FALSE;
+                }
+                return TRUE;
+            }
+            log_warn("Error Writing to Worker %d: %s\n", worker->worker_id, strerror(errno));
+            close_worker(d, worker);
+            return FALSE;
+        }
+        worker->sent += written;
+    }
+
+    worker->sending = FALSE;
+    if(!poll_out(d, worker, FALSE))
+    {
+        close_worker(d, worker);
+        return FALSE;
+    }
+
+    uint64_t now = stats_now();
+    struct client_stats * run = &job->runs[worker->run];
+    run->bytes_out = total;
+    job->stats.bytes_out += total;
+    job->stats.phases[PHASE_SEND].ns += worker->send_ns + now - start;
+    job->stats.phases[PHASE_SEND].count++;
+    stats_client_latency(&job->stats, run, LATENCY_DISPATCH, now);
+    return TRUE;
+}
+
+//hand the next fragment of a job to an idle worker
+//returns FALSE if it did not take it: either the worker was closed
+//or the job failed and the worker is still idle
+static int assign(struct daemon_state * d, struct conn * worker, struct job * job)
+{
+    int f = queue_pop(&job->pending);
+    struct fragment_info * fragment = &job->fragments[f];
+    fragment->queued = FALSE;
+    fragment->running++;
+    job->running++;
+    job->dispatched++;
+    job->stats.connections++;
+
+    job->runs = realloc(job->runs, sizeof(struct client_stats) * (job->num_runs + 1));
+    struct client_stats * run = &job->runs[job->num_runs];
+    memset(run, 0, sizeof(*run));
+    run->client_id = worker->worker_id;
+    run->fragment = fragment->manifest_index;
+
+    worker->job = job;
+    worker->fragment = f;
+    worker->run = job->num_runs++;
+
+    run->accept_ns = stats_now();
+
+    //taken from the cache or mapped on dispatch and let go once its
+    //results are in; permutation results are copied out of the fragment
+    if(d->cache != NULL)
+    {
+        cache_fragment(fragment, d->cache);
+    }
+    int ret = open_fragment(fragment, &d->fds) ? SEND_OK : SEND_READ_FAILED;
+    map_fragment(fragment);
+    line_reader_set_fragment(&worker->reader, fragment->data, fragment->size, NULL);
+
+    log_info("Sending fragment %d of job %d to worker %d\n", fragment->manifest_index, job->id, worker->worker_id);
+    if(ret == SEND_READ_FAILED)
+    {
+        fail_fragment(d, worker);
+        return FALSE;
+    }
+
+    worker->sending = TRUE;
+    worker->sent = 0;
+    worker->send_ns = 0;
+    return send_pending(d, worker);
+}
+
+//give every idle worker a fragment while there are any waiting
+static void dispatch(struct daemon_state * d)
+{
+    int w = 0;
+    while(w < d->num_workers)
+    {
+        struct conn * worker = d->workers[w];
+        if(worker->job != NULL || worker->closing)
+        {
+            w++;
+            continue;
+        }
+
+        struct job * job = pick_job(d);
+        if(job == NULL)
+        {
+            return;
+        }
+
+        //otherwise the slot holds another worker, or the same one to try again
+        if(assign(d, worker, job))
+        {
+            w++;
+        }
+    }
+}
+
+static void worker_event(struct daemon_state * d, struct conn * worker, uint32_t events)
+{
+    //room for more of the fragment; an error shows up on the write
+    if(worker->sending && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && !send_pending(d, worker))
+    {
+        return;
+    }
+
+    if(events & EPOLLIN)
+    {
+        char buf[BUFFER_RW_SIZE];
+        uint64_t phase_start = stats_now();
+        ssize_t bytesRead;
+        while((bytesRead = read(worker->fd, buf, BUFFER_RW_SIZE)) == -1 && errno == EINTR);
+
+        //worker sockets do not block
+        if(bytesRead == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return;
+        }
+        if(bytesRead <= 0)
+        {
+            close_worker(d, worker);
+            return;
+        }
+
+        struct job * job = worker->job;
+        if(job == NULL)
+        {
+            log_warn("Worker %d sent results without a fragment, dropping it\n", worker->worker_id);
+            close_worker(d, worker);
+            return;
+        }
+        //it cannot have sorted what it has not been sent yet; closing
+        //it puts the fragment back in the queue
+        if(worker->sending)
+        {
+            log_warn("Worker %d sent results before its fragment was out, dropping it\n", worker->worker_id);
+            close_worker(d, worker);
+            return;
+        }
+
+        struct client_stats * run = &job->runs[worker->run];
+        phase_start = stats_phase_end(&job->stats, PHASE_RECV, phase_start);
+        stats_client_latency(&job->stats, run, LATENCY_FIRST_RESULT, phase_start);
+        run->bytes_in += bytesRead;
+        job->stats.bytes_in += bytesRead;
+
+        struct ingest_counts counts;
+        memset(&counts, 0, sizeof(counts));
+        int done = ingest_chunk(&worker->reader, buf, bytesRead, &job->index, &counts);
+
+        run->lines += counts.lines;
+        job->stats.lines += counts.lines;
+        //daemon jobs keep every line until the job is done
+        job->buffered += counts.bytes;
+        if(job->buffered > job->stats.peak_buffered)
+        {
+            job->stats.peak_buffered = job->buffered;
+        }
+        run->duplicates += counts.duplicates;
+        job->stats.duplicates += counts.duplicates;
+        run->malformed += counts.malformed;
+        job->stats.malformed += counts.malformed;
+        job->stats.phases[PHASE_INSERT].ns += counts.insert_ns;
+        job->stats.phases[PHASE_INSERT].count += counts.lines;
+        job->stats.phases[PHASE_PARSE].ns += stats_now() - phase_start - counts.insert_ns;
+        job->stats.phases[PHASE_PARSE].count++;
+
+        if(done)
+        {
+            stats_client_latency(&job->stats, run, LATENCY_TURNAROUND, stats_now());
+            struct fragment_info * fragment = &job->fragments[worker->fragment];
+            fragment->done = TRUE;
+            fragment->running--;
+            job->running--;
+            job->num_done++;
+            worker->job = NULL;
+            release_fragment(fragment);
+
+            if(job_finished(job))
+            {
+                finish_job(d, job);
+            }
+        }
+    }
+
+    //a plain client closes after one fragment; keep reading until
+    //its results are in but do not hand it another one
+    if(worker->fd != -1 && (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+    {
+        worker->closing = TRUE;
+        if(worker->job == NULL)
+        {
+            close_worker(d, worker);
+        }
+    }
+}
+
+static void submit_job(struct daemon_state * d, int fd, char * manifest, int priority)
+{
+    if(d->shutting_down)
+    {
+        reply(fd, "ERROR shutting down\n");
+        return;
+    }
+
+    struct job * job = calloc(1, sizeof(struct job));
+    switch(read_manifest(manifest, &job->output_path, &job->fragments, &job->num_fragments))
+    {
+        case MANIFEST_MISSING:
+            reply(fd, "ERROR cannot open manifest %s\n", manifest);
+            free(job);
+            return;
+        case MANIFEST_NO_OUTPUT:
+            reply(fd, "ERROR manifest %s has no output file\n", manifest);
+            free(job);
+            return;
+        case MANIFEST_BAD_FRAGMENT:
+            reply(fd, "ERROR manifest %s names a fragment that cannot be opened\n", manifest);
+            free(job);
+            return;
+    }
+
+    job->out_fd = open(job->output_path, O_WRONLY | O_CREAT | O_TRUNC, RW_ACCCESS);
+    if(job->out_fd == -1)
+    {
+        reply(fd, "ERROR cannot open output %s: %s\n", job->output_path, strerror(errno));
+        close_fragments(job->num_fragments, job->fragments);
+        free(job->output_path);
+        free(job);
+        return;
+    }
+
+    line_index_init(&job->index, 1, INT_MIN);
+    queue_init(&job->pending, job->num_fragments);
+    for(int f = 0; f < job->num_fragments; f++)
+    {
+        queue_fragment(&job->pending, job->fragments, f);
+    }
+    stats_init(&job->stats);
+    job->manifest = strdup(manifest);
+    job->priority = priority;
+    job->id = d->next_job_id++;
+
+    d->job_results = realloc(d->job_results, sizeof(int) * d->next_job_id);
+    d->job_results[job->id] = JOB_RUNNING;
+    d->jobs = realloc(d->jobs, sizeof(struct job *) * (d->num_jobs + 1));
+    d->jobs[d->num_jobs++] = job;
+
+    log_info("Job %d submitted: %s, %d fragments, priority %d\n",
+             job->id, manifest, job->num_fragments, priority);
+    reply(fd, "OK %d\n", job->id);
+
+    if(job_finished(job))
+    {
+        finish_job(d, job);
+    }
+}
+
+static void report_status(struct daemon_state * d, int fd)
+{
+    for(int j = 0; j < d->num_jobs; j++)
+    {
+        struct job * job = d->jobs[j];
+        reply(fd, "JOB %d priority %d done %d/%d running %d %s\n", job->id, job->priority,
+              job->num_done, job->num_fragments, job->running, job->manifest);
+    }
+
+    int busy = 0;
+    for(int w = 0; w < d->num_workers; w++)
+    {
+        busy += d->workers[w]->job != NULL;
+    }
+    reply(fd, "WORKERS busy %d/%d\n", busy, d->num_workers);
+    if(d->cache != NULL)
+    {
+        reply(fd, "CACHE entries %d bytes %llu/%llu hits %llu misses %llu evictions %llu\n",
+              d->cache->num_entries,
+              (unsigned long long) d->cache->bytes, (unsigned long long) d->cache->capacity,
+              (unsigned long long) d->cache->hits, (unsigned long long) d->cache->misses,
+              (unsigned long long) d->cache->evictions);
+    }
+    reply(fd, "END\n");
+}
+
+static void wait_for_job(struct daemon_state * d, int fd, int id)
+{
+    if(id < 0 || id >= d->next_job_id)
+    {
+        reply(fd, "ERROR no job %d\n", id);
+        return;
+    }
+    if(d->job_results[id] != JOB_RUNNING)
+    {
+        reply(fd, "%s %d\n", d->job_results[id] == JOB_DONE ? "DONE" : "FAILED", id);
+        return;
+    }
+
+    for(int j = 0; j < d->num_jobs; j++)
+    {
+        struct job * job = d->jobs[j];
+        if(job->id == id)
+        {
+            job->waiters = realloc(job->waiters, sizeof(int) * (job->num_waiters + 1));
+            job->waiters[job->num_waiters++] = fd;
+            return;
+        }
+    }
+}
+
+static void handle_command(struct daemon_state * d, int fd, char * command)
+{
+    char * save = NULL;
+    char * verb = strtok_r(command, " \t\r", &save);
+    char * arg = strtok_r(NULL, " \t\r", &save);
+    char * extra = strtok_r(NULL, " \t\r", &save);
+
+    if(verb == NULL)
+    {
+        return;
+    }
+
+    if(strcmp(verb, "SUBMIT") == 0 && arg != NULL)
+    {
+        int priority = DEFAULT_PRIORITY;
+        char * end = NULL;
+        if(extra != NULL)
+        {
+            priority = strtol(extra, &end, 10);
+        }
+        if(extra != NULL && (*end != '\0' || priority < 1))
+        {
+            reply(fd, "ERROR priority must be a positive integer\n");
+            return;
+        }
+        submit_job(d, fd, arg, priority);
+    }
+    else if(strcmp(verb, "WAIT") == 0 && arg != NULL)
+    {
+        wait_for_job(d, fd, atoi(arg));
+    }
+    else if(strcmp(verb, "STATUS") == 0)
+    {
+        report_status(d, fd);
+    }
+    else if(strcmp(verb, "SHUTDOWN") == 0)
+    {
+        log_info("Shutting down once %d jobs are done\n", d->num_jobs);
+        d->shutting_down = TRUE;
+        reply(fd, "OK\n");
+    }
+    else
+    {
+        reply(fd, "ERROR unknown command\n");
+    }
+}
+
+static void close_command(struct daemon_state * d, struct conn * conn)
+{
+    //it can no longer be told about jobs it waits for
+    for(int j = 0; j < d->num_jobs; j++)
+    {
+        struct job * job = d->jobs[j];
+        int kept = 0;
+        for(int w = 0; w < job->num_waiters; w++)
+        {
+            if(job->waiters[w] != conn->fd)
+            {
+                job->waiters[kept++] = job->waiters[w];
+            }
+        }
+        job->num_waiters = kept;
+    }
+
+    int c = 0;
+    while(d->commands[c] != conn)
+    {
+        c++;
+    }
+    d->commands[c] = d->commands[--d->num_commands];
+    drop_conn(d, conn);
+}
+
+static void command_event(struct daemon_state * d, struct conn * conn)
+{
+    ssize_t bytesRead;
+    while((bytesRead = read(conn->fd, conn->command + conn->command_len,
+                            COMMAND_MAX - 1 - conn->command_len)) == -1 && errno == EINTR);
+    if(bytesRead <= 0)
+    {
+        close_command(d, conn);
+        return;
+    }
+    conn->command_len += bytesRead;
+
+    //run every complete line, keep the start of the next
+    int start = 0;
+    int index;
+    while((index = position_delim(conn->command + start, conn->command_len - start, '\n')) != -1)
+    {
+        conn->command[start + index] = '\0';
+        handle_command(d, conn->fd, conn->command + start);
+        start += index + 1;
+    }
+    memmove(conn->command, conn->command + start, conn->command_len - start);
+    conn->command_len -= start;
+
+    if(conn->command_len == COMMAND_MAX - 1)
+    {
+        reply(conn->fd, "ERROR command too long\n");
+        close_command(d, conn);
+    }
+}
+
+//control socket in the file system, replacing one left by an earlier run
+static int open_control(char * path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        printf("Control socket path is too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int cfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(cfd == -1)
+    {
+        printf("Error Creating Control Socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    unlink(path);
+    if(bind(cfd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+       listen(cfd, CONTROL_BACKLOG) == -1)
+    {
+        printf("Error Setting up Control Socket %s: %s\n", path, strerror(errno));
+        close(cfd);
+        return -1;
+    }
+    return cfd;
+}
+
+int run_daemon(int sfd, char * control_path, enum daemon_policy policy, uint64_t cache_bytes)
+{
+    struct daemon_state d;
+    memset(&d, 0, sizeof(d));
+    d.policy = policy;
+
+    struct fragment_cache cache;
+    if(cache_bytes > 0)
+    {
+        cache_init(&cache, cache_bytes);
+        d.cache = &cache;
+    }
+
+    //a worker that dies mid-send should give us EPIPE, not kill the daemon
+    signal(SIGPIPE, SIG_IGN);
+
+    int control_fd = open_control(control_path);
+    if(control_fd == -1)
+    {
+        close(sfd);
+        return DAEMON_SETUP_FAILED;
+    }
+
+    d.epfd = epoll_create1(0);
+    struct conn * listener = new_conn(&d, CONN_WORKER_LISTENER, sfd);
+    struct conn * control = new_conn(&d, CONN_CONTROL_LISTENER, control_fd);
+    if(d.epfd == -1 || listener == NULL || control == NULL)
+    {
+        printf("Error Setting up epoll: %s\n", strerror(errno));
+        unlink(control_path);
+        return DAEMON_SETUP_FAILED;
+    }
+
+    if(!fd_cache_init(&d.fds, FD_CACHE_SIZE))
+    {
+        printf("Error Allocating fragment file slots\n");
+        unlink(control_path);
+        return DAEMON_SETUP_FAILED;
+    }
+
+    printf("Daemon taking jobs on %s (%s scheduling)\n", control_path,
+           policy == POLICY_FAIR ? "fair share" : "priority");
+
+    struct epoll_event evlist[DAEMON_MAX_EVENTS];
+
+    while(!d.shutting_down || d.num_jobs > 0)
+    {
+        int num_events = epoll_wait(d.epfd, evlist, DAEMON_MAX_EVENTS, -1);
+        if(num_events == -1 && errno != EINTR)
+        {
+            log_error("Error Waiting on EPOLL: %s\n", strerror(errno));
+            break;
+        }
+
+        for(int i = 0; i < num_events; i++)
+        {
+            struct conn * conn = (struct conn *) evlist[i].data.ptr;
+            uint32_t events = evlist[i].events;
+
+            //closed earlier in this batch
+            if(conn->fd == -1)
+            {
+                continue;
+            }
+
+            if(conn->kind == CONN_WORKER_LISTENER)
+            {
+                int cfd = accept(sfd, NULL, NULL);
+                if(cfd == -1)
+                {
+                    log_error("Error Accepting Connection: %s\n", strerror(errno));
+                    continue;
+                }
+                //fragments go out as the worker takes them, see send_pending
+                if(fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK) == -1)
+                {
+                    log_error("Error Setting up Worker Socket: %s\n", strerror(errno));
+                    close(cfd);
+                    continue;
+                }
+                struct conn * worker = new_conn(&d, CONN_WORKER, cfd);
+                if(worker != NULL)
+                {
+                    worker->worker_id = d.next_worker_id++;
+                    d.workers = realloc(d.workers, sizeof(struct conn *) * (d.num_workers + 1));
+                    d.workers[d.num_workers++] = worker;
+                    log_info("Worker %d connected\n", worker->worker_id);
+                }
+            }
+            else if(conn->kind == CONN_CONTROL_LISTENER)
+            {
+                int cfd = accept(control_fd, NULL, NULL);
+                if(cfd == -1)
+                {
+                    log_error("Error Accepting Control Connection: %s\n", strerror(errno));
+                    continue;
+                }
+                struct conn * command = new_conn(&d, CONN_COMMAND, cfd);
+                if(command != NULL)
+                {
+                    d.commands = realloc(d.commands, sizeof(struct conn *) * (d.num_commands + 1));
+                    d.commands[d.num_commands++] = command;
+                }
+            }
+            else if(conn->kind == CONN_COMMAND)
+            {
+                command_event(&d, conn);
+            }
+            else
+            {
+                worker_event(&d, conn, events);
+            }
+        }
+
+        dispatch(&d);
+
+        for(int c = 0; c < d.num_dead; c++)
+        {
+            free(d.dead[c]);
+        }
+        d.num_dead = 0;
+    }
+
+    //persistent workers exit when their connection closes
+    log_info("All jobs done, closing %d workers\n", d.num_workers);
+    while(d.num_workers > 0)
+    {
+        close_worker(&d, d.workers[0]);
+    }
+    while(d.num_commands > 0)
+    {
+        close_command(&d, d.commands[0]);
+    }
+    for(int c = 0; c < d.num_dead; c++)
+    {
+        free(d.dead[c]);
+    }
+    free(d.dead);
+    free(d.workers);
+    free(d.commands);
+    free(d.jobs);
+    free(d.job_results);
+    fd_cache_free(&d.fds);
+    if(d.cache != NULL)
+    {
+        log_info("Fragment cache: %llu hits, %llu misses, %llu evictions\n",
+                 (unsigned long long) cache.hits, (unsigned long long) cache.misses,
+                 (unsigned long long) cache.evictions);
+        cache_destroy(&cache);
+    }
+
+    close(d.epfd);
+    close(sfd);
+    close(control_fd);
+    free(listener);
+    free(control);
+    unlink(control_path);
+    return DAEMON_OK;
+}
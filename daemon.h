@@ -0,0 +1,45 @@
+/*
+daemon.h - long running server that sorts many jobs with one pool of
+workers.
+
+Jobs are submitted as manifest paths on a local control socket, one
+command per line:
+
+    SUBMIT <manifest> [priority]    ->  OK <job id>
+    WAIT <job id>                   ->  DONE <job id> | FAILED <job id>
+    STATUS                          ->  JOB ... lines, WORKERS ..., END
+    SHUTDOWN                        ->  OK, exits once every job is done
+
+Workers are clients started with --persistent: they stay connected
+and take fragments of any job, one at a time. Each time a worker is
+free it gets the next fragment of the job picked by the policy, and a
+job's output and stats are written as soon as its last fragment is in.
+Fragments used by one job stay mapped in a fragment_cache for the next.
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdint.h>
+
+//run_daemon return values
+#define DAEMON_OK 0
+#define DAEMON_SETUP_FAILED 1
+
+enum daemon_policy
+{
+    //spread workers over jobs by priority weight
+    POLICY_FAIR,
+    //highest priority job first, oldest first among equals
+    POLICY_PRIORITY
+};
+
+//serve jobs until SHUTDOWN; 'sfd' is the listening socket workers
+//connect to and the control socket is created at 'control_path'
+//up to 'cache_bytes' of fragment contents are kept between jobs
+int run_daemon(int sfd, char * control_path, enum daemon_policy policy, uint64_t cache_bytes);
+
+#endif
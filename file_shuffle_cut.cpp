@@ -2,12 +2,39 @@
 // Author: Chris Gill
 // Purpose: reads lines of a text file and numbers them, shuffles them, and
 //          cuts them into separate files with fragments of the original text
+//
+//          With --stream the file is never held in memory: a single pass
+//          numbers each line and scatters it to a randomly chosen fragment
+//          through a bounded per-fragment buffer, then (unless
+//          --no-bucket-shuffle is given) each fragment is shuffled on its
+//          own.  Memory use is O(fragments x buffer size) for the scatter
+//          and O(largest fragment) for the optional in-bucket pass, which
+//          runs one fragment at a time unless --threads is given; with
+//          --threads <n> it holds up to n fragments at once.
+//
+//          Shuffling uses the seeded engine in shuffle_engine.h; the seed is
+//          printed with the statistics and --seed <n> reproduces a run
+//          exactly, whatever --threads is set to.
+//
+//          With --indexed each fragment is written in the indexed format of
+//          fragment_format.h (header, line table, then the text records) so
+//          the server and clients never have to rescan the text.
+//
+//          With --range fragment k holds the k-th contiguous range of line
+//          numbers instead of a random sample, shuffled within itself, so a
+//          server started with --concat can append the sorted fragments in
+//          manifest order instead of merging them.  --stream counts the
+//          lines in a first pass to size the ranges.
 
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <algorithm>
 #include <sstream>
+#include <random>
+#include "shuffle_engine.h"
+#include "fragment_writer.h"
+#include "counting_allocator.h"
 using namespace std;
 
 // return codes for success or failure
@@ -15,6 +42,8 @@ const int success = 0;
 const int wrong_number_of_arguments = -1;
 const int input_file_open_failed = -2;
 const int output_file_open_failed = -3;
+const int invalid_fragment_count = -4;
+const int unknown_option = -5;
 
 // constants for command line indexing
 const int program_name_index = 0;
@@ -22,25 +51,47 @@ const int file_name_index = 1;
 const int fragments_index = 2;
 const int expected_argc = 3;
 
+// default bytes buffered per fragment before it is flushed in --stream mode
+const size_t default_buffer_bytes = 64 * 1024;
+
 // struct to hold a numbered line of text
 struct numbered_line {
     numbered_line() : number(0) {}
     int number;
-    string text;
+    splitter_string text;
 };
 
+// the whole input when it is split in memory; counted by make alloc-profile
+typedef vector<numbered_line, splitter_allocator<numbered_line> > line_vector;
+
 // outputs proper usage syntax for the program
 int usage (const char *program_name, int result) {
     cout << "usage: " << program_name 
+         << " [--seed <n>] [--threads <n>]"
+         << " [--stream] [--buffer-bytes <n>] [--no-bucket-shuffle]"
+         << " [--indexed] [--range]"
          << " <file name> <number of fragments>" << endl;
     return result;
 }
 
 // writes out a range of lines into a named output file
-int write_fragment (vector<numbered_line>::const_iterator iter,
-                    vector<numbered_line>::const_iterator stop,
-                    const char * filename)
+int write_fragment (line_vector::const_iterator iter,
+                    line_vector::const_iterator stop,
+                    const char * filename, bool indexed)
 {
+    if (indexed) {
+        vector<uint64_t> numbers;
+        vector<string> records;
+        for (; iter != stop; ++iter) {
+            ostringstream record;
+            record << iter->number << " " << iter->text;
+            numbers.push_back(iter->number);
+            records.push_back(record.str());
+        }
+        return write_indexed_fragment(numbers, records, filename)
+               ? success : output_file_open_failed;
+    }
+
     ofstream ofs (filename);
     if (!ofs) {
         cout << "Could not open output file " <<  filename << endl;
@@ -56,14 +107,127 @@ int write_fragment (vector<numbered_line>::const_iterator iter,
 }
 
 
+// splits a file of any size: numbers each line and scatters it to a
+// randomly chosen fragment, then optionally shuffles within each fragment
+// (scatter + in-bucket shuffle yields a uniformly random permutation)
+int stream_split (const char * file_name, int fragments,
+                  size_t buffer_bytes, bool bucket_shuffle, bool indexed,
+                  bool range, uint64_t seed, unsigned threads)
+{
+    ifstream ifs (file_name);
+    if (!ifs) {
+        cout << "Could not open file " << file_name << endl;
+        return input_file_open_failed;
+    }
+
+    fragment_scatter scatter (file_name, fragments, buffer_bytes, seed);
+    uint64_t number = 0;
+    string text;
+
+    // the ranges are sized from the line count, so count first
+    if (range) {
+        while (getline(ifs, text)) {
+            number++;
+        }
+        scatter.use_ranges(number);
+        ifs.clear();
+        ifs.seekg(0);
+        number = 0;
+    }
+    while (getline(ifs, text)) {
+        if (!scatter.add(number++, text)) return output_file_open_failed;
+    }
+
+    // fragments are independent, so the in-bucket pass can run one
+    // fragment per thread, each with its own generator stream; every
+    // thread holds a whole fragment, so that is only done when asked for
+    if (!scatter.finish(bucket_shuffle, indexed, threads)) {
+        return output_file_open_failed;
+    }
+
+    // report statistics for what was done
+    cout << number << " lines" << endl;
+    cout << fragments << " fragments" << endl;
+    cout << scatter.min_lines() << "-" << scatter.max_lines()
+         << " lines_per_fragment" << endl;
+    cout << seed << " seed" << endl;
+#ifdef ALLOC_PROFILE_ENABLED
+    report_splitter_allocations(cout, number);
+#endif
+
+    return success;
+}
+
+
 int main (int argc, char *argv[]) {
 
+    // pull out options, leaving the positional arguments in place
+    bool stream = false;
+    bool bucket_shuffle = true;
+    bool indexed = false;
+    bool range = false;
+    size_t buffer_bytes = default_buffer_bytes;
+    uint64_t seed = (static_cast<uint64_t>(random_device()()) << 32)
+                    | random_device()();
+    unsigned threads = thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    // --stream keeps to one fragment in memory unless told otherwise
+    bool threads_given = false;
+    vector<char *> args;
+    args.push_back(argv[program_name_index]);
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--stream") {
+            stream = true;
+        } else if (arg == "--no-bucket-shuffle") {
+            bucket_shuffle = false;
+        } else if (arg == "--indexed") {
+            indexed = true;
+        } else if (arg == "--range") {
+            range = true;
+        } else if (arg == "--buffer-bytes" && i + 1 < argc) {
+            istringstream iss (argv[++i]);
+            if (!(iss >> buffer_bytes) || buffer_bytes == 0) {
+                return usage(argv[program_name_index], unknown_option);
+            }
+        } else if (arg == "--seed" && i + 1 < argc) {
+            istringstream iss (argv[++i]);
+            if (!(iss >> seed)) {
+                return usage(argv[program_name_index], unknown_option);
+            }
+        } else if (arg == "--threads" && i + 1 < argc) {
+            istringstream iss (argv[++i]);
+            if (!(iss >> threads) || threads == 0) {
+                return usage(argv[program_name_index], unknown_option);
+            }
+            threads_given = true;
+        } else if (arg.compare(0, 2, "--") == 0) {
+            cout << "Unknown option " << arg << endl;
+            return usage(argv[program_name_index], unknown_option);
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    argc = args.size();
+    argv = &args[0];
+
     // check command line argument count
     if (argc != expected_argc) {
         // suggest how to run the program correctly
         return usage(argv[program_name_index], wrong_number_of_arguments);
     }
 
+    if (stream) {
+        int fragments = 0;
+        istringstream iss (argv[fragments_index]);
+        if (!(iss >> fragments) || fragments < 1) {
+            return usage(argv[program_name_index], invalid_fragment_count);
+        }
+        return stream_split(argv[file_name_index], fragments,
+                            buffer_bytes, bucket_shuffle, indexed,
+                            range, seed, threads_given ? threads : 1);
+    }
+
     // check ability to open input file
     ifstream ifs (argv[file_name_index]);
     if (!ifs) {
@@ -72,37 +236,53 @@ int main (int argc, char *argv[]) {
     }
 
     // fill a vector with numbered lines from the file
-    vector<numbered_line> nlv;
+    line_vector nlv;
     numbered_line nl;
     while (getline(ifs, nl.text)) {
         nlv.push_back(nl);
         nl.number++;
     }
 
-    // shuffle the numbered lines in the vector
-    random_shuffle (nlv.begin(), nlv.end());
-
     // extract (and possibly reduce) number of fragments to create
-    int fragments;
+    int fragments = 0;
     istringstream iss (argv[fragments_index]);
-    iss >> fragments;
-    if (fragments > nlv.size()) {
+    if (!(iss >> fragments) || fragments < 1) {
+        return usage(argv[program_name_index], invalid_fragment_count);
+    }
+    if (fragments > static_cast<int>(nlv.size())) {
         fragments = nlv.size();
     }
 
     // calculate number of lines per fragment, initialize iterators
-    int lines_per_fragment = nlv.size() / fragments;
-    vector<numbered_line>::const_iterator start = nlv.begin();
-    vector<numbered_line>::const_iterator stop = start + lines_per_fragment;
+    int lines_per_fragment = fragments > 0 ? nlv.size() / fragments : 0;
+
+    if (range) {
+        // cut in line order, then shuffle each range on its own, one
+        // generator stream per fragment
+        run_parallel(fragments, threads, [&] (size_t fragment) {
+            line_vector::iterator first =
+                nlv.begin() + fragment * lines_per_fragment;
+            line_vector::iterator last =
+                static_cast<int>(fragment) == fragments - 1
+                    ? nlv.end() : first + lines_per_fragment;
+            xoshiro256 rng = xoshiro256::stream(seed, fragment + 1);
+            fisher_yates(first, last, rng);
+        });
+    } else {
+        // shuffle the numbered lines in the vector
+        parallel_shuffle (nlv, seed, threads);
+    }
+    line_vector::const_iterator start = nlv.begin();
+    line_vector::const_iterator stop = start + lines_per_fragment;
 
     // output fragments of shuffled text into files    
     for (int fragment = 1; fragment <= fragments; ++fragment) {
         if (stop > nlv.end() || fragment == fragments) stop = nlv.end();
 
-        ostringstream file_name_stream;
-        file_name_stream << argv[file_name_index] << "_" << fragment;
         int result =  write_fragment (start, stop,
-                                      file_name_stream.str().c_str());
+                                      fragment_name(argv[file_name_index],
+                                                    fragment).c_str(),
+                                      indexed);
         if (result != success) return result;
         start += lines_per_fragment;
         stop = start + lines_per_fragment;
@@ -112,6 +292,10 @@ int main (int argc, char *argv[]) {
     cout << nlv.size() << " lines" << endl;
     cout << fragments << " fragments" << endl;
     cout << lines_per_fragment << " lines_per_fragment" << endl;
+    cout << seed << " seed" << endl;
+#ifdef ALLOC_PROFILE_ENABLED
+    report_splitter_allocations(cout, nlv.size());
+#endif
 
     return success;
 }
\ No newline at end of file
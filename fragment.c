@@ -0,0 +1,573 @@
+/*
+fragment.c - manifest loading, the pending queue and the
+fragment and output I/O of the server
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "alloc_profile.h"
+#include "fragment.h"
+#include "fragment_format.h"
+#include "line_util.h"
+#include "log.h"
+
+#define FALSE 0
+#define TRUE 1
+
+#define BUFFER_RW_SIZE 1024
+
+int read_manifest(char * manifest, char ** output_path, struct fragment_info ** fragments,
+                  int * num_fragments)
+{
+    FILE * file_cmd_input = fopen(manifest, "r");
+    if(file_cmd_input == NULL)
+    {
+        return MANIFEST_MISSING;
+    }
+
+    //go through lines of file given file
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t nread;
+
+    if((nread = getline(&line, &size, file_cmd_input)) == -1)
+    {
+        fclose(file_cmd_input);
+        free(line);
+        return MANIFEST_NO_OUTPUT;
+    }
+
+    //turn end of line char '\n' into '\0'
+    if(line[nread - 1] == '\n')
+    {
+        line[nread - 1] = '\0';
+    }
+    *output_path = strdup(line);
+
+    struct fragment_info * opened = NULL;
+    int index = 0;
+    int capacity = 0;
+
+    while ((nread = getline(&line, &size, file_cmd_input)) != -1) {
+        if(line[nread - 1] == '\n')
+        {
+            line[nread - 1] = '\0';
+        }
+        //doubled as it fills, a manifest can name a great many fragments
+        if(index == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 16;
+            opened = (struct fragment_info *) realloc(opened, sizeof(struct fragment_info) * capacity);
+        }
+        memset(&opened[index], 0, sizeof(struct fragment_info));
+        opened[index].manifest_index = index;
+        opened[index].fd = -1;
+        opened[index].path = strdup(line);
+
+        //the header waits for open_fragment; the size is enough to
+        //schedule by
+        struct stat st;
+        if(stat(line, &st) == -1 || !S_ISREG(st.st_mode))
+        {
+            printf("Fragment[%d] did not open\nFile name given: %s\n", index, line);
+
+            //free this one and the ones before it
+            close_fragments(index + 1, opened);
+            free(line);
+            free(*output_path);
+            *output_path = NULL;
+            fclose(file_cmd_input);
+            return MANIFEST_BAD_FRAGMENT;
+        }
+
+        opened[index].size = st.st_size;
+        index++;
+    }
+
+    free(line);
+    fclose(file_cmd_input);
+
+    //size-aware scheduling: fragments are dispatched in this order
+    qsort(opened, index, sizeof(struct fragment_info), compare_fragment_size);
+
+    *fragments = opened;
+    *num_fragments = index;
+    return MANIFEST_OK;
+}
+
+//close up to n fragments
+void close_fragments(int n, struct fragment_info * fragments)
+{
+    for(int i = 0; i < n; i++)
+    {
+        concat_run_free(fragments[i].run);
+        free(fragments[i].path);
+        if(fragments[i].cached != NULL)
+        {
+            cache_release(fragments[i].cached);
+        }
+        else
+        {
+            if(fragments[i].mapped)
+            {
+                munmap(fragments[i].data, fragments[i].size);
+            }
+            if(fragments[i].fd != -1)
+            {
+                close(fragments[i].fd);
+            }
+        }
+    }
+    free(fragments);
+}
+
+int fd_cache_init(struct fd_cache * fds, int capacity)
+{
+    fds->slots = malloc(sizeof(struct fragment_info *) * capacity);
+    fds->head = 0;
+    fds->count = 0;
+    fds->capacity = capacity;
+    return fds->slots != NULL;
+}
+
+//the files themselves are closed by close_fragments
+void fd_cache_free(struct fd_cache * fds)
+{
+    free(fds->slots);
+    fds->slots = NULL;
+}
+
+void fd_cache_remove(struct fd_cache * fds, struct fragment_info * fragment)
+{
+    int kept = 0;
+    for(int i = 0; i < fds->count; i++)
+    {
+        struct fragment_info * held = fds->slots[(fds->head + i) % fds->capacity];
+        if(held != fragment)
+        {
+            fds->slots[(fds->head + kept) % fds->capacity] = held;
+            kept++;
+        }
+    }
+    fds->count = kept;
+}
+
+int open_fragment(struct fragment_info * fragment, struct fd_cache * fds)
+{
+    if(fragment->fd != -1 || fragment->cached != NULL)
+    {
+        return TRUE;
+    }
+    //mapped and then pushed out of the cache: the mapping is enough
+    if(fragment->data != NULL)
+    {
+        return TRUE;
+    }
+
+    if(fds != NULL && fds->count == fds->capacity)
+    {
+        struct fragment_info * oldest = fds->slots[fds->head];
+        close(oldest->fd);
+        oldest->fd = -1;
+        fds->head = (fds->head + 1) % fds->capacity;
+        fds->count--;
+    }
+
+    fragment->fd = open(fragment->path, O_RDONLY | O_CLOEXEC);
+    if(fragment->fd == -1)
+    {
+        printf("Fragment[%d] did not open\nFile name given: %s\n", fragment->manifest_index, fragment->path);
+        return FALSE;
+    }
+    if(!fragment->loaded)
+    {
+        if(!load_fragment_info(fragment))
+        {
+            printf("Fragment[%d] did not open\nFile name given: %s\n", fragment->manifest_index, fragment->path);
+            close(fragment->fd);
+            fragment->fd = -1;
+            return FALSE;
+        }
+        fragment->loaded = TRUE;
+    }
+
+    if(fds != NULL)
+    {
+        fds->slots[(fds->head + fds->count) % fds->capacity] = fragment;
+        fds->count++;
+    }
+    return TRUE;
+}
+
+int cache_fragment(struct fragment_info * fragment, struct fragment_cache * cache)
+{
+    if(fragment->cached != NULL)
+    {
+        return TRUE;
+    }
+    //already read from its file on an earlier dispatch; a cached copy
+    //could be a newer version of it
+    if(fragment->fd != -1 || fragment->data != NULL)
+    {
+        return FALSE;
+    }
+
+    struct cache_entry * entry = cache_acquire(cache, fragment->path);
+    if(entry == NULL)
+    {
+        return FALSE;
+    }
+    fragment->loaded = TRUE;
+    fragment->size = entry->size;
+    fragment->indexed = entry->indexed;
+    fragment->line_count = entry->line_count;
+    fragment->data = entry->data;
+    fragment->cached = entry;
+    return TRUE;
+}
+
+void prefetch_fragment(struct fragment_info * fragment, struct fd_cache * fds)
+{
+    if(fragment->fd != -1 || fragment->data != NULL || fragment->cached != NULL)
+    {
+        return;
+    }
+    if(open_fragment(fragment, fds))
+    {
+        posix_fadvise(fragment->fd, 0, 0, POSIX_FADV_WILLNEED);
+    }
+}
+
+//mapped once, on its first dispatch, and kept until the job ends
+int map_fragment(struct fragment_info * fragment)
+{
+    if(fragment->data != NULL)
+    {
+        return TRUE;
+    }
+    if(fragment->size == 0 || fragment->fd == -1)
+    {
+        return FALSE;
+    }
+
+    char * data = mmap(NULL, fragment->size, PROT_READ, MAP_PRIVATE, fragment->fd, 0);
+    if(data == MAP_FAILED)
+    {
+        log_warn("Could not map fragment %d: %s\n", fragment->manifest_index, strerror(errno));
+        return FALSE;
+    }
+    fragment->data = data;
+    fragment->mapped = TRUE;
+    return TRUE;
+}
+
+void release_fragment(struct fragment_info * fragment)
+{
+    if(fragment->cached != NULL)
+    {
+        cache_release(fragment->cached);
+        fragment->cached = NULL;
+        fragment->data = NULL;
+        return;
+    }
+    if(!fragment->mapped || fragment->shared_locally)
+    {
+        return;
+    }
+    munmap(fragment->data, fragment->size);
+    fragment->data = NULL;
+    fragment->mapped = FALSE;
+}
+
+//fill in size information for an opened fragment
+//indexed fragments are recognised by their header and checked
+//against the file size; anything else is a plain text fragment
+int load_fragment_info(struct fragment_info * fragment)
+{
+    struct stat st;
+    if(fstat(fragment->fd, &st) == -1)
+    {
+        return FALSE;
+    }
+
+    fragment->size = st.st_size;
+    fragment->indexed = FALSE;
+    fragment->line_count = 0;
+
+    struct fragment_header header;
+    if(fragment->size < sizeof(header))
+    {
+        return TRUE;
+    }
+
+    ssize_t n;
+    while((n = pread(fragment->fd, &header, sizeof(header), 0)) == -1 && errno == EINTR);
+    if(n != sizeof(header) || memcmp(header.magic, FRAGMENT_MAGIC, FRAGMENT_MAGIC_LEN) != 0)
+    {
+        return TRUE;
+    }
+
+    //checked piece by piece, so no sum can wrap
+    if(header.line_count > FRAGMENT_MAX_LINES ||
+       FRAGMENT_DATA_OFFSET(header.line_count) > fragment->size ||
+       header.text_bytes != fragment->size - FRAGMENT_DATA_OFFSET(header.line_count))
+    {
+        printf("Indexed fragment header does not match its size\n");
+        return FALSE;
+    }
+
+    fragment->indexed = TRUE;
+    fragment->line_count = header.line_count;
+    return TRUE;
+}
+
+//largest fragments first: the longest jobs start earliest,
+//which keeps the last client from finishing long after the rest
+int compare_fragment_size(const void * a, const void * b)
+{
+    const struct fragment_info * fa = a;
+    const struct fragment_info * fb = b;
+    if(fa->size != fb->size)
+    {
+        return (fa->size < fb->size) ? 1 : -1;
+    }
+    return fa->manifest_index - fb->manifest_index;
+}
+
+int queue_init(struct fragment_queue * queue, int capacity)
+{
+    queue->items = malloc(sizeof(int) * (capacity > 0 ? capacity : 1));
+    queue->head = 0;
+    queue->count = 0;
+    queue->capacity = capacity;
+    return queue->items != NULL;
+}
+
+void queue_push(struct fragment_queue * queue, int fragment)
+{
+    queue->items[(queue->head + queue->count) % queue->capacity] = fragment;
+    queue->count++;
+}
+
+int queue_pop(struct fragment_queue * queue)
+{
+    int fragment = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    return fragment;
+}
+
+int queue_back(struct fragment_queue * queue)
+{
+    return queue->items[(queue->head + queue->count - 1) % queue->capacity];
+}
+
+int queue_pop_back(struct fragment_queue * queue)
+{
+    int fragment = queue_back(queue);
+    queue->count--;
+    return fragment;
+}
+
+void prune_queue(struct fragment_queue * queue, struct fragment_info * fragments)
+{
+    while(queue->count > 0 && fragments[queue->items[queue->head]].done)
+    {
+        fragments[queue_pop(queue)].queued = FALSE;
+    }
+}
+
+void queue_fragment(struct fragment_queue * queue, struct fragment_info * fragments, int fragment)
+{
+    fragments[fragment].queued = TRUE;
+    queue_push(queue, fragment);
+}
+
+//to the client's socket, or its shared memory ring when it has one
+static int send_bytes(int cfd, struct shm_ring * ring, char * buf, size_t n)
+{
+    if(ring != NULL)
+    {
+        return shm_ring_write_all(ring, buf, n);
+    }
+    return write_all(cfd, buf, n);
+}
+
+//a cached or mapped fragment goes out straight from memory, otherwise it is
+//sent in byte ranges of BUFFER_RW_SIZE
+//pread is used so the fragment can be sent again from the start
+int send_fragment(int cfd, struct shm_ring * ring, struct fragment_info * fragment)
+{
+    if(fragment->data != NULL)
+    {
+        if(!send_bytes(cfd, ring, fragment->data, fragment->size))
+        {
+            log_error("Error Writing to Client: %s\n", strerror(errno));
+            return SEND_WRITE_FAILED;
+        }
+        return SEND_OK;
+    }
+
+    char buffer[BUFFER_RW_SIZE];
+    uint64_t offset = 0;
+
+    while(offset < fragment->size)
+    {
+        size_t want = BUFFER_RW_SIZE;
+        if(fragment->size - offset < want)
+        {
+            want = fragment->size - offset;
+        }
+
+        ssize_t bytesRead = pread(fragment->fd, buffer, want, offset);
+        if(bytesRead == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            log_error("Error Reading from a fragment file: %s\n", strerror(errno));
+            return SEND_READ_FAILED;
+        }
+        if(bytesRead == 0)
+        {
+            log_error("Fragment file shrank while sending\n");
+            return SEND_READ_FAILED;
+        }
+
+        if(!send_bytes(cfd, ring, buffer, bytesRead))
+        {
+            log_error("Error Writing to Client: %s\n", strerror(errno));
+            return SEND_WRITE_FAILED;
+        }
+
+        offset += bytesRead;
+    }
+
+    return SEND_OK;
+}
+
+int send_end_message(int cfd, struct shm_ring * ring)
+{
+    char * end_message = "EOF\n";
+    if(!send_bytes(cfd, ring, end_message, strlen(end_message)))
+    {
+        log_error("Error Writing to Client: %s\n", strerror(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+//where the output goes, and what was written
+struct output_sink
+{
+    int fd;
+    uint64_t * lines;
+    uint64_t * bytes;
+    uint64_t * freed;
+};
+
+//write the text of one line, without its number, and free it
+static int write_line(void * arg, int line_num, char * line, int length)
+{
+    struct output_sink * out = arg;
+    (void) line_num;
+
+    //echo the line when debug logging is compiled in
+    log_debug("%s", line);
+
+    //find index of space
+    int index = position_delim(line, length + 1, ' ');
+
+    int ok = TRUE;
+    if(index != -1)
+    {
+        //write to output file
+        int total_write = length - index - 1;
+        ok = write_all(out->fd, line + index + 1, total_write);
+        if(ok)
+        {
+            (*out->lines)++;
+            *out->bytes += total_write;
+        }
+    }
+    if(out->freed != NULL)
+    {
+        *out->freed += length;
+    }
+    prof_free(ALLOC_SITE_LINE, line);
+    return ok;
+}
+
+int write_output(struct line_index * index, int fd, uint64_t * lines, uint64_t * bytes)
+{
+    struct output_sink out = {fd, lines, bytes, NULL};
+    return line_index_take_all(index, write_line, &out);
+}
+
+int write_ready_output(struct line_index * index, int fd, int * next_line,
+                       uint64_t * lines, uint64_t * bytes, uint64_t * freed)
+{
+    struct output_sink out = {fd, lines, bytes, freed};
+    int ok = line_index_take_ready(index, write_line, &out);
+    *next_line = line_index_next_line(index);
+    return ok;
+}
+
+int write_concat_output(struct fragment_info * fragments, int num_fragments, int fd,
+                        int * next_run, int * next_line, uint64_t * lines, uint64_t * bytes)
+{
+    while(*next_run < num_fragments)
+    {
+        //the array is in dispatch order, the output in manifest order
+        struct fragment_info * fragment = NULL;
+        for(int f = 0; f < num_fragments && fragment == NULL; f++)
+        {
+            if(fragments[f].manifest_index == *next_run)
+            {
+                fragment = &fragments[f];
+            }
+        }
+        if(fragment == NULL || fragment->run == NULL)
+        {
+            return CONCAT_OK;
+        }
+
+        struct concat_run * run = fragment->run;
+        if(run->broken)
+        {
+            printf("Fragment %d does not hold one range of lines\n", fragment->manifest_index);
+            return CONCAT_NOT_RANGES;
+        }
+        if(run->lines > 0 && run->first_line != *next_line)
+        {
+            printf("Fragment %d holds lines %d to %d, but the output is at line %d\n",
+                   fragment->manifest_index, run->first_line, run->next_line - 1, *next_line);
+            return CONCAT_NOT_RANGES;
+        }
+        if(!write_all(fd, run->text, run->len))
+        {
+            return CONCAT_WRITE_FAILED;
+        }
+        *lines += run->lines;
+        *bytes += run->len;
+        if(run->lines > 0)
+        {
+            *next_line = run->next_line;
+        }
+        concat_run_free(run);
+        fragment->run = NULL;
+        (*next_run)++;
+    }
+    return CONCAT_OK;
+}
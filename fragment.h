@@ -0,0 +1,180 @@
+/*
+fragment.h - the server's side of a job's fragments: reading the
+manifest, the pending queue, sending a fragment to a client and
+writing the merged output. Shared by the single job server and the
+daemon.
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#ifndef FRAGMENT_H
+#define FRAGMENT_H
+
+#include <stdint.h>
+
+#include "fragment_cache.h"
+#include "ingest.h"
+#include "line_index.h"
+#include "shm_ring.h"
+
+//read_manifest return values
+#define MANIFEST_OK 0
+#define MANIFEST_MISSING 1
+#define MANIFEST_NO_OUTPUT 2
+#define MANIFEST_BAD_FRAGMENT 3
+
+//send_fragment return values
+#define SEND_OK 0
+#define SEND_READ_FAILED 1
+#define SEND_WRITE_FAILED 2
+
+//write_concat_output return values
+#define CONCAT_OK 0
+#define CONCAT_WRITE_FAILED 1
+#define CONCAT_NOT_RANGES 2
+
+//what the server knows about a fragment before sending it
+//the manifest is checked with stat alone; a fragment is opened and
+//its header read when it is first dispatched or prefetched
+struct fragment_info
+{
+    char * path;
+    //-1 while it is not open, or when the contents come from the cache
+    int fd;
+    int manifest_index;
+    //the header has been read, so indexed and line_count are known
+    int loaded;
+    int indexed;
+    uint64_t line_count;
+    uint64_t size;
+    //cached or mapped contents, NULL if read from fd
+    char * data;
+    struct cache_entry * cached;
+    int mapped;
+    //a local sort thread was given the mapping, which it may still
+    //be reading after its copy was cancelled
+    int shared_locally;
+    //--concat: the winning result, until the output reaches it
+    struct concat_run * run;
+
+    //scheduling state
+    int done;
+    int queued;
+    //connections working on it now, and copies sent since it last
+    //had none
+    int running;
+    int copies;
+    uint64_t start_ns;
+};
+
+//the fragment files held open, oldest first; opening one more
+//than 'capacity' closes the oldest. Mapped fragments stay mapped
+struct fd_cache
+{
+    struct fragment_info ** slots;
+    int head;
+    int count;
+    int capacity;
+};
+
+//fragments waiting for a client, in dispatch order
+//a fragment whose client dies goes back on the end, so the
+//queue never holds more than every fragment once
+struct fragment_queue
+{
+    int * items;
+    int head;
+    int count;
+    int capacity;
+};
+
+//stat every fragment named in a manifest and list them largest first,
+//with the scheduling state cleared. Nothing is opened yet, see
+//open_fragment. *output_path is malloc'd
+//returns MANIFEST_OK or the first problem found
+int read_manifest(char * manifest, char ** output_path, struct fragment_info ** fragments,
+                  int * num_fragments);
+
+//close up to n fragments, release their cache entries and free the
+//results they still hold
+void close_fragments(int n, struct fragment_info * fragments);
+
+int fd_cache_init(struct fd_cache * fds, int capacity);
+void fd_cache_free(struct fd_cache * fds);
+
+//forget a fragment that is about to be closed elsewhere, keeping the
+//order of the rest
+void fd_cache_remove(struct fd_cache * fds, struct fragment_info * fragment);
+
+//open a fragment's file if it is not open, reading its header the
+//first time; with 'fds' the oldest file it holds may be closed to make
+//room, without it the file stays open until close_fragments
+//returns 1 on success, or if the contents are already in memory
+int open_fragment(struct fragment_info * fragment, struct fd_cache * fds);
+
+//take a fragment that is about to be dispatched from 'cache', holding
+//the entry until release_fragment; returns 1 if its contents are in
+//fragment->data, 0 if it is to be read from its file
+int cache_fragment(struct fragment_info * fragment, struct fragment_cache * cache);
+
+//open a fragment that is about to be dispatched and have the kernel
+//start reading it in
+void prefetch_fragment(struct fragment_info * fragment, struct fd_cache * fds);
+
+//map a fragment that is read from its file, so permutation results
+//can be copied out of it; returns 1 if fragment->data can be used
+//the fragment has to be open
+int map_fragment(struct fragment_info * fragment);
+
+//unmap a finished fragment, or give back its cache entry, so a job
+//with many fragments does not hold a mapping for each; left alone if
+//a local thread had it
+void release_fragment(struct fragment_info * fragment);
+
+//fill in size information for an opened fragment
+int load_fragment_info(struct fragment_info * fragment);
+
+//largest fragments first, then manifest order
+int compare_fragment_size(const void * a, const void * b);
+
+int queue_init(struct fragment_queue * queue, int capacity);
+void queue_push(struct fragment_queue * queue, int fragment);
+int queue_pop(struct fragment_queue * queue);
+
+//the other end: the smallest fragment of the first pass
+int queue_back(struct fragment_queue * queue);
+int queue_pop_back(struct fragment_queue * queue);
+
+//drop queued fragments that a speculative copy finished in the meantime
+void prune_queue(struct fragment_queue * queue, struct fragment_info * fragments);
+
+void queue_fragment(struct fragment_queue * queue, struct fragment_info * fragments, int fragment);
+
+//send a whole fragment to a client, through 'ring' instead of the
+//socket when it is not NULL; returns SEND_OK or what failed
+int send_fragment(int cfd, struct shm_ring * ring, struct fragment_info * fragment);
+
+//send the "EOF\n" that follows a fragment; returns 1 on success
+int send_end_message(int cfd, struct shm_ring * ring);
+
+//write the text of every line in the index, in line order, and empty it
+//*lines and *bytes are increased by what was written; returns 1 on success
+int write_output(struct line_index * index, int fd, uint64_t * lines, uint64_t * bytes);
+
+//write lines from the front of the index for as long as they carry
+//the next line number, so only lines that came early stay in memory
+//*next_line is set to the line the output now waits for and *freed
+//is increased by the bytes taken out of the index; returns 1 on success
+int write_ready_output(struct line_index * index, int fd, int * next_line,
+                       uint64_t * lines, uint64_t * bytes, uint64_t * freed);
+
+//--concat: append the finished runs that come next in manifest order
+//to the output, as they are, and free them. *next_run is the manifest
+//index the output waits for and *next_line the line it has to start
+//with. Returns CONCAT_OK, CONCAT_WRITE_FAILED, or CONCAT_NOT_RANGES
+//if a run is not the range that follows the one before it
+int write_concat_output(struct fragment_info * fragments, int num_fragments, int fd,
+                        int * next_run, int * next_line, uint64_t * lines, uint64_t * bytes);
+
+#endif
@@ -0,0 +1,236 @@
+/*
+fragment_cache.c - LRU cache of mapped fragments
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fragment_cache.h"
+#include "fragment.h"
+#include "log.h"
+
+#define FALSE 0
+#define TRUE 1
+
+//FNV-1a
+static unsigned bucket_of(const char * path)
+{
+    uint32_t hash = 2166136261u;
+    for(const char * c = path; *c != '\0'; c++)
+    {
+        hash = (hash ^ (unsigned char) *c) * 16777619u;
+    }
+    return hash % CACHE_BUCKETS;
+}
+
+static void list_unlink(struct fragment_cache * cache, struct cache_entry * entry)
+{
+    if(entry->prev != NULL)
+    {
+        entry->prev->next = entry->next;
+    }
+    else
+    {
+        cache->head = entry->next;
+    }
+    if(entry->next != NULL)
+    {
+        entry->next->prev = entry->prev;
+    }
+    else
+    {
+        cache->tail = entry->prev;
+    }
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void list_push_front(struct fragment_cache * cache, struct cache_entry * entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if(cache->head != NULL)
+    {
+        cache->head->prev = entry;
+    }
+    cache->head = entry;
+    if(cache->tail == NULL)
+    {
+        cache->tail = entry;
+    }
+}
+
+//take an entry out of the lookup, it stays mapped until freed
+static void detach(struct fragment_cache * cache, struct cache_entry * entry)
+{
+    struct cache_entry ** link = &cache->buckets[bucket_of(entry->path)];
+    while(*link != entry)
+    {
+        link = &(*link)->bucket_next;
+    }
+    *link = entry->bucket_next;
+    list_unlink(cache, entry);
+    cache->num_entries--;
+}
+
+static void free_entry(struct fragment_cache * cache, struct cache_entry * entry)
+{
+    munmap(entry->data, entry->size);
+    cache->bytes -= entry->size;
+    free(entry->path);
+    free(entry);
+}
+
+//evict unreferenced entries from the cold end until under budget
+static void shrink(struct fragment_cache * cache)
+{
+    struct cache_entry * entry = cache->tail;
+    while(cache->bytes > cache->capacity && entry != NULL)
+    {
+        struct cache_entry * prev = entry->prev;
+        if(entry->refs == 0)
+        {
+            detach(cache, entry);
+            free_entry(cache, entry);
+            cache->evictions++;
+        }
+        entry = prev;
+    }
+}
+
+void cache_init(struct fragment_cache * cache, uint64_t capacity)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->capacity = capacity;
+}
+
+//map a fragment that is not cached yet
+static struct cache_entry * load_entry(struct fragment_cache * cache, const char * path)
+{
+    struct fragment_info info;
+    memset(&info, 0, sizeof(info));
+    info.fd = open(path, O_RDONLY);
+    if(info.fd == -1)
+    {
+        return NULL;
+    }
+
+    struct stat st;
+    if(fstat(info.fd, &st) == -1 || !load_fragment_info(&info) ||
+       info.size == 0 || info.size > cache->capacity)
+    {
+        close(info.fd);
+        return NULL;
+    }
+
+    //populated now so the first send does not fault the pages in
+    char * data = mmap(NULL, info.size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, info.fd, 0);
+    close(info.fd);
+    if(data == MAP_FAILED)
+    {
+        log_warn("Could not map fragment %s, reading it from the file\n", path);
+        return NULL;
+    }
+
+    struct cache_entry * entry = calloc(1, sizeof(struct cache_entry));
+    entry->path = strdup(path);
+    entry->size = info.size;
+    entry->mtime = st.st_mtim;
+    entry->data = data;
+    entry->indexed = info.indexed;
+    entry->line_count = info.line_count;
+    entry->cache = cache;
+    return entry;
+}
+
+struct cache_entry * cache_acquire(struct fragment_cache * cache, const char * path)
+{
+    struct stat st;
+    if(stat(path, &st) == -1)
+    {
+        return NULL;
+    }
+
+    unsigned bucket = bucket_of(path);
+    struct cache_entry * entry = cache->buckets[bucket];
+    while(entry != NULL && strcmp(entry->path, path) != 0)
+    {
+        entry = entry->bucket_next;
+    }
+
+    if(entry != NULL && ((uint64_t) st.st_size != entry->size ||
+                         st.st_mtim.tv_sec != entry->mtime.tv_sec ||
+                         st.st_mtim.tv_nsec != entry->mtime.tv_nsec))
+    {
+        //the file changed: jobs still sending the old one keep it
+        detach(cache, entry);
+        if(entry->refs == 0)
+        {
+            free_entry(cache, entry);
+        }
+        else
+        {
+            entry->stale = TRUE;
+        }
+        entry = NULL;
+    }
+
+    if(entry != NULL)
+    {
+        cache->hits++;
+        list_unlink(cache, entry);
+        list_push_front(cache, entry);
+        entry->refs++;
+        return entry;
+    }
+
+    cache->misses++;
+    entry = load_entry(cache, path);
+    if(entry == NULL)
+    {
+        return NULL;
+    }
+
+    entry->refs = 1;
+    entry->bucket_next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    list_push_front(cache, entry);
+    cache->num_entries++;
+    cache->bytes += entry->size;
+    shrink(cache);
+    return entry;
+}
+
+void cache_release(struct cache_entry * entry)
+{
+    struct fragment_cache * cache = entry->cache;
+    entry->refs--;
+    if(entry->refs > 0)
+    {
+        return;
+    }
+    if(entry->stale)
+    {
+        free_entry(cache, entry);
+        return;
+    }
+    shrink(cache);
+}
+
+void cache_destroy(struct fragment_cache * cache)
+{
+    while(cache->head != NULL)
+    {
+        struct cache_entry * entry = cache->head;
+        detach(cache, entry);
+        free_entry(cache, entry);
+    }
+}
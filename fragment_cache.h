@@ -0,0 +1,80 @@
+/*
+fragment_cache.h - size-bounded LRU cache of fragment contents for
+the daemon, so fragments that come up in job after job are sent from
+memory instead of being reopened and reread.
+
+Entries are keyed by path and checked against the file's size and
+mtime on every lookup; a file that changed is mapped again. Contents
+are kept as read-only mmaps populated up front, along with what
+load_fragment_info found (indexed or not, line count), so a hit does
+no fragment I/O at all.
+
+A job holds a reference on an entry from when the fragment is handed
+to a worker until its results are in. Only unreferenced entries are
+evicted, least recently used first, so the cache only goes over its
+budget while the fragments out on workers need more than it holds.
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#ifndef FRAGMENT_CACHE_H
+#define FRAGMENT_CACHE_H
+
+#include <stdint.h>
+#include <time.h>
+
+//hash buckets for the path lookup
+#define CACHE_BUCKETS 1024
+
+struct fragment_cache;
+
+struct cache_entry
+{
+    char * path;
+    uint64_t size;
+    struct timespec mtime;
+    char * data;
+    int indexed;
+    uint64_t line_count;
+
+    //jobs using it; it is only evicted at 0
+    int refs;
+    //replaced by a newer version of the file, freed at 0 refs
+    int stale;
+
+    //least recently used list, most recent first
+    struct cache_entry * prev;
+    struct cache_entry * next;
+    struct cache_entry * bucket_next;
+    struct fragment_cache * cache;
+};
+
+struct fragment_cache
+{
+    uint64_t capacity;
+    uint64_t bytes;
+    int num_entries;
+    struct cache_entry * head;
+    struct cache_entry * tail;
+    struct cache_entry * buckets[CACHE_BUCKETS];
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+void cache_init(struct fragment_cache * cache, uint64_t capacity);
+
+//referenced entry for the fragment at 'path', mapping it on a miss
+//returns NULL if it should be read from the file instead: it cannot
+//be opened or mapped, is empty or is bigger than the whole cache
+struct cache_entry * cache_acquire(struct fragment_cache * cache, const char * path);
+
+//drop a reference taken by cache_acquire
+void cache_release(struct cache_entry * entry);
+
+//unmap everything; no entry may still be referenced
+void cache_destroy(struct fragment_cache * cache);
+
+#endif
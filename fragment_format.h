@@ -0,0 +1,60 @@
+/*
+fragment_format.h - on-disk layout of an indexed fragment.
+
+An indexed fragment is a fixed header, a table with one entry per
+line, then the raw text block. The text block holds the same
+"<num> <text>\n" records a plain fragment would, so the records
+can be sent back verbatim; the table lets a reader find and order
+them without scanning or parsing the text.
+
+    struct fragment_header                       (24 bytes)
+    struct fragment_index_entry [line_count]     (24 bytes each)
+    text block                                   (text_bytes)
+
+Integers are stored in host byte order: fragments are produced and
+consumed by machines in the same cluster.
+
+Shared by file_shuffle_cut.cpp (writer), server.c and client.c.
+*/
+
+#ifndef FRAGMENT_FORMAT_H
+#define FRAGMENT_FORMAT_H
+
+#include <stdint.h>
+
+#define FRAGMENT_MAGIC "FRAGIDX1"
+#define FRAGMENT_MAGIC_LEN 8
+
+struct fragment_header
+{
+    char magic[FRAGMENT_MAGIC_LEN];
+    uint64_t line_count;
+    //size of the text block only
+    uint64_t text_bytes;
+};
+
+struct fragment_index_entry
+{
+    uint64_t line_num;
+    //offset of the record from the start of the text block
+    uint64_t offset;
+    //record length including the trailing '\n'
+    uint32_t length;
+    uint32_t reserved;
+};
+
+//bytes in front of the text block
+#define FRAGMENT_DATA_OFFSET(line_count) \
+    (sizeof(struct fragment_header) + (line_count) * sizeof(struct fragment_index_entry))
+
+//headers come off disk or the network: a line_count above this would
+//wrap FRAGMENT_DATA_OFFSET, so check it before using the macro
+#define FRAGMENT_MAX_LINES \
+    ((SIZE_MAX - sizeof(struct fragment_header)) / sizeof(struct fragment_index_entry))
+
+//an entry's record lies inside a text block of text_bytes, checked
+//without adding offset and length, which could wrap
+#define FRAGMENT_ENTRY_FITS(entry, text_bytes) \
+    ((entry).offset <= (text_bytes) && (entry).length <= (text_bytes) - (entry).offset)
+
+#endif
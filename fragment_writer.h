@@ -0,0 +1,239 @@
+// File: fragment_writer.h
+// Purpose: writing fragment files, shared by the splitter and the corpus
+//          generator.  Covers plain and indexed fragments (see
+//          fragment_format.h) and the bounded-memory scatter used to split
+//          inputs that do not fit in memory.
+//
+//          Functions report failure by returning false after printing which
+//          file could not be opened, leaving the exit code to the caller.
+
+#ifndef FRAGMENT_WRITER_H
+#define FRAGMENT_WRITER_H
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <stdint.h>
+#include "shuffle_engine.h"
+#include "fragment_format.h"
+#include "counting_allocator.h"
+
+// builds the name of a fragment file from the input file name
+inline std::string fragment_name (const char * file_name, int fragment) {
+    std::ostringstream file_name_stream;
+    file_name_stream << file_name << "_" << fragment;
+    return file_name_stream.str();
+}
+
+// writes already numbered "<num> <text>" records (no trailing newline) as
+// an indexed fragment: header, one table entry per record, then the text
+template <typename Records>
+bool write_indexed_fragment (const std::vector<uint64_t> & numbers,
+                             const Records & records, const char * filename)
+{
+    std::ofstream ofs (filename, std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!ofs) {
+        std::cout << "Could not open output file " <<  filename << std::endl;
+        return false;
+    }
+
+    fragment_header header;
+    memcpy(header.magic, FRAGMENT_MAGIC, FRAGMENT_MAGIC_LEN);
+    header.line_count = records.size();
+    header.text_bytes = 0;
+
+    std::vector<fragment_index_entry> table (records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        table[i].line_num = numbers[i];
+        table[i].offset = header.text_bytes;
+        table[i].length = records[i].size() + 1;
+        table[i].reserved = 0;
+        header.text_bytes += table[i].length;
+    }
+
+    ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    if (!table.empty()) {
+        ofs.write(reinterpret_cast<const char *>(&table[0]),
+                  table.size() * sizeof(fragment_index_entry));
+    }
+    for (size_t i = 0; i < records.size(); ++i) {
+        ofs << records[i] << '\n';
+    }
+
+    return static_cast<bool>(ofs);
+}
+
+// shuffles the lines of one fragment file in place and/or rewrites it in
+// the indexed format; a fragment holds about 1/fragments of the input, so
+// this is the only pass that needs memory proportional to the data
+inline bool finish_fragment_file (const std::string & name, xoshiro256 rng,
+                                  bool shuffle, bool indexed)
+{
+    std::vector<splitter_string, splitter_allocator<splitter_string> > lines;
+    {
+        std::ifstream ifs (name.c_str());
+        if (!ifs) {
+            std::cout << "Could not open file " << name << std::endl;
+            return false;
+        }
+        splitter_string text;
+        while (getline(ifs, text)) {
+            lines.push_back(text);
+        }
+    }
+
+    if (shuffle) {
+        fisher_yates (lines.begin(), lines.end(), rng);
+    }
+
+    if (indexed) {
+        std::vector<uint64_t> numbers (lines.size());
+        for (size_t i = 0; i < lines.size(); ++i) {
+            numbers[i] = strtoull(lines[i].c_str(), NULL, 10);
+        }
+        return write_indexed_fragment(numbers, lines, name.c_str());
+    }
+
+    std::ofstream ofs (name.c_str(), std::ios::out | std::ios::trunc);
+    if (!ofs) {
+        std::cout << "Could not open output file " << name << std::endl;
+        return false;
+    }
+    for (auto iter = lines.begin(); iter != lines.end(); ++iter) {
+        ofs << *iter << '\n';
+    }
+    return true;
+}
+
+// scatters numbered lines to randomly chosen fragments through bounded
+// per-fragment buffers, then optionally shuffles within each fragment
+// (scatter + in-bucket shuffle yields a uniformly random permutation).
+// Memory is O(fragments x buffer_bytes) until finish() runs.
+class fragment_scatter {
+public:
+    fragment_scatter (const char * base_name, int fragments,
+                      size_t buffer_bytes, uint64_t seed)
+        : buckets_ (fragments), buffer_bytes_ (buffer_bytes),
+          seed_ (seed), rng_ (seed), lines_ (0), range_lines_ (0)
+    {
+        for (int fragment = 0; fragment < fragments; ++fragment) {
+            buckets_[fragment].name = fragment_name(base_name, fragment + 1);
+            buckets_[fragment].buffer.reserve(buffer_bytes);
+        }
+    }
+
+    // range partitioning (--range): line n goes to fragment
+    // n / (total_lines / fragments), the last fragment taking the rest,
+    // so each fragment is one contiguous range of line numbers
+    void use_ranges (uint64_t total_lines) {
+        range_lines_ = total_lines / buckets_.size();
+        if (range_lines_ == 0) range_lines_ = 1;
+    }
+
+    // routes one line to a random fragment, or the fragment of its range,
+    // flushing that fragment's buffer to disk once it reaches the bound
+    bool add (uint64_t number, const std::string & text) {
+        size_t fragment = range_lines_ == 0 ? rng_.bounded(buckets_.size())
+                          : std::min<uint64_t>(number / range_lines_, buckets_.size() - 1);
+        bucket & b = buckets_[fragment];
+        b.buffer += std::to_string(number);
+        b.buffer += ' ';
+        b.buffer += text;
+        b.buffer += '\n';
+        b.lines++;
+        lines_++;
+
+        if (b.buffer.size() >= buffer_bytes_) {
+            return flush(b);
+        }
+        return true;
+    }
+
+    // flushes the tails, which also creates fragments that got no lines,
+    // then runs the optional per-fragment pass one fragment per thread;
+    // each thread holds a whole fragment in memory
+    bool finish (bool shuffle, bool indexed, unsigned threads) {
+        for (size_t fragment = 0; fragment < buckets_.size(); ++fragment) {
+            if (!flush(buckets_[fragment])) return false;
+        }
+
+        if (!shuffle && !indexed) {
+            return true;
+        }
+
+        std::vector<char> ok (buckets_.size(), 1);
+        run_parallel(buckets_.size(), threads, [&] (size_t fragment) {
+            ok[fragment] = finish_fragment_file(
+                buckets_[fragment].name,
+                xoshiro256::stream(seed_, fragment + 1),
+                shuffle, indexed);
+        });
+        for (size_t fragment = 0; fragment < ok.size(); ++fragment) {
+            if (!ok[fragment]) return false;
+        }
+        return true;
+    }
+
+    size_t lines () const { return lines_; }
+
+    size_t min_lines () const {
+        size_t result = lines_;
+        for (size_t i = 0; i < buckets_.size(); ++i) {
+            if (buckets_[i].lines < result) result = buckets_[i].lines;
+        }
+        return result;
+    }
+
+    size_t max_lines () const {
+        size_t result = 0;
+        for (size_t i = 0; i < buckets_.size(); ++i) {
+            if (buckets_[i].lines > result) result = buckets_[i].lines;
+        }
+        return result;
+    }
+
+    const std::string & name (int fragment) const {
+        return buckets_[fragment].name;
+    }
+
+private:
+    // a fragment being filled: only one file is open at a time
+    struct bucket {
+        bucket () : started(false), lines(0) {}
+        std::string name;
+        std::string buffer;
+        bool started;
+        size_t lines;
+    };
+
+    // appends whatever a bucket has buffered to its fragment file; the
+    // first flush truncates so that reruns do not append to stale fragments
+    static bool flush (bucket & b) {
+        std::ofstream ofs (b.name.c_str(),
+                           b.started ? std::ios::out | std::ios::app
+                                     : std::ios::out | std::ios::trunc);
+        if (!ofs) {
+            std::cout << "Could not open output file " << b.name << std::endl;
+            return false;
+        }
+        ofs << b.buffer;
+        b.buffer.clear();
+        b.started = true;
+        return true;
+    }
+
+    std::vector<bucket> buckets_;
+    size_t buffer_bytes_;
+    uint64_t seed_;
+    xoshiro256 rng_;
+    size_t lines_;
+    // lines per fragment with use_ranges, 0 for a random scatter
+    uint64_t range_lines_;
+};
+
+#endif // FRAGMENT_WRITER_H
@@ -0,0 +1,349 @@
+/*
+ingest.c - splitting received results into lines for the line index, or
+copying them out of the fragment for permutation results. With --concat
+the lines are appended to the reader's run instead
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "alloc_profile.h"
+#include "ingest.h"
+#include "line_util.h"
+#include "log.h"
+#include "stats.h"
+
+#define FALSE 0
+#define TRUE 1
+
+#define DELIMITER '\n'
+
+//smallest allocation of a run's text
+#define RUN_MIN_CAPACITY 4096
+
+void line_reader_init(struct line_reader * reader)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->kind = RESULT_UNKNOWN;
+}
+
+void line_reader_free(struct line_reader * reader)
+{
+    if(reader->line)
+    {
+        prof_free(ALLOC_SITE_LINE, reader->line);
+    }
+    line_reader_init(reader);
+}
+
+void line_reader_set_fragment(struct line_reader * reader, const char * fragment,
+                              uint64_t fragment_size, FILE * spill)
+{
+    reader->fragment = fragment;
+    reader->fragment_size = fragment_size;
+    reader->spill = spill;
+}
+
+void line_reader_set_run(struct line_reader * reader, struct concat_run * run)
+{
+    reader->run = run;
+}
+
+struct concat_run * concat_run_new(void)
+{
+    return calloc(1, sizeof(struct concat_run));
+}
+
+void concat_run_free(struct concat_run * run)
+{
+    if(run == NULL)
+    {
+        return;
+    }
+    free(run->text);
+    free(run);
+}
+
+//append the text of a line, after its number, to a run
+//a line without a space has no text, as in the merged output
+static void append_run(struct concat_run * run, int line_num, char * line, int length)
+{
+    if(run->lines > 0 && line_num != run->next_line)
+    {
+        if(!run->broken)
+        {
+            log_limited(LOG_WARN, "line %d came after line %d, the fragment is not a range\n",
+                        line_num, run->next_line - 1);
+        }
+        run->broken = TRUE;
+    }
+    if(run->lines == 0)
+    {
+        run->first_line = line_num;
+    }
+    run->lines++;
+    run->next_line = line_num == INT_MAX ? INT_MAX : line_num + 1;
+
+    int index = position_delim(line, length, ' ');
+    if(index == -1)
+    {
+        return;
+    }
+    uint64_t text_len = length - index - 1;
+    if(run->len + text_len > run->capacity)
+    {
+        uint64_t capacity = run->capacity ? run->capacity * 2 : RUN_MIN_CAPACITY;
+        while(capacity < run->len + text_len)
+        {
+            capacity *= 2;
+        }
+        run->text = realloc(run->text, capacity);
+        run->capacity = capacity;
+    }
+    memcpy(run->text + run->len, line + index + 1, text_len);
+    run->len += text_len;
+}
+
+//put one received line in the index, which takes 'line', or in the
+//reader's run
+static void add_line(struct line_reader * reader, char * line, int line_num, int length,
+                     struct line_index * idx, struct ingest_counts * counts)
+{
+    if(reader->run != NULL)
+    {
+        append_run(reader->run, line_num, line, length);
+        prof_free(ALLOC_SITE_LINE, line);
+        counts->lines++;
+        return;
+    }
+
+    uint64_t insert_start = stats_now();
+    prof_phase(PHASE_INSERT);
+    int added = line_index_add(idx, line_num, line, length);
+    prof_phase(PHASE_PARSE);
+    counts->insert_ns += stats_now() - insert_start;
+
+    counts->lines++;
+    if(!added)
+    {
+        //already in the index, or already in the output
+        counts->duplicates++;
+        return;
+    }
+    counts->bytes += length;
+    counts->last_line = line_num;
+}
+
+static int ingest_text(struct line_reader * reader, char * buf, int len,
+                       struct line_index * idx, struct ingest_counts * counts)
+{
+    int index;
+    int last_index = 0;
+
+    if(reader->spill != NULL)
+    {
+        //a short write shows up when the spill is committed
+        fwrite(buf, 1, len, reader->spill);
+    }
+
+    //each time we find the next delim, we start where we left off by adding last_index
+    while ((index = position_delim(buf + last_index, len - last_index, DELIMITER)) != -1) {
+
+        //index does not start from beggining every time
+        //so the indexes need to be accumulated
+        index += last_index;
+
+        get_mem_for_line(&reader->line, &reader->line_index, &reader->curr_len_line, index - last_index + 1);
+
+        reader->line[reader->curr_len_line] = '\0';
+
+        // Copy the message fragment that ends at the delimiter.
+        memcpy(reader->line + reader->line_index, buf + last_index, index - last_index + 1);
+
+        if(strcmp(reader->line, "EOF\n") == 0)
+        {
+            line_reader_free(reader);
+            return TRUE;
+        }
+
+        int line_num;
+        if(sscanf(reader->line, "%d", &line_num) != 1)
+        {
+            //badly formatted input
+            counts->malformed++;
+            log_limited(LOG_WARN, "received badly formatted line (skipping): %s\n", reader->line);
+            prof_free(ALLOC_SITE_LINE, reader->line);
+        }
+        else
+        {
+            add_line(reader, reader->line, line_num, reader->curr_len_line, idx, counts);
+        }
+        reader->line = NULL;
+
+        // Reset for a new message.
+        reader->line_index = 0;
+        reader->curr_len_line = 0;
+
+        //move past the delim
+        last_index = index + 1;
+    }
+
+    //keep the start of a line that continues in the next read
+    if(last_index < len)
+    {
+        int copy_len = len - last_index;
+        // grow our line buffer by exactly copy_len bytes
+        get_mem_for_line(&reader->line, &reader->line_index, &reader->curr_len_line, copy_len);
+        // copy just those bytes
+        memcpy(reader->line + reader->line_index, buf + last_index, copy_len);
+        reader->line_index += copy_len;
+    }
+
+    return FALSE;
+}
+
+//copy the record a permutation entry points at into the index
+//the entry is checked against the fragment, not trusted
+static void add_record(struct line_reader * reader,
+                       struct line_index * idx, struct ingest_counts * counts)
+{
+    uint64_t line_num = reader->prev_line + reader->fields[0];
+    uint64_t offset = reader->fields[1];
+    uint64_t length = reader->fields[2];
+    reader->prev_line = line_num;
+
+    if(line_num > INT_MAX || reader->fragment == NULL || length == 0 ||
+       offset > reader->fragment_size || length > reader->fragment_size - offset ||
+       reader->fragment[offset + length - 1] != DELIMITER)
+    {
+        counts->malformed++;
+        log_limited(LOG_WARN, "received bad permutation entry (skipping): line %llu at %llu+%llu\n",
+                    (unsigned long long) line_num, (unsigned long long) offset,
+                    (unsigned long long) length);
+        return;
+    }
+
+    const char * record = reader->fragment + offset;
+    if(reader->spill != NULL)
+    {
+        fwrite(record, 1, length, reader->spill);
+    }
+
+    //a run copies the text anyway, so it goes straight from the fragment
+    if(reader->run != NULL)
+    {
+        append_run(reader->run, (int) line_num, (char *) record, (int) length);
+        counts->lines++;
+        return;
+    }
+
+    char * line = prof_malloc(ALLOC_SITE_LINE, length + 1);
+    memcpy(line, record, length);
+    line[length] = '\0';
+    add_line(reader, line, (int) line_num, (int) length, idx, counts);
+}
+
+static int ingest_permutation(struct line_reader * reader, char * buf, int len,
+                              struct line_index * idx, struct ingest_counts * counts)
+{
+    const char * end_message = "EOF\n";
+
+    for(int i = 0; i < len; i++)
+    {
+        unsigned char byte = buf[i];
+
+        //after the last entry only "EOF\n" is left
+        if(reader->have_count && reader->remaining == 0)
+        {
+            if(byte != (unsigned char) end_message[reader->end_matched])
+            {
+                counts->malformed++;
+                log_limited(LOG_WARN, "received bytes past the last permutation entry (skipping)\n");
+                reader->end_matched = 0;
+                continue;
+            }
+            reader->end_matched++;
+            if(end_message[reader->end_matched] == '\0')
+            {
+                line_reader_free(reader);
+                return TRUE;
+            }
+            continue;
+        }
+
+        //bits past 64 are dropped, so an overlong varint just
+        //fails the checks in add_record
+        if(reader->varint_shift < 64)
+        {
+            reader->varint |= (uint64_t) (byte & 0x7f) << reader->varint_shift;
+        }
+        reader->varint_shift += 7;
+        if(byte & 0x80)
+        {
+            continue;
+        }
+
+        uint64_t value = reader->varint;
+        reader->varint = 0;
+        reader->varint_shift = 0;
+
+        if(!reader->have_count)
+        {
+            reader->remaining = value;
+            reader->have_count = TRUE;
+            continue;
+        }
+
+        reader->fields[reader->field++] = value;
+        if(reader->field == RESULT_FIELDS)
+        {
+            reader->field = 0;
+            reader->remaining--;
+            add_record(reader, idx, counts);
+        }
+    }
+
+    return FALSE;
+}
+
+int ingest_chunk(struct line_reader * reader, char * buf, int len,
+                 struct line_index * idx, struct ingest_counts * counts)
+{
+    int start = 0;
+
+    if(reader->kind == RESULT_UNKNOWN)
+    {
+        //hold bytes back while they could still be the magic
+        while(start < len && reader->magic_len < RESULT_MAGIC_LEN &&
+              buf[start] == RESULT_MAGIC[reader->magic_len])
+        {
+            reader->magic[reader->magic_len++] = buf[start++];
+        }
+
+        if(reader->magic_len == RESULT_MAGIC_LEN)
+        {
+            reader->kind = RESULT_PERMUTATION;
+        }
+        else if(start < len)
+        {
+            //the held back bytes were the start of a text line
+            reader->kind = RESULT_TEXT;
+            ingest_text(reader, reader->magic, reader->magic_len, idx, counts);
+        }
+        else
+        {
+            return FALSE;
+        }
+    }
+
+    if(reader->kind == RESULT_PERMUTATION)
+    {
+        return ingest_permutation(reader, buf + start, len - start, idx, counts);
+    }
+    return ingest_text(reader, buf + start, len - start, idx, counts);
+}
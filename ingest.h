@@ -0,0 +1,122 @@
+/*
+ingest.h - turns the "<num> <text>\n" results a client sends back
+into line index entries. Reads arrive in arbitrary pieces, so a line cut
+off at the end of one read is kept in a line_reader until the rest
+of it comes in.
+
+Results in the permutation format of result_format.h are told apart
+by their first bytes; their lines are copied out of the fragment the
+client was sent instead.
+
+With --concat the fragments are ranges of line numbers, so a result
+is kept as one run of text in place of going into the index.
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "line_index.h"
+#include "result_format.h"
+
+enum result_kind
+{
+    //not enough bytes seen yet to tell
+    RESULT_UNKNOWN,
+    RESULT_TEXT,
+    RESULT_PERMUTATION
+};
+
+//--concat: the result of one fragment, the text of its lines without
+//their numbers, which have to come in as a run of consecutive numbers
+struct concat_run
+{
+    char * text;
+    uint64_t len;
+    uint64_t capacity;
+    uint64_t lines;
+    //number of the first line and the one the next line has to carry
+    int first_line;
+    int next_line;
+    //a line came out of order, so the result is not one range
+    int broken;
+};
+
+//the partial line of one connection between reads
+struct line_reader
+{
+    char * line;
+    int line_index;
+    int curr_len_line;
+
+    enum result_kind kind;
+    //start of the stream while it could still be the magic
+    char magic[RESULT_MAGIC_LEN];
+    int magic_len;
+
+    //where results are saved for a checkpoint, NULL for nowhere:
+    //text as it was received, permutations as the lines they name
+    FILE * spill;
+    //where lines go in place of the index, NULL for the index
+    struct concat_run * run;
+    //permutation results: the fragment the client was sent
+    const char * fragment;
+    uint64_t fragment_size;
+
+    //permutation results: the varint being read, the fields of the
+    //line so far and how much of the stream is left
+    uint64_t varint;
+    int varint_shift;
+    int field;
+    uint64_t fields[RESULT_FIELDS];
+    int have_count;
+    uint64_t remaining;
+    uint64_t prev_line;
+    int end_matched;
+};
+
+//what one chunk added, for the stats
+struct ingest_counts
+{
+    uint64_t lines;
+    uint64_t duplicates;
+    uint64_t malformed;
+    //bytes of the lines that went into the index, and the number of
+    //the last one
+    uint64_t bytes;
+    int last_line;
+    //time spent inside the index inserts
+    uint64_t insert_ns;
+};
+
+void line_reader_init(struct line_reader * reader);
+
+//the fragment whose results come next, and where to save them
+void line_reader_set_fragment(struct line_reader * reader, const char * fragment,
+                              uint64_t fragment_size, FILE * spill);
+
+//keep the lines of the fragment in 'run' instead of the index
+void line_reader_set_run(struct line_reader * reader, struct concat_run * run);
+
+//free a partial line that will never be finished
+void line_reader_free(struct line_reader * reader);
+
+//allocate an empty run; returns NULL if out of memory
+struct concat_run * concat_run_new(void);
+
+void concat_run_free(struct concat_run * run);
+
+//add every complete line in buf to the index, or the reader's run,
+//and keep the rest
+//safe to call from several threads for different readers
+//'counts' is added to, not cleared
+//returns 1 once "EOF\n" is reached; anything after it is ignored
+int ingest_chunk(struct line_reader * reader, char * buf, int len,
+                 struct line_index * idx, struct ingest_counts * counts);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ingest_pool.c - parsing and inserting results on several threads
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc_profile.h"
+#include "ingest_pool.h"
+#include "log.h"
+#include "stats.h"
+
+#define FALSE 0
+#define TRUE 1
+
+void ingest_task_run(struct ingest_task * task, struct line_index * index)
+{
+    uint64_t start = stats_now();
+    memset(&task->counts, 0, sizeof(task->counts));
+    prof_phase(PHASE_PARSE);
+    task->finished = ingest_chunk(task->reader, task->buf, task->len, index, &task->counts);
+    prof_phase(ALLOC_PHASE_OTHER);
+    task->ns = stats_now() - start;
+}
+
+//take tasks of the current batch until there are none left
+//called and returns with the lock held
+static void take_tasks(struct ingest_pool * pool)
+{
+    while(pool->next_task < pool->num_tasks)
+    {
+        struct ingest_task * task = &pool->tasks[pool->next_task++];
+        pthread_mutex_unlock(&pool->lock);
+        ingest_task_run(task, pool->index);
+        pthread_mutex_lock(&pool->lock);
+
+        if(--pool->unfinished == 0)
+        {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+}
+
+static void * ingest_loop(void * arg)
+{
+    struct ingest_pool * pool = arg;
+    unsigned int seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while(TRUE)
+    {
+        while(pool->batch == seen && !pool->stopping)
+        {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if(pool->stopping)
+        {
+            break;
+        }
+        seen = pool->batch;
+        take_tasks(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+int ingest_pool_start(struct ingest_pool * pool, int num_threads, struct line_index * index)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->index = index;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    pool->threads = malloc(sizeof(pthread_t) * num_threads);
+    for(int i = 0; i < num_threads; i++)
+    {
+        int err = pthread_create(&pool->threads[i], NULL, ingest_loop, pool);
+        if(err != 0)
+        {
+            log_error("Could not start ingest thread: %s\n", strerror(err));
+            ingest_pool_stop(pool);
+            return FALSE;
+        }
+        pool->num_threads++;
+    }
+    return TRUE;
+}
+
+void ingest_pool_run(struct ingest_pool * pool, struct ingest_task * tasks, int n)
+{
+    if(n == 1)
+    {
+        //nothing to share out
+        ingest_task_run(&tasks[0], pool->index);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->tasks = tasks;
+    pool->num_tasks = n;
+    pool->next_task = 0;
+    pool->unfinished = n;
+    pool->batch++;
+    pthread_cond_broadcast(&pool->start);
+
+    take_tasks(pool);
+    while(pool->unfinished > 0)
+    {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pool->tasks = NULL;
+    pool->num_tasks = 0;
+    pool->next_task = 0;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void ingest_pool_stop(struct ingest_pool * pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = TRUE;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(int i = 0; i < pool->num_threads; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    pool->threads = NULL;
+    pool->num_threads = 0;
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+}
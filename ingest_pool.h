@@ -0,0 +1,73 @@
+/*
+ingest_pool.h - threads that parse and insert the results of several
+connections at once.
+
+The event loop still does every read. Each pass it reads one chunk
+from every connection that is ready, hands the whole batch to the
+pool and waits for it, then does the bookkeeping for each chunk in
+order as before. A connection has at most one chunk in a batch, so its
+line_reader is only touched by one thread at a time, and all inserts
+go to a line index (line_index.h) built for concurrent writers.
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#ifndef INGEST_POOL_H
+#define INGEST_POOL_H
+
+#include <pthread.h>
+
+#include "ingest.h"
+#include "line_index.h"
+
+//what the server reads from a connection per pass when there is a
+//pool, so a chunk is worth handing to another thread
+#define INGEST_CHUNK_BYTES (64 * 1024)
+
+struct ingest_task
+{
+    //the connection the chunk came from, for the caller
+    void * owner;
+    struct line_reader * reader;
+    char * buf;
+    int len;
+    //results, filled in by ingest_chunk
+    struct ingest_counts counts;
+    int finished;
+    //time the task took, parsing and inserting
+    uint64_t ns;
+};
+
+struct ingest_pool
+{
+    pthread_t * threads;
+    int num_threads;
+    struct line_index * index;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    //the batch being run: tasks not yet taken, and not yet finished
+    struct ingest_task * tasks;
+    int num_tasks;
+    int next_task;
+    int unfinished;
+    //counts batches, so a thread never runs the same one twice
+    unsigned int batch;
+    int stopping;
+};
+
+//run the ingest of a single task, on whatever thread calls it
+void ingest_task_run(struct ingest_task * task, struct line_index * index);
+
+//start num_threads threads inserting into 'index'; returns 1 on success
+int ingest_pool_start(struct ingest_pool * pool, int num_threads, struct line_index * index);
+
+//ingest n tasks and return once all of them are done; the calling
+//thread takes tasks as well
+void ingest_pool_run(struct ingest_pool * pool, struct ingest_task * tasks, int n);
+
+void ingest_pool_stop(struct ingest_pool * pool);
+
+#endif
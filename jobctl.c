@@ -0,0 +1,115 @@
+/*
+jobctl.c - sends one command to a server running with --daemon
+and prints the reply.
+
+    ./jobctl <control socket> SUBMIT <manifest> [priority]
+    ./jobctl <control socket> WAIT <job id>
+    ./jobctl <control socket> STATUS
+    ./jobctl <control socket> SHUTDOWN
+
+Manifest and fragment paths are opened by the daemon, so relative
+paths are taken from the daemon's working directory. The exit status
+is non-zero if the daemon answered ERROR or FAILED.
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define FALSE 0
+#define TRUE 1
+
+//main function return values
+#define SUCCESS 0
+#define INCORRECT_CMD_ARGS 1
+#define SOCKET_ISSUE 2
+#define COMMAND_FAILED 3
+
+#define SOCKET_ARG 1
+#define COMMAND_ARG 2
+#define MIN_ARGS 3
+
+#define COMMAND_MAX (PATH_MAX + 64)
+
+int usage(char * message)
+{
+    printf("Expected ./jobctl <control socket> SUBMIT <manifest> [priority] | WAIT <job id> | STATUS | SHUTDOWN\n%s\n",
+           message);
+    return INCORRECT_CMD_ARGS;
+}
+
+int main(int argc, char * argv[])
+{
+    if(argc < MIN_ARGS)
+    {
+        return usage("missing command");
+    }
+
+    //the command words are sent as one line
+    char command[COMMAND_MAX];
+    int len = 0;
+    for(int i = COMMAND_ARG; i < argc; i++)
+    {
+        len += snprintf(command + len, COMMAND_MAX - len, "%s%s", i > COMMAND_ARG ? " " : "", argv[i]);
+        if(len >= COMMAND_MAX - 1)
+        {
+            return usage("command too long");
+        }
+    }
+    command[len++] = '\n';
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(argv[SOCKET_ARG]) >= sizeof(addr.sun_path))
+    {
+        return usage("control socket path is too long");
+    }
+    strcpy(addr.sun_path, argv[SOCKET_ARG]);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+    {
+        printf("Error Connecting to %s: %s\n", argv[SOCKET_ARG], strerror(errno));
+        return SOCKET_ISSUE;
+    }
+
+    if(write(fd, command, len) != len)
+    {
+        printf("Error Sending Command: %s\n", strerror(errno));
+        close(fd);
+        return SOCKET_ISSUE;
+    }
+
+    //STATUS ends with an END line, everything else is one line
+    int multi_line = strcmp(argv[COMMAND_ARG], "STATUS") == 0;
+    FILE * replies = fdopen(fd, "r");
+    char * line = NULL;
+    size_t size = 0;
+    int ret = SOCKET_ISSUE;
+    while(getline(&line, &size, replies) != -1)
+    {
+        fputs(line, stdout);
+        if(strncmp(line, "ERROR", 5) == 0 || strncmp(line, "FAILED", 6) == 0)
+        {
+            ret = COMMAND_FAILED;
+            break;
+        }
+        if(!multi_line || strcmp(line, "END\n") == 0)
+        {
+            ret = SUCCESS;
+            break;
+        }
+    }
+    free(line);
+    fclose(replies);
+    return ret;
+}
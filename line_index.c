@@ -0,0 +1,219 @@
+/*
+line_index.c - received lines sharded by line number
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "alloc_profile.h"
+#include "line_index.h"
+
+#define FALSE 0
+#define TRUE 1
+
+//a line taken out of a shard, to be handed to the sink unlocked
+struct taken_line
+{
+    int line_num;
+    char * line;
+    int length;
+};
+
+static int block_of(int line_num)
+{
+    //an arithmetic shift keeps negative numbers in order as well
+    return line_num >> LINE_INDEX_BLOCK_BITS;
+}
+
+static struct line_shard * shard_of(struct line_index * index, int line_num)
+{
+    return &index->shards[(unsigned int) block_of(line_num) & (index->num_shards - 1)];
+}
+
+int line_index_init(struct line_index * index, int num_shards, int next_line)
+{
+    int shards = 1;
+    while(shards * 2 <= num_shards)
+    {
+        shards *= 2;
+    }
+
+    index->shards = malloc(sizeof(struct line_shard) * shards);
+    if(index->shards == NULL)
+    {
+        return FALSE;
+    }
+    index->num_shards = shards;
+    for(int s = 0; s < shards; s++)
+    {
+        pthread_mutex_init(&index->shards[s].lock, NULL);
+        index->shards[s].root = NULL;
+        index->shards[s].bytes = 0;
+    }
+    __atomic_store_n(&index->next_line, next_line, __ATOMIC_RELAXED);
+    return TRUE;
+}
+
+void line_index_free(struct line_index * index)
+{
+    if(index->shards == NULL)
+    {
+        return;
+    }
+    for(int s = 0; s < index->num_shards; s++)
+    {
+        free_tree(index->shards[s].root);
+        pthread_mutex_destroy(&index->shards[s].lock);
+    }
+    free(index->shards);
+    index->shards = NULL;
+}
+
+int line_index_add(struct line_index * index, int line_num, char * line, int length)
+{
+    struct line_shard * shard = shard_of(index, line_num);
+    int duplicate = 0;
+
+    pthread_mutex_lock(&shard->lock);
+    //the output only moves past a line under this lock
+    if(line_num < __atomic_load_n(&index->next_line, __ATOMIC_RELAXED))
+    {
+        duplicate = 1;
+        prof_free(ALLOC_SITE_LINE, line);
+    }
+    else
+    {
+        shard->root = add_checked(shard->root, line_num, line, length, &duplicate);
+        if(!duplicate)
+        {
+            shard->bytes += length;
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return !duplicate;
+}
+
+uint64_t line_index_bytes(struct line_index * index)
+{
+    uint64_t bytes = 0;
+    for(int s = 0; s < index->num_shards; s++)
+    {
+        pthread_mutex_lock(&index->shards[s].lock);
+        bytes += index->shards[s].bytes;
+        pthread_mutex_unlock(&index->shards[s].lock);
+    }
+    return bytes;
+}
+
+int line_index_next_line(struct line_index * index)
+{
+    return __atomic_load_n(&index->next_line, __ATOMIC_RELAXED);
+}
+
+//take the smallest line of a shard out; the caller holds its lock
+static void take_min(struct line_shard * shard, struct taken_line * taken)
+{
+    struct btree * min_node = find_min(shard->root);
+    taken->line_num = min_node->line_num;
+    taken->line = min_node->line;
+    taken->length = min_node->line_length;
+    shard->bytes -= min_node->line_length;
+
+    //delete_node frees the line, so it is taken out first
+    min_node->line = NULL;
+    shard->root = delete_node(shard->root, min_node);
+}
+
+//hand n taken lines to the sink; if it fails the rest are freed
+static int drain(struct taken_line * taken, int n, line_index_sink sink, void * arg)
+{
+    for(int i = 0; i < n; i++)
+    {
+        if(!sink(arg, taken[i].line_num, taken[i].line, taken[i].length))
+        {
+            for(int j = i + 1; j < n; j++)
+            {
+                prof_free(ALLOC_SITE_LINE, taken[j].line);
+            }
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+int line_index_take_ready(struct line_index * index, line_index_sink sink, void * arg)
+{
+    struct taken_line taken[LINE_INDEX_BLOCK_LINES];
+    while(TRUE)
+    {
+        int next = line_index_next_line(index);
+        struct line_shard * shard = shard_of(index, next);
+        int block = block_of(next);
+        int n = 0;
+
+        //the rest of next's block is in this shard
+        pthread_mutex_lock(&shard->lock);
+        while(next != INT_MAX && block_of(next) == block && shard->root != NULL &&
+              find_min(shard->root)->line_num == next)
+        {
+            take_min(shard, &taken[n++]);
+            next++;
+            __atomic_store_n(&index->next_line, next, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&shard->lock);
+
+        if(!drain(taken, n, sink, arg))
+        {
+            return FALSE;
+        }
+        //stopped inside the block: the next line has not come in yet
+        if(n == 0 || block_of(next) == block)
+        {
+            return TRUE;
+        }
+    }
+}
+
+int line_index_take_all(struct line_index * index, line_index_sink sink, void * arg)
+{
+    struct taken_line taken[LINE_INDEX_BLOCK_LINES];
+    while(TRUE)
+    {
+        //the smallest line left starts the next block to write out
+        struct line_shard * shard = NULL;
+        int smallest = 0;
+        for(int s = 0; s < index->num_shards; s++)
+        {
+            struct btree * root = index->shards[s].root;
+            if(root != NULL && (shard == NULL || find_min(root)->line_num < smallest))
+            {
+                shard = &index->shards[s];
+                smallest = find_min(root)->line_num;
+            }
+        }
+        if(shard == NULL)
+        {
+            return TRUE;
+        }
+
+        //every line of that block, which the shard holds in order
+        int block = block_of(smallest);
+        int n = 0;
+        while(shard->root != NULL && block_of(find_min(shard->root)->line_num) == block)
+        {
+            take_min(shard, &taken[n++]);
+        }
+        if(n > 0 && taken[n - 1].line_num != INT_MAX)
+        {
+            __atomic_store_n(&index->next_line, taken[n - 1].line_num + 1, __ATOMIC_RELAXED);
+        }
+        if(!drain(taken, n, sink, arg))
+        {
+            return FALSE;
+        }
+    }
+}
@@ -0,0 +1,89 @@
+/*
+line_index.h - the received lines of a job, keyed by line number,
+split into shards so several threads can insert at once.
+
+Line numbers go to shards in blocks of LINE_INDEX_BLOCK_LINES: block
+b lives in shard b % num_shards, and each shard is an AVL tree
+(btree.h) behind its own lock. Clients send their lines in order and
+move through the line numbers at about the same pace, so consecutive
+blocks in different shards keep them from queueing on one lock.
+
+The output walks the blocks in order, so only the shard holding the
+next line is locked while it is written. Lines below next_line were
+written out already; inserts of them are dropped as duplicates under
+the same shard lock that moved next_line past them.
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "btree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LINE_INDEX_BLOCK_BITS 6
+#define LINE_INDEX_BLOCK_LINES (1 << LINE_INDEX_BLOCK_BITS)
+//shards when more than one thread inserts, a power of two
+#define LINE_INDEX_SHARDS 64
+
+struct line_shard
+{
+    pthread_mutex_t lock;
+    struct btree * root;
+    //bytes of line text in root
+    uint64_t bytes;
+};
+
+struct line_index
+{
+    struct line_shard * shards;
+    //a power of two
+    int num_shards;
+    //only moved by the output, under the lock of the shard it leaves;
+    //read and written with __atomic builtins, so C++ can include this
+    int next_line;
+};
+
+//'num_shards' is rounded down to a power of two; lines below
+//'next_line' are dropped as duplicates, INT_MIN keeps everything
+//returns 1 on success
+int line_index_init(struct line_index * index, int num_shards, int next_line);
+
+//free every line still in the index
+void line_index_free(struct line_index * index);
+
+//put a line in the index, which takes 'line'; safe from any thread
+//returns 1 if it was added, 0 if it was a duplicate and freed
+int line_index_add(struct line_index * index, int line_num, char * line, int length);
+
+//bytes of line text in the index
+uint64_t line_index_bytes(struct line_index * index);
+
+int line_index_next_line(struct line_index * index);
+
+//called with each line in order as it comes out of the index; the
+//callback takes 'line'. Returns 1 to go on
+typedef int (*line_index_sink)(void * arg, int line_num, char * line, int length);
+
+//take the lines that carry next_line and the numbers after it out of
+//the index, in order, for as long as there are no gaps
+//returns 0 if the sink failed
+int line_index_take_ready(struct line_index * index, line_index_sink sink, void * arg);
+
+//take every line out of the index in order, gaps and all
+//not safe while other threads insert; returns 0 if the sink failed
+int line_index_take_all(struct line_index * index, line_index_sink sink, void * arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
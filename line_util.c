@@ -0,0 +1,72 @@
+/*
+line_util.c - helpers for splitting a byte stream into lines and
+writing them out
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "alloc_profile.h"
+#include "line_util.h"
+
+//get position of delim for messages
+int position_delim(char * str, int len, char delim)
+{
+	for(int i = 0; i < len; i++)
+	{
+		if(str[i] == delim)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+//for writing to a string with a current length 
+//and an index where writing will happen (line_index)
+void get_mem_for_line(char ** line, int * line_index, int * curr_len_line, int amount)
+{
+    //case 1: line has nothing in it rn
+    if(*line == NULL)
+    {
+        *line_index = 0;
+        *curr_len_line = amount;
+
+        //1 additional char for end string '\0'
+        *line = prof_malloc(ALLOC_SITE_LINE, (*curr_len_line + 1) * sizeof(char));
+        
+    }
+    //case 2: line has something in it already
+    else
+    {
+        *line_index = *curr_len_line;
+        *curr_len_line += amount;
+
+        //should already have the additional char for end string '\0'
+        *line = prof_realloc(ALLOC_SITE_LINE, *line, (*curr_len_line + 1) * sizeof(char));
+
+    }
+}
+
+int write_all(int fd, const char * buf, size_t n)
+{
+    size_t total = 0;
+    while(total != n)
+    {
+        ssize_t written = write(fd, buf + total, n - total);
+        if(written == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return 0;
+        }
+        total += written;
+    }
+    return 1;
+}
@@ -0,0 +1,36 @@
+/*
+line_util.h - helpers for splitting a byte stream into
+'\n' terminated lines and writing them out, shared by the server
+and the client
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#ifndef LINE_UTIL_H
+#define LINE_UTIL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//get position of delim for messages
+//returns -1 if delim is not in the first len chars
+int position_delim(char * str, int len, char delim);
+
+//for writing to a string with a current length 
+//and an index where writing will happen (line_index)
+//grows *line by amount chars (plus room for '\0')
+void get_mem_for_line(char ** line, int * line_index, int * curr_len_line, int amount);
+
+//write all n bytes, retrying on interruption
+//returns 1 on success, 0 with errno set if a write failed
+int write_all(int fd, const char * buf, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
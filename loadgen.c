@@ -0,0 +1,893 @@
+/*
+loadgen.c - load generator that plays many clients from one
+process. It opens up to --concurrency connections at once to the
+server, receives each fragment, sorts it and sends it back the way
+client.c does, all from a single epoll loop, so thousands of clients
+cost a few kilobytes each instead of a process each.
+
+Each connection can be made to misbehave:
+
+    --sort-delay ms      wait before sending results back
+    --throttle bps       send results at most bps bytes/s
+    --slow-reader bps    read the fragment at most bps bytes/s
+    --disconnect-at k    hang up after reading k fragment bytes
+    --disconnect-frac f  ...on this fraction of connections (default 1)
+    --malformed f        add a malformed line before this fraction of results
+
+and at the end it prints one JSON object with the counts, the
+throughput the server sustained and connect / first byte /
+fragment / turnaround latency percentiles.
+
+Example, against a server started on a 2000 fragment manifest:
+    ./loadgen --port 8080 --clients 2000 --concurrency 500 --sort-delay 5
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "fragment_format.h"
+#include "stats.h"
+
+#define FALSE 0
+#define TRUE 1
+
+//main function return values
+#define SUCCESS 0
+#define INCORRECT_CMD_ARGS 1
+#define SETUP_FAILED 2
+#define RUN_FAILED 3
+
+#define DECIMAL_NUM 10
+
+#define DEFAULT_HOST "127.0.0.1"
+#define DEFAULT_CLIENTS 1
+#define DEFAULT_SEED 1
+
+#define READ_CHUNK 65536
+#define MAX_EVENTS 256
+
+#define NS_PER_S 1000000000ULL
+#define NS_PER_MS 1000000ULL
+#define BYTES_PER_MB (1024.0 * 1024.0)
+
+#define END_MESSAGE "EOF\n"
+#define END_MESSAGE_LEN 4
+
+//fragment_complete return values
+#define FRAGMENT_INCOMPLETE 0
+#define FRAGMENT_COMPLETE 1
+#define FRAGMENT_BAD_HEADER 2
+#define MALFORMED_LINE "loadgen malformed line\n"
+
+struct loadgen_options
+{
+    char * host;
+    int port;
+    long clients;
+    long concurrency;
+    long sort_delay_ms;
+    long throttle_bps;
+    long slow_read_bps;
+    long disconnect_at;
+    double disconnect_frac;
+    double malformed_frac;
+    long seed;
+};
+
+enum conn_state
+{
+    CONN_IDLE,
+    CONN_CONNECTING,
+    CONN_RECEIVING,
+    CONN_DELAYING,
+    CONN_SENDING,
+    CONN_DONE,
+    CONN_FAILED,
+    CONN_DROPPED
+};
+
+//one simulated client
+struct conn
+{
+    int id;
+    int fd;
+    enum conn_state state;
+    uint32_t armed;
+    int drop;
+    uint64_t rng;
+
+    //fragment as received, and the length it will have once complete
+    //(0 until known)
+    char * in;
+    size_t in_len;
+    size_t in_cap;
+    size_t expect_len;
+
+    //sorted results to send back
+    char * out;
+    size_t out_len;
+    size_t out_off;
+
+    uint64_t start_ns;
+    uint64_t connected_ns;
+    uint64_t first_byte_ns;
+    uint64_t eof_ns;
+    uint64_t phase_ns;
+    uint64_t wake_ns;
+};
+
+//one line of a fragment, by position in the received buffer
+struct lg_line
+{
+    uint64_t num;
+    size_t offset;
+    size_t length;
+};
+
+//latencies reported, all from the start of the connect
+enum lg_latency
+{
+    LG_CONNECT,
+    LG_FIRST_BYTE,
+    LG_FRAGMENT,
+    LG_TURNAROUND,
+    LG_NUM_LATENCIES
+};
+
+static const char * lg_latency_names[LG_NUM_LATENCIES] = {
+    "connect", "first_byte", "fragment", "turnaround"
+};
+
+struct loadgen_totals
+{
+    long done;
+    long failed;
+    long dropped;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t lines;
+    uint64_t malformed;
+    struct latency_hist latencies[LG_NUM_LATENCIES];
+};
+
+static int epfd;
+static long num_open = 0;
+static long num_finished = 0;
+//earliest wake_ns of any connection, 0 if none
+static uint64_t next_wake_ns = 0;
+static struct loadgen_options opt;
+static struct loadgen_totals totals;
+
+int usage(char * message)
+{
+    printf("Expected ./loadgen --port n [--host ip] [--clients n] [--concurrency n]\n"
+           "                   [--sort-delay ms] [--throttle bps] [--slow-reader bps]\n"
+           "                   [--disconnect-at k] [--disconnect-frac f] [--malformed f] [--seed n]\n%s\n", message);
+    return INCORRECT_CMD_ARGS;
+}
+
+int string_to_long(long * num, char * str)
+{
+    char *end;
+    errno = 0;
+    *num = strtol(str, &end, DECIMAL_NUM);
+    if(end == str || *end != '\0' || errno == ERANGE)
+    {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+int string_to_fraction(double * num, char * str)
+{
+    char *end;
+    *num = strtod(str, &end);
+    return end != str && *end == '\0' && *num >= 0.0 && *num <= 1.0;
+}
+
+//splitmix64, one stream per connection
+uint64_t next_random(uint64_t * state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+double next_fraction(uint64_t * state)
+{
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int compare_lg_line(const void * a, const void * b)
+{
+    const struct lg_line * la = a;
+    const struct lg_line * lb = b;
+    if(la->num == lb->num)
+    {
+        return 0;
+    }
+    return (la->num < lb->num) ? -1 : 1;
+}
+
+void set_events(struct conn * c, uint32_t events)
+{
+    if(c->armed == events)
+    {
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = c;
+    if(epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) == 0)
+    {
+        c->armed = events;
+    }
+}
+
+void finish_conn(struct conn * c, enum conn_state state)
+{
+    uint64_t now = stats_now();
+
+    //closing removes it from the epoll set
+    if(c->fd != -1)
+    {
+        close(c->fd);
+    }
+    c->fd = -1;
+    c->state = state;
+    num_open--;
+    num_finished++;
+
+    if(state == CONN_DONE)
+    {
+        totals.done++;
+        hist_record(&totals.latencies[LG_CONNECT], c->connected_ns - c->start_ns);
+        hist_record(&totals.latencies[LG_FIRST_BYTE], c->first_byte_ns - c->start_ns);
+        hist_record(&totals.latencies[LG_FRAGMENT], c->eof_ns - c->start_ns);
+        hist_record(&totals.latencies[LG_TURNAROUND], now - c->start_ns);
+    }
+    else if(state == CONN_DROPPED)
+    {
+        totals.dropped++;
+    }
+    else
+    {
+        totals.failed++;
+    }
+
+    free(c->in);
+    free(c->out);
+    c->in = NULL;
+    c->out = NULL;
+}
+
+//work out the complete length of the fragment once enough has arrived
+//plain fragments end at a line that is exactly "EOF\n"
+//returns FRAGMENT_COMPLETE, FRAGMENT_INCOMPLETE, or FRAGMENT_BAD_HEADER
+//if an indexed header's sizes cannot be added up
+int fragment_complete(struct conn * c)
+{
+    if(c->expect_len == 0 && c->in_len >= sizeof(struct fragment_header) &&
+       memcmp(c->in, FRAGMENT_MAGIC, FRAGMENT_MAGIC_LEN) == 0)
+    {
+        struct fragment_header header;
+        memcpy(&header, c->in, sizeof(header));
+        //checked piece by piece as client.c does, so no sum can wrap
+        if(header.line_count > FRAGMENT_MAX_LINES ||
+           FRAGMENT_DATA_OFFSET(header.line_count) > SIZE_MAX - END_MESSAGE_LEN ||
+           header.text_bytes > SIZE_MAX - END_MESSAGE_LEN - FRAGMENT_DATA_OFFSET(header.line_count))
+        {
+            return FRAGMENT_BAD_HEADER;
+        }
+        c->expect_len = FRAGMENT_DATA_OFFSET(header.line_count) + header.text_bytes + END_MESSAGE_LEN;
+    }
+
+    if(c->expect_len != 0)
+    {
+        return c->in_len >= c->expect_len ? FRAGMENT_COMPLETE : FRAGMENT_INCOMPLETE;
+    }
+
+    if(c->in_len < END_MESSAGE_LEN ||
+       memcmp(c->in + c->in_len - END_MESSAGE_LEN, END_MESSAGE, END_MESSAGE_LEN) != 0)
+    {
+        return FRAGMENT_INCOMPLETE;
+    }
+    return c->in_len == END_MESSAGE_LEN || c->in[c->in_len - END_MESSAGE_LEN - 1] == '\n' ?
+           FRAGMENT_COMPLETE : FRAGMENT_INCOMPLETE;
+}
+
+//sort the received fragment into the results to send back
+//returns FALSE if out of memory
+int build_results(struct conn * c)
+{
+    struct lg_line * lines = NULL;
+    size_t num_lines = 0;
+    char * text;
+
+    if(c->expect_len != 0)
+    {
+        //indexed: the table already has every record's line number
+        struct fragment_header header;
+        memcpy(&header, c->in, sizeof(header));
+        text = c->in + FRAGMENT_DATA_OFFSET(header.line_count);
+
+        //fragment_complete bounded line_count by the table's size, not by this
+        if(header.line_count > SIZE_MAX / sizeof(struct lg_line) - 1)
+        {
+            return FALSE;
+        }
+        lines = malloc(sizeof(struct lg_line) * (header.line_count + 1));
+        if(lines == NULL)
+        {
+            return FALSE;
+        }
+        for(uint64_t i = 0; i < header.line_count; i++)
+        {
+            struct fragment_index_entry entry;
+            memcpy(&entry, c->in + sizeof(header) + i * sizeof(entry), sizeof(entry));
+            if(!FRAGMENT_ENTRY_FITS(entry, header.text_bytes))
+            {
+                continue;
+            }
+            lines[num_lines].num = entry.line_num;
+            lines[num_lines].offset = entry.offset;
+            lines[num_lines].length = entry.length;
+            num_lines++;
+        }
+    }
+    else
+    {
+        text = c->in;
+        size_t text_len = c->in_len - END_MESSAGE_LEN;
+        size_t cap = 0;
+        size_t start = 0;
+        while(start < text_len)
+        {
+            char * nl = memchr(text + start, '\n', text_len - start);
+            size_t end = nl ? (size_t) (nl - text) + 1 : text_len;
+
+            char * num_end;
+            unsigned long long num = strtoull(text + start, &num_end, DECIMAL_NUM);
+            if(num_end != text + start)
+            {
+                if(num_lines == cap)
+                {
+                    cap = cap ? cap * 2 : 1024;
+                    struct lg_line * grown = realloc(lines, sizeof(struct lg_line) * cap);
+                    if(grown == NULL)
+                    {
+                        free(lines);
+                        return FALSE;
+                    }
+                    lines = grown;
+                }
+                lines[num_lines].num = num;
+                lines[num_lines].offset = start;
+                lines[num_lines].length = end - start;
+                num_lines++;
+            }
+            start = end;
+        }
+    }
+
+    qsort(lines, num_lines, sizeof(struct lg_line), compare_lg_line);
+
+    //worst case every line gets a malformed line in front of it
+    size_t out_cap = END_MESSAGE_LEN;
+    for(size_t i = 0; i < num_lines; i++)
+    {
+        out_cap += lines[i].length;
+    }
+    if(opt.malformed_frac > 0.0)
+    {
+        out_cap += num_lines * strlen(MALFORMED_LINE);
+    }
+
+    c->out = malloc(out_cap);
+    if(c->out == NULL)
+    {
+        free(lines);
+        return FALSE;
+    }
+
+    c->out_len = 0;
+    for(size_t i = 0; i < num_lines; i++)
+    {
+        if(opt.malformed_frac > 0.0 && next_fraction(&c->rng) < opt.malformed_frac)
+        {
+            memcpy(c->out + c->out_len, MALFORMED_LINE, strlen(MALFORMED_LINE));
+            c->out_len += strlen(MALFORMED_LINE);
+            totals.malformed++;
+        }
+        memcpy(c->out + c->out_len, text + lines[i].offset, lines[i].length);
+        c->out_len += lines[i].length;
+    }
+    memcpy(c->out + c->out_len, END_MESSAGE, END_MESSAGE_LEN);
+    c->out_len += END_MESSAGE_LEN;
+    c->out_off = 0;
+    totals.lines += num_lines;
+
+    free(lines);
+    free(c->in);
+    c->in = NULL;
+    return TRUE;
+}
+
+void schedule_wake(struct conn * c, uint64_t when)
+{
+    c->wake_ns = when;
+    if(next_wake_ns == 0 || when < next_wake_ns)
+    {
+        next_wake_ns = when;
+    }
+}
+
+void start_sending(struct conn * c, uint64_t now)
+{
+    c->state = CONN_SENDING;
+    c->phase_ns = now;
+    c->wake_ns = 0;
+    set_events(c, EPOLLOUT);
+}
+
+//how many bytes a bps limit allows 'done' bytes into a phase that
+//began at 'since'; if none, *wake_ns is when the next byte is allowed
+size_t throttle_allowance(long bps, uint64_t since, uint64_t now, size_t done, uint64_t * wake_ns)
+{
+    if(bps <= 0)
+    {
+        return READ_CHUNK;
+    }
+    uint64_t budget = (now - since) * (uint64_t) bps / NS_PER_S;
+    if(budget > done)
+    {
+        return budget - done;
+    }
+    *wake_ns = since + (done + 1) * NS_PER_S / (uint64_t) bps;
+    return 0;
+}
+
+void start_conn(struct conn * c, struct sockaddr_in * addr)
+{
+    c->start_ns = stats_now();
+    c->rng = (uint64_t) opt.seed * 0x2545F4914F6CDD1DULL + c->id;
+    c->drop = opt.disconnect_at > 0 && next_fraction(&c->rng) < opt.disconnect_frac;
+    num_open++;
+
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(c->fd == -1)
+    {
+        printf("Error Creating Socket: %s\n", strerror(errno));
+        finish_conn(c, CONN_FAILED);
+        return;
+    }
+
+    if(connect(c->fd, (struct sockaddr *) addr, sizeof(struct sockaddr_in)) == -1 &&
+       errno != EINPROGRESS)
+    {
+        finish_conn(c, CONN_FAILED);
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLOUT;
+    ev.data.ptr = c;
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) == -1)
+    {
+        printf("Error Adding to EPOLL: %s\n", strerror(errno));
+        finish_conn(c, CONN_FAILED);
+        return;
+    }
+    c->armed = EPOLLOUT;
+    c->state = CONN_CONNECTING;
+}
+
+void handle_read(struct conn * c, uint64_t now)
+{
+    uint64_t wake;
+    size_t want = throttle_allowance(opt.slow_read_bps, c->connected_ns, now, c->in_len, &wake);
+    if(want == 0)
+    {
+        schedule_wake(c, wake);
+        set_events(c, 0);
+        return;
+    }
+    if(want > READ_CHUNK)
+    {
+        want = READ_CHUNK;
+    }
+    if(c->drop && c->in_len + want > (size_t) opt.disconnect_at)
+    {
+        want = opt.disconnect_at - c->in_len;
+    }
+
+    if(c->in_len + want > c->in_cap)
+    {
+        size_t cap = c->in_cap ? c->in_cap : READ_CHUNK;
+        while(cap < c->in_len + want)
+        {
+            cap *= 2;
+        }
+        char * grown = realloc(c->in, cap);
+        if(grown == NULL)
+        {
+            finish_conn(c, CONN_FAILED);
+            return;
+        }
+        c->in = grown;
+        c->in_cap = cap;
+    }
+
+    ssize_t got = read(c->fd, c->in + c->in_len, want);
+    if(got == -1)
+    {
+        if(errno != EINTR && errno != EAGAIN)
+        {
+            finish_conn(c, CONN_FAILED);
+        }
+        return;
+    }
+    if(got == 0)
+    {
+        //server closed before "EOF\n"
+        finish_conn(c, CONN_FAILED);
+        return;
+    }
+
+    if(c->in_len == 0)
+    {
+        c->first_byte_ns = now;
+    }
+    c->in_len += got;
+    totals.bytes_in += got;
+
+    if(c->drop && c->in_len >= (size_t) opt.disconnect_at)
+    {
+        finish_conn(c, CONN_DROPPED);
+        return;
+    }
+
+    int complete = fragment_complete(c);
+    if(complete == FRAGMENT_BAD_HEADER)
+    {
+        printf("Client %d got a fragment header with sizes too large\n", c->id);
+        finish_conn(c, CONN_FAILED);
+        return;
+    }
+    if(complete == FRAGMENT_INCOMPLETE)
+    {
+        return;
+    }
+
+    c->eof_ns = stats_now();
+    if(!build_results(c))
+    {
+        printf("Could not allocate results for client %d\n", c->id);
+        finish_conn(c, CONN_FAILED);
+        return;
+    }
+
+    if(opt.sort_delay_ms > 0)
+    {
+        c->state = CONN_DELAYING;
+        schedule_wake(c, c->eof_ns + opt.sort_delay_ms * NS_PER_MS);
+        set_events(c, 0);
+        return;
+    }
+    start_sending(c, c->eof_ns);
+}
+
+void handle_write(struct conn * c, uint64_t now)
+{
+    uint64_t wake;
+    size_t want = throttle_allowance(opt.throttle_bps, c->phase_ns, now, c->out_off, &wake);
+    if(want == 0)
+    {
+        schedule_wake(c, wake);
+        set_events(c, 0);
+        return;
+    }
+    if(want > c->out_len - c->out_off)
+    {
+        want = c->out_len - c->out_off;
+    }
+
+    ssize_t sent = write(c->fd, c->out + c->out_off, want);
+    if(sent == -1)
+    {
+        if(errno != EINTR && errno != EAGAIN)
+        {
+            finish_conn(c, CONN_FAILED);
+        }
+        return;
+    }
+    c->out_off += sent;
+    totals.bytes_out += sent;
+
+    if(c->out_off == c->out_len)
+    {
+        finish_conn(c, CONN_DONE);
+    }
+}
+
+void handle_event(struct conn * c, uint32_t events, uint64_t now)
+{
+    if(c->state == CONN_CONNECTING)
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if(err != 0)
+        {
+            finish_conn(c, CONN_FAILED);
+            return;
+        }
+        c->connected_ns = now;
+        c->state = CONN_RECEIVING;
+        set_events(c, EPOLLIN);
+        return;
+    }
+
+    if(c->state == CONN_RECEIVING && (events & EPOLLIN))
+    {
+        handle_read(c, now);
+    }
+    else if(c->state == CONN_SENDING && (events & EPOLLOUT))
+    {
+        handle_write(c, now);
+    }
+    else if(events & (EPOLLHUP | EPOLLERR))
+    {
+        finish_conn(c, CONN_FAILED);
+    }
+}
+
+//re-arm connections whose delay or throttle has run out
+//returns the epoll_wait timeout until the next one, in ms
+int wake_due(struct conn * conns, long started, uint64_t now)
+{
+    if(next_wake_ns == 0)
+    {
+        return -1;
+    }
+    if(next_wake_ns > now)
+    {
+        return (int) ((next_wake_ns - now + NS_PER_MS - 1) / NS_PER_MS);
+    }
+
+    //only scan when something is due
+    uint64_t next = 0;
+    for(long i = 0; i < started; i++)
+    {
+        struct conn * c = &conns[i];
+        if(c->wake_ns == 0 || c->fd == -1)
+        {
+            continue;
+        }
+        if(c->wake_ns > now)
+        {
+            if(next == 0 || c->wake_ns < next)
+            {
+                next = c->wake_ns;
+            }
+            continue;
+        }
+
+        c->wake_ns = 0;
+        if(c->state == CONN_DELAYING)
+        {
+            start_sending(c, now);
+        }
+        else if(c->state == CONN_RECEIVING)
+        {
+            set_events(c, EPOLLIN);
+        }
+        else if(c->state == CONN_SENDING)
+        {
+            set_events(c, EPOLLOUT);
+        }
+    }
+
+    next_wake_ns = next;
+    if(next == 0)
+    {
+        return -1;
+    }
+    return (int) ((next - now + NS_PER_MS - 1) / NS_PER_MS);
+}
+
+void print_report(double seconds)
+{
+    double total_mb = (totals.bytes_in + totals.bytes_out) / BYTES_PER_MB;
+
+    printf("{\"clients\": %ld, \"concurrency\": %ld, \"done\": %ld, \"failed\": %ld, \"dropped\": %ld,\n",
+           opt.clients, opt.concurrency, totals.done, totals.failed, totals.dropped);
+    printf(" \"wall_s\": %.6f, \"bytes_in\": %llu, \"bytes_out\": %llu, \"lines\": %llu, \"malformed\": %llu,\n",
+           seconds,
+           (unsigned long long) totals.bytes_in,
+           (unsigned long long) totals.bytes_out,
+           (unsigned long long) totals.lines,
+           (unsigned long long) totals.malformed);
+    printf(" \"clients_per_s\": %.1f, \"lines_per_s\": %.1f, \"mb_per_s\": %.3f,\n",
+           totals.done / seconds, totals.lines / seconds, total_mb / seconds);
+    printf(" \"latency_ms\": {");
+    for(int l = 0; l < LG_NUM_LATENCIES; l++)
+    {
+        struct latency_hist * h = &totals.latencies[l];
+        printf("%s\n   \"%s\": {\"p50\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f}",
+               l ? "," : "", lg_latency_names[l],
+               hist_percentile(h, 0.50) / (double) NS_PER_MS,
+               hist_percentile(h, 0.99) / (double) NS_PER_MS,
+               hist_percentile(h, 0.999) / (double) NS_PER_MS,
+               h->max_ns / (double) NS_PER_MS);
+    }
+    printf("\n }}\n");
+}
+
+int main(int argc, char ** argv)
+{
+    memset(&opt, 0, sizeof(opt));
+    opt.host = DEFAULT_HOST;
+    opt.clients = DEFAULT_CLIENTS;
+    opt.disconnect_frac = 1.0;
+    opt.seed = DEFAULT_SEED;
+
+    for(int i = 1; i < argc; i++)
+    {
+        char * arg = argv[i];
+        char * value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        long num;
+
+        if(value == NULL)
+        {
+            return usage("missing option value");
+        }
+        i++;
+
+        if(strcmp(arg, "--host") == 0)
+        {
+            opt.host = value;
+        }
+        else if(strcmp(arg, "--port") == 0)
+        {
+            if(!string_to_long(&num, value) || num <= 0 || num > 65535) return usage("bad --port");
+            opt.port = num;
+        }
+        else if(strcmp(arg, "--clients") == 0)
+        {
+            if(!string_to_long(&opt.clients, value) || opt.clients <= 0) return usage("bad --clients");
+        }
+        else if(strcmp(arg, "--concurrency") == 0)
+        {
+            if(!string_to_long(&opt.concurrency, value) || opt.concurrency <= 0) return usage("bad --concurrency");
+        }
+        else if(strcmp(arg, "--sort-delay") == 0)
+        {
+            if(!string_to_long(&opt.sort_delay_ms, value) || opt.sort_delay_ms < 0) return usage("bad --sort-delay");
+        }
+        else if(strcmp(arg, "--throttle") == 0)
+        {
+            if(!string_to_long(&opt.throttle_bps, value) || opt.throttle_bps < 0) return usage("bad --throttle");
+        }
+        else if(strcmp(arg, "--slow-reader") == 0)
+        {
+            if(!string_to_long(&opt.slow_read_bps, value) || opt.slow_read_bps < 0) return usage("bad --slow-reader");
+        }
+        else if(strcmp(arg, "--disconnect-at") == 0)
+        {
+            if(!string_to_long(&opt.disconnect_at, value) || opt.disconnect_at < 0) return usage("bad --disconnect-at");
+        }
+        else if(strcmp(arg, "--disconnect-frac") == 0)
+        {
+            if(!string_to_fraction(&opt.disconnect_frac, value)) return usage("bad --disconnect-frac");
+        }
+        else if(strcmp(arg, "--malformed") == 0)
+        {
+            if(!string_to_fraction(&opt.malformed_frac, value)) return usage("bad --malformed");
+        }
+        else if(strcmp(arg, "--seed") == 0)
+        {
+            if(!string_to_long(&opt.seed, value)) return usage("bad --seed");
+        }
+        else
+        {
+            return usage("unknown option");
+        }
+    }
+
+    if(opt.port == 0)
+    {
+        return usage("--port is required");
+    }
+    if(opt.concurrency == 0 || opt.concurrency > opt.clients)
+    {
+        opt.concurrency = opt.clients;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opt.port);
+    if(inet_aton(opt.host, &addr.sin_addr) == 0)
+    {
+        return usage("--host must be an IPv4 address");
+    }
+
+    //a hang up from the server should show up as EPIPE, not kill us
+    signal(SIGPIPE, SIG_IGN);
+
+    //thousands of sockets need more than the default descriptor limit
+    struct rlimit lim;
+    if(getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    struct conn * conns = calloc(opt.clients, sizeof(struct conn));
+    epfd = epoll_create1(0);
+    if(conns == NULL || epfd == -1)
+    {
+        printf("Could not set up %ld clients: %s\n", opt.clients, strerror(errno));
+        free(conns);
+        return SETUP_FAILED;
+    }
+
+    struct epoll_event evlist[MAX_EVENTS];
+    long started = 0;
+    uint64_t start = stats_now();
+    int timeout = -1;
+
+    while(num_finished < opt.clients)
+    {
+        while(num_open < opt.concurrency && started < opt.clients)
+        {
+            conns[started].id = started;
+            start_conn(&conns[started], &addr);
+            started++;
+        }
+        if(num_finished == opt.clients)
+        {
+            break;
+        }
+
+        int num_events = epoll_wait(epfd, evlist, MAX_EVENTS, timeout);
+        if(num_events == -1 && errno != EINTR)
+        {
+            printf("Error Waiting on EPOLL: %s\n", strerror(errno));
+            break;
+        }
+
+        uint64_t now = stats_now();
+        for(int i = 0; i < num_events; i++)
+        {
+            struct conn * c = (struct conn *) evlist[i].data.ptr;
+            if(c->fd != -1)
+            {
+                handle_event(c, evlist[i].events, now);
+            }
+        }
+
+        timeout = wake_due(conns, started, stats_now());
+    }
+
+    double seconds = (stats_now() - start) / (double) NS_PER_S;
+    print_report(seconds);
+
+    close(epfd);
+    free(conns);
+    return (num_finished == opt.clients && totals.failed == 0) ? SUCCESS : RUN_FAILED;
+}
@@ -0,0 +1,203 @@
+/*
+local_exec.c - sort threads inside the server
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "local_exec.h"
+#include "line_util.h"
+#include "permutation.h"
+#include "log.h"
+
+#define FALSE 0
+#define TRUE 1
+
+//where every line of the task's fragment is, sorted by line number
+//*base is what the offsets are relative to
+static uint64_t sort_task(struct local_task * task, struct fragment_index_entry ** entries, uint64_t * base)
+{
+    if(!task->indexed)
+    {
+        *base = 0;
+        uint64_t count = index_plain_fragment(task->data, task->size, entries);
+        qsort(*entries, count, sizeof(struct fragment_index_entry), compare_index_entry);
+        return count;
+    }
+
+    //the mapping is read only, so the table is sorted in a copy
+    *base = FRAGMENT_DATA_OFFSET(task->line_count);
+    uint64_t text_bytes = task->size - *base;
+    struct fragment_index_entry * table = malloc(sizeof(struct fragment_index_entry) * (task->line_count + 1));
+    memcpy(table, task->data + sizeof(struct fragment_header),
+           sizeof(struct fragment_index_entry) * task->line_count);
+
+    //keep only the entries that point inside the text block
+    uint64_t count = 0;
+    for(uint64_t i = 0; i < task->line_count; i++)
+    {
+        if(FRAGMENT_ENTRY_FITS(table[i], text_bytes))
+        {
+            table[count++] = table[i];
+        }
+    }
+    //one warning per fragment rather than one per entry
+    if(count != task->line_count)
+    {
+        log_warn("Local sort skipped %llu bad index entries\n",
+                 (unsigned long long) (task->line_count - count));
+    }
+
+    qsort(table, count, sizeof(struct fragment_index_entry), compare_index_entry);
+    *entries = table;
+    return count;
+}
+
+static void run_task(struct local_exec * exec, struct local_task * task)
+{
+    struct fragment_index_entry * entries = NULL;
+    uint64_t base;
+    uint64_t count = sort_task(task, &entries, &base);
+
+    size_t len;
+    unsigned char * result = encode_permutation(entries, count, base, &len);
+    free(entries);
+
+    //the sort is done, so the event loop may start another one
+    pthread_mutex_lock(&exec->lock);
+    exec->busy--;
+    pthread_mutex_unlock(&exec->lock);
+
+    //a failed write means the run was cancelled or the server is
+    //stopping; the server sees a missing "EOF\n" as a failed run
+    if(result == NULL || !write_all(task->fd, (char *) result, len) ||
+       !write_all(task->fd, "EOF\n", strlen("EOF\n")))
+    {
+        log_info("Local sort result not delivered: %s\n", result == NULL ? "out of memory" : strerror(errno));
+    }
+    free(result);
+    close(task->fd);
+}
+
+static void * sort_loop(void * arg)
+{
+    struct local_exec * exec = arg;
+
+    pthread_mutex_lock(&exec->lock);
+    while(TRUE)
+    {
+        while(exec->head == NULL && !exec->stopping)
+        {
+            pthread_cond_wait(&exec->ready, &exec->lock);
+        }
+        if(exec->stopping)
+        {
+            break;
+        }
+
+        struct local_task * task = exec->head;
+        exec->head = task->next;
+        if(exec->head == NULL)
+        {
+            exec->tail = NULL;
+        }
+
+        pthread_mutex_unlock(&exec->lock);
+        run_task(exec, task);
+        free(task);
+        pthread_mutex_lock(&exec->lock);
+    }
+    pthread_mutex_unlock(&exec->lock);
+    return NULL;
+}
+
+int local_exec_start(struct local_exec * exec, int num_threads)
+{
+    memset(exec, 0, sizeof(*exec));
+    pthread_mutex_init(&exec->lock, NULL);
+    pthread_cond_init(&exec->ready, NULL);
+
+    exec->threads = malloc(sizeof(pthread_t) * num_threads);
+    for(int i = 0; i < num_threads; i++)
+    {
+        int err = pthread_create(&exec->threads[i], NULL, sort_loop, exec);
+        if(err != 0)
+        {
+            log_error("Could not start local sort thread: %s\n", strerror(err));
+            local_exec_stop(exec);
+            return FALSE;
+        }
+        exec->num_threads++;
+    }
+    return TRUE;
+}
+
+int local_exec_submit(struct local_exec * exec, int fd, struct fragment_info * fragment)
+{
+    struct local_task * task = malloc(sizeof(struct local_task));
+    if(task == NULL)
+    {
+        return FALSE;
+    }
+    task->fd = fd;
+    task->data = fragment->data;
+    task->size = fragment->size;
+    task->indexed = fragment->indexed;
+    task->line_count = fragment->line_count;
+    task->next = NULL;
+
+    pthread_mutex_lock(&exec->lock);
+    if(exec->tail != NULL)
+    {
+        exec->tail->next = task;
+    }
+    else
+    {
+        exec->head = task;
+    }
+    exec->tail = task;
+    exec->busy++;
+    pthread_cond_signal(&exec->ready);
+    pthread_mutex_unlock(&exec->lock);
+    return TRUE;
+}
+
+int local_exec_busy(struct local_exec * exec)
+{
+    pthread_mutex_lock(&exec->lock);
+    int busy = exec->busy;
+    pthread_mutex_unlock(&exec->lock);
+    return busy;
+}
+
+void local_exec_stop(struct local_exec * exec)
+{
+    pthread_mutex_lock(&exec->lock);
+    exec->stopping = TRUE;
+    while(exec->head != NULL)
+    {
+        struct local_task * task = exec->head;
+        exec->head = task->next;
+        close(task->fd);
+        free(task);
+    }
+    exec->tail = NULL;
+    pthread_cond_broadcast(&exec->ready);
+    pthread_mutex_unlock(&exec->lock);
+
+    for(int i = 0; i < exec->num_threads; i++)
+    {
+        pthread_join(exec->threads[i], NULL);
+    }
+    free(exec->threads);
+    exec->threads = NULL;
+    exec->num_threads = 0;
+    pthread_mutex_destroy(&exec->lock);
+    pthread_cond_destroy(&exec->ready);
+}
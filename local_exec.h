@@ -0,0 +1,66 @@
+/*
+local_exec.h - the server's own pool of sort threads, for fragments
+that cost less to sort in place than to send to a client.
+
+A local run looks like any other connection to the event loop: the
+server keeps one end of a socketpair and a pool thread gets the
+other. The thread reads the fragment straight from the server's
+mapping, sorts it with the client's kernels (permutation.h) and
+writes a permutation result and "EOF\n" to its end, so the results
+go through the same ingest, checkpoint and output path as a
+client's, while only a few bytes per line cross the socket.
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#ifndef LOCAL_EXEC_H
+#define LOCAL_EXEC_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "fragment.h"
+
+struct local_task
+{
+    //the thread's end of the socketpair; it is closed once written
+    int fd;
+    const char * data;
+    uint64_t size;
+    int indexed;
+    uint64_t line_count;
+    struct local_task * next;
+};
+
+struct local_exec
+{
+    pthread_t * threads;
+    int num_threads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    struct local_task * head;
+    struct local_task * tail;
+    //tasks queued or being sorted; a thread writing its result out
+    //no longer counts
+    int busy;
+    int stopping;
+};
+
+//start num_threads sort threads; returns 1 on success
+int local_exec_start(struct local_exec * exec, int num_threads);
+
+//sort 'fragment' and write its result to 'fd', which the pool now
+//owns. The fragment must stay mapped until local_exec_stop
+//returns 1 if it was queued, otherwise fd is left open
+int local_exec_submit(struct local_exec * exec, int fd, struct fragment_info * fragment);
+
+//number of tasks queued or being sorted
+int local_exec_busy(struct local_exec * exec);
+
+//drop queued tasks and wait for the threads. A thread blocked writing
+//a result only returns once the server's end is closed
+void local_exec_stop(struct local_exec * exec);
+
+#endif
@@ -0,0 +1,218 @@
+/*
+log.c - leveled logging through a lock-free ring and a drain thread
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+
+#define LOG_RING_MASK (LOG_RING_SLOTS - 1)
+//how long the drain thread sleeps when the ring is empty
+#define LOG_IDLE_NS 1000000
+
+//bounded multi-producer ring: a slot's sequence number says whether it
+//is free for the producer at that position (seq == pos) or holds a
+//message for the consumer (seq == pos + 1)
+struct log_slot
+{
+    atomic_size_t seq;
+    enum log_level level;
+    char msg[LOG_MSG_MAX];
+};
+
+static struct log_slot ring[LOG_RING_SLOTS];
+static atomic_size_t ring_tail;
+static size_t ring_head;
+
+static atomic_int running;
+static atomic_int stopping;
+static atomic_ulong dropped;
+static enum log_level min_level = LOG_INFO;
+static pthread_t drain_thread;
+
+static const char * level_prefix[] = {"", "", "warning: ", "error: "};
+
+static uint64_t log_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//write out everything queued, returns how many messages were written
+static int drain(void)
+{
+    int n = 0;
+    while(1)
+    {
+        struct log_slot * slot = &ring[ring_head & LOG_RING_MASK];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if(seq != ring_head + 1)
+        {
+            return n;
+        }
+        fputs(level_prefix[slot->level], stdout);
+        fputs(slot->msg, stdout);
+        atomic_store_explicit(&slot->seq, ring_head + LOG_RING_SLOTS, memory_order_release);
+        ring_head++;
+        n++;
+    }
+}
+
+static void * drain_loop(void * arg)
+{
+    struct timespec idle = {0, LOG_IDLE_NS};
+    while(1)
+    {
+        //read the flag first so nothing queued before the stop is missed
+        int stop = atomic_load(&stopping);
+        if(drain() > 0)
+        {
+            fflush(stdout);
+            continue;
+        }
+        if(stop)
+        {
+            return NULL;
+        }
+        nanosleep(&idle, NULL);
+    }
+}
+
+void log_init(void)
+{
+    const char * env = getenv("LOG_LEVEL");
+    if(env != NULL)
+    {
+        if(strcmp(env, "debug") == 0) min_level = LOG_DEBUG;
+        else if(strcmp(env, "info") == 0) min_level = LOG_INFO;
+        else if(strcmp(env, "warn") == 0) min_level = LOG_WARN;
+        else if(strcmp(env, "error") == 0) min_level = LOG_ERROR;
+    }
+
+    for(size_t i = 0; i < LOG_RING_SLOTS; i++)
+    {
+        atomic_init(&ring[i].seq, i);
+    }
+
+    if(pthread_create(&drain_thread, NULL, drain_loop, NULL) != 0)
+    {
+        //stay synchronous
+        return;
+    }
+    atomic_store(&running, 1);
+    atexit(log_shutdown);
+}
+
+void log_shutdown(void)
+{
+    if(!atomic_exchange(&running, 0))
+    {
+        return;
+    }
+    atomic_store(&stopping, 1);
+    pthread_join(drain_thread, NULL);
+
+    unsigned long lost = atomic_load(&dropped);
+    if(lost > 0)
+    {
+        printf("warning: %lu log messages dropped\n", lost);
+    }
+    fflush(stdout);
+}
+
+void log_msg(enum log_level level, const char * fmt, ...)
+{
+    if(level < min_level)
+    {
+        return;
+    }
+
+    va_list args;
+    va_start(args, fmt);
+
+    if(!atomic_load_explicit(&running, memory_order_relaxed))
+    {
+        fputs(level_prefix[level], stdout);
+        vprintf(fmt, args);
+        va_end(args);
+        return;
+    }
+
+    //claim a slot
+    struct log_slot * slot;
+    size_t pos = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+    while(1)
+    {
+        slot = &ring[pos & LOG_RING_MASK];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if(seq == pos)
+        {
+            if(atomic_compare_exchange_weak_explicit(&ring_tail, &pos, pos + 1,
+                                                     memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if(seq < pos)
+        {
+            //full: drop rather than wait on the drain thread
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            va_end(args);
+            return;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+        }
+    }
+
+    slot->level = level;
+    if(vsnprintf(slot->msg, LOG_MSG_MAX, fmt, args) >= LOG_MSG_MAX)
+    {
+        //keep the line ending on messages that were cut short
+        slot->msg[LOG_MSG_MAX - 2] = '\n';
+    }
+    va_end(args);
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+}
+
+//call sites are shared by the ingest threads; only warnings get here,
+//so one lock for all of them costs nothing on the normal path
+static pthread_mutex_t rate_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int log_rate_allow(struct log_rate * rate, unsigned int * suppressed)
+{
+    uint64_t now = log_now();
+    int allowed = 0;
+
+    pthread_mutex_lock(&rate_lock);
+    if(rate->window_start == 0 || now - rate->window_start >= LOG_RATE_WINDOW_NS)
+    {
+        rate->window_start = now;
+        rate->count = 0;
+    }
+
+    if(rate->count >= LOG_RATE_BURST)
+    {
+        rate->suppressed++;
+    }
+    else
+    {
+        rate->count++;
+        *suppressed = rate->suppressed;
+        rate->suppressed = 0;
+        allowed = 1;
+    }
+    pthread_mutex_unlock(&rate_lock);
+    return allowed;
+}
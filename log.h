@@ -0,0 +1,91 @@
+/*
+log.h - leveled logging that never blocks the caller
+
+Messages are formatted by the caller into a fixed-size ring and written
+out by a background thread, so a slow terminal or pipe on stdout cannot
+stall the event loop or the sort. If the ring is full the message is
+dropped and counted instead of waiting.
+
+log_debug compiles to nothing unless LOG_DEBUG_ENABLED is defined, and
+LOG_LEVEL=debug|info|warn|error in the environment picks the lowest
+level that is printed (info by default).
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum log_level
+{
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR
+};
+
+//longest message kept, including the '\0'; longer ones are cut short
+#define LOG_MSG_MAX 256
+//ring slots, must be a power of two
+#define LOG_RING_SLOTS 1024
+
+//repeated warnings: at most LOG_RATE_BURST per LOG_RATE_WINDOW_NS per call site
+#define LOG_RATE_BURST 10
+#define LOG_RATE_WINDOW_NS 1000000000ULL
+
+//start the drain thread; the ring is flushed at exit
+//before this is called messages are written synchronously
+void log_init(void);
+
+//stop the drain thread after writing everything queued
+void log_shutdown(void);
+
+void log_msg(enum log_level level, const char * fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+struct log_rate
+{
+    uint64_t window_start;
+    unsigned int count;
+    unsigned int suppressed;
+};
+
+//returns 1 if a message may be logged now; *suppressed is set to the
+//number dropped since the last one that was allowed
+int log_rate_allow(struct log_rate * rate, unsigned int * suppressed);
+
+#ifdef LOG_DEBUG_ENABLED
+#define log_debug(...) log_msg(LOG_DEBUG, __VA_ARGS__)
+#else
+//still type checks the arguments, but the optimiser removes it
+#define log_debug(...) do { if(0) log_msg(LOG_DEBUG, __VA_ARGS__); } while(0)
+#endif
+
+#define log_info(...) log_msg(LOG_INFO, __VA_ARGS__)
+#define log_warn(...) log_msg(LOG_WARN, __VA_ARGS__)
+#define log_error(...) log_msg(LOG_ERROR, __VA_ARGS__)
+
+//rate limited per call site, across all threads
+#define log_limited(level, ...) do { \
+        static struct log_rate log_rate_state; \
+        unsigned int log_suppressed; \
+        if(log_rate_allow(&log_rate_state, &log_suppressed)) { \
+            if(log_suppressed) { \
+                log_msg(level, "(%u similar messages suppressed)\n", log_suppressed); \
+            } \
+            log_msg(level, __VA_ARGS__); \
+        } \
+    } while(0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
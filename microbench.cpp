@@ -0,0 +1,807 @@
+// Program: microbench.cpp
+// Purpose: microbenchmarks for the hot kernels, so that a change to any of
+//          them can be measured in isolation:
+//
+//            scan    position_delim vs. memchr vs. an SSE2 scan
+//            parse   sscanf("%d") vs. a hand-written decimal parse
+//            grow    get_mem_for_line vs. capacity doubling, for lines that
+//                    arrive in 1024-byte reads and in 64-byte trickles
+//            index   AVL add + find_min/delete_node drain vs. qsort, LSD
+//                    radix sort, a direct index, a B-tree and std::map
+//            ingest  the sharded line index with 1 to 16 threads inserting
+//                    at once, against one AVL tree behind one lock
+//            split   the splitter's shuffle and fragment write paths
+//
+//          Inputs cover several sizes and line length distributions.  Each
+//          case reports ns per operation (a line, a key or an element) and
+//          bytes per cycle.  Cycles come from the TSC where there is one, so
+//          they are reference cycles rather than core cycles.
+//
+//          usage: microbench [--filter <substring>] [--quick] [--json]
+//                            [--tmp-dir <dir>]
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "btree.h"
+#include "line_index.h"
+#include "line_util.h"
+#include "shuffle_engine.h"
+#include "fragment_writer.h"
+using namespace std;
+
+// return codes for success or failure
+const int success = 0;
+const int bad_option = -1;
+
+// bytes of text each scan/parse/grow input holds
+const size_t text_bytes = 1 << 20;
+
+// read sizes used to feed get_mem_for_line
+const int server_read_size = 1024;
+const int trickle_read_size = 64;
+
+// interleaved sorted runs, as the server sees them from its clients
+const int interleaved_runs = 8;
+
+// B-tree node fan-out for the index comparison
+const int btree_order = 32;
+
+// inserting threads for the ingest comparison
+const int max_ingest_threads = 16;
+
+const uint64_t input_seed = 422;
+
+// ---------------------------------------------------------------- harness
+
+struct bench_config {
+    bench_config() : min_seconds(0.2), quick(false), json(false),
+                     tmp_dir("/tmp") {}
+    double min_seconds;
+    bool quick;
+    bool json;
+    string filter;
+    string tmp_dir;
+};
+
+bench_config config;
+
+inline uint64_t now_ns () {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+inline uint64_t cycles () {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// keeps the optimiser from discarding a result
+template <typename T>
+inline void keep (const T & value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// runs 'iteration' until min_seconds have passed (at least once) and
+// reports per-op time and throughput.  'setup' runs untimed before every
+// iteration, for kernels that consume their input.
+void measure (const string & group, const string & name, const string & input,
+              size_t ops, size_t bytes,
+              const function<void ()> & iteration,
+              const function<void ()> & setup = function<void ()>())
+{
+    string id = group + "/" + name + "/" + input;
+    if (!config.filter.empty() && id.find(config.filter) == string::npos) {
+        return;
+    }
+
+    uint64_t total_ns = 0;
+    uint64_t total_cycles = 0;
+    uint64_t iterations = 0;
+    const uint64_t budget = static_cast<uint64_t>(config.min_seconds * 1e9);
+
+    while (iterations == 0 || total_ns < budget) {
+        if (setup) setup();
+        uint64_t c0 = cycles();
+        uint64_t t0 = now_ns();
+        iteration();
+        total_ns += now_ns() - t0;
+        total_cycles += cycles() - c0;
+        iterations++;
+    }
+
+    double ns_per_op = static_cast<double>(total_ns) / (iterations * ops);
+    double bytes_per_cycle = total_cycles
+        ? static_cast<double>(bytes) * iterations / total_cycles : 0.0;
+
+    if (config.json) {
+        cout << "{\"group\": \"" << group << "\", \"name\": \"" << name
+             << "\", \"input\": \"" << input << "\", \"ops\": " << ops
+             << ", \"bytes\": " << bytes << ", \"iterations\": " << iterations
+             << ", \"ns_per_op\": " << ns_per_op
+             << ", \"bytes_per_cycle\": " << bytes_per_cycle << "}" << endl;
+    } else {
+        cout << left << setw(7) << group << setw(22) << name << setw(22)
+             << input << right << fixed << setprecision(2) << setw(12)
+             << ns_per_op << " ns/op" << setw(10) << bytes_per_cycle
+             << " B/cycle" << endl;
+    }
+}
+
+// ---------------------------------------------------------------- inputs
+
+// line length distributions shared by the text-based groups
+struct length_dist {
+    const char * name;
+    size_t min_len;
+    size_t max_len;
+    double empty_fraction;
+    double long_fraction;
+};
+
+const length_dist distributions[] = {
+    { "short",  0,    40,   0.0,  0.0 },
+    { "mixed",  0,    120,  0.02, 0.001 },
+    { "long",   2048, 8192, 0.0,  0.0 },
+};
+
+// builds roughly text_bytes of "<num> <text>\n" lines with the given
+// length distribution; line numbers are shuffled like a real fragment
+string make_text (const length_dist & dist, size_t & lines) {
+    xoshiro256 rng (input_seed);
+    vector<size_t> lengths;
+    size_t total = 0;
+    while (total < text_bytes) {
+        double p = rng.next() / 18446744073709551616.0;
+        size_t len;
+        if (p < dist.empty_fraction) {
+            len = 0;
+        } else if (p < dist.empty_fraction + dist.long_fraction) {
+            len = 4096;
+        } else {
+            len = dist.min_len + rng.bounded(dist.max_len - dist.min_len + 1);
+        }
+        lengths.push_back(len);
+        total += len + 12;
+    }
+
+    vector<size_t> numbers (lengths.size());
+    for (size_t i = 0; i < numbers.size(); ++i) numbers[i] = i;
+    fisher_yates(numbers.begin(), numbers.end(), rng);
+
+    string text;
+    text.reserve(total);
+    for (size_t i = 0; i < lengths.size(); ++i) {
+        text += to_string(numbers[i]);
+        text += ' ';
+        for (size_t k = 0; k < lengths[i]; ++k) {
+            text += static_cast<char>('a' + rng.bounded(26));
+        }
+        text += '\n';
+    }
+    lines = lengths.size();
+    return text;
+}
+
+// ---------------------------------------------------------------- scan
+
+int memchr_delim (char * str, int len, char delim) {
+    void * p = memchr(str, delim, len);
+    return p ? static_cast<char *>(p) - str : -1;
+}
+
+#ifdef __SSE2__
+int sse2_delim (char * str, int len, char delim) {
+    const __m128i needle = _mm_set1_epi8(delim);
+    int i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(str + i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    for (; i < len; ++i) {
+        if (str[i] == delim) return i;
+    }
+    return -1;
+}
+#endif
+
+// counts lines the way the receive loop does: repeated scans from the
+// position after the previous delimiter
+template <typename Scan>
+size_t count_lines (string & text, Scan scan) {
+    char * buf = &text[0];
+    int len = text.size();
+    int last = 0;
+    int index;
+    size_t found = 0;
+    while ((index = scan(buf + last, len - last, '\n')) != -1) {
+        last += index + 1;
+        found++;
+    }
+    return found;
+}
+
+void bench_scan () {
+    for (size_t d = 0; d < sizeof(distributions) / sizeof(distributions[0]); ++d) {
+        size_t lines;
+        string text = make_text(distributions[d], lines);
+        const char * input = distributions[d].name;
+
+        measure("scan", "position_delim", input, lines, text.size(), [&] {
+            keep(count_lines(text, position_delim));
+        });
+        measure("scan", "memchr", input, lines, text.size(), [&] {
+            keep(count_lines(text, memchr_delim));
+        });
+#ifdef __SSE2__
+        measure("scan", "sse2", input, lines, text.size(), [&] {
+            keep(count_lines(text, sse2_delim));
+        });
+#endif
+    }
+}
+
+// ---------------------------------------------------------------- parse
+
+// leading decimal number of a line, as sscanf("%d") would read it
+inline int parse_decimal (const char * str, int * num) {
+    while (*str == ' ' || *str == '\t') str++;
+    int negative = 0;
+    if (*str == '-' || *str == '+') {
+        negative = *str == '-';
+        str++;
+    }
+    if (*str < '0' || *str > '9') {
+        return 0;
+    }
+    long value = 0;
+    while (*str >= '0' && *str <= '9') {
+        value = value * 10 + (*str - '0');
+        str++;
+    }
+    *num = negative ? -value : value;
+    return 1;
+}
+
+void bench_parse () {
+    for (size_t d = 0; d < sizeof(distributions) / sizeof(distributions[0]); ++d) {
+        size_t lines;
+        string text = make_text(distributions[d], lines);
+        const char * input = distributions[d].name;
+
+        // parse works on whole, '\0' terminated lines like the receive loop
+        vector<string> records;
+        istringstream iss (text);
+        string record;
+        while (getline(iss, record)) records.push_back(record + "\n");
+
+        measure("parse", "sscanf", input, records.size(), text.size(), [&] {
+            long sum = 0;
+            for (size_t i = 0; i < records.size(); ++i) {
+                int num;
+                if (sscanf(records[i].c_str(), "%d", &num) == 1) sum += num;
+            }
+            keep(sum);
+        });
+        measure("parse", "parse_decimal", input, records.size(), text.size(), [&] {
+            long sum = 0;
+            for (size_t i = 0; i < records.size(); ++i) {
+                int num;
+                if (parse_decimal(records[i].c_str(), &num)) sum += num;
+            }
+            keep(sum);
+        });
+    }
+}
+
+// ---------------------------------------------------------------- grow
+
+// the alternative to get_mem_for_line: track capacity and double it
+inline void grow_doubling (char ** line, int * line_index, int * curr_len_line,
+                           int * capacity, int amount) {
+    if (*line == NULL) {
+        *line_index = 0;
+        *curr_len_line = 0;
+    } else {
+        *line_index = *curr_len_line;
+    }
+    *curr_len_line += amount;
+    if (*curr_len_line + 1 > *capacity) {
+        int cap = *capacity ? *capacity : 64;
+        while (cap < *curr_len_line + 1) cap *= 2;
+        *line = static_cast<char *>(realloc(*line, cap));
+        *capacity = cap;
+    }
+}
+
+// feeds 'text' in reads of read_size bytes, assembling each line from the
+// pieces that straddle read boundaries, as the receive loops do
+template <typename Grow>
+void assemble_lines (const string & text, int read_size, Grow grow) {
+    char * line = NULL;
+    int line_index = 0;
+    int curr_len_line = 0;
+    const char * buf = text.data();
+    size_t len = text.size();
+
+    for (size_t start = 0; start < len; start += read_size) {
+        size_t end = min(len, start + read_size);
+        size_t last = start;
+        for (size_t i = start; i < end; ++i) {
+            if (buf[i] == '\n') {
+                grow(&line, &line_index, &curr_len_line, i - last + 1);
+                memcpy(line + line_index, buf + last, i - last + 1);
+                free(line);
+                line = NULL;
+                last = i + 1;
+            }
+        }
+        if (last < end) {
+            grow(&line, &line_index, &curr_len_line, end - last);
+            memcpy(line + line_index, buf + last, end - last);
+        }
+    }
+    free(line);
+}
+
+void bench_grow () {
+    const int read_sizes[] = { server_read_size, trickle_read_size };
+    for (size_t d = 0; d < sizeof(distributions) / sizeof(distributions[0]); ++d) {
+        size_t lines;
+        string text = make_text(distributions[d], lines);
+
+        for (size_t r = 0; r < 2; ++r) {
+            int read_size = read_sizes[r];
+            string input = string(distributions[d].name) + "/read" + to_string(read_size);
+
+            measure("grow", "get_mem_for_line", input, lines, text.size(), [&] {
+                assemble_lines(text, read_size, get_mem_for_line);
+            });
+            measure("grow", "doubling", input, lines, text.size(), [&] {
+                int capacity = 0;
+                assemble_lines(text, read_size,
+                    [&capacity] (char ** line, int * index, int * len, int amount) {
+                        if (*line == NULL) capacity = 0;
+                        grow_doubling(line, index, len, &capacity, amount);
+                    });
+            });
+        }
+    }
+}
+
+// ---------------------------------------------------------------- index
+
+struct keyed_line {
+    uint32_t key;
+    char * line;
+};
+
+int compare_keyed (const void * a, const void * b) {
+    uint32_t ka = static_cast<const keyed_line *>(a)->key;
+    uint32_t kb = static_cast<const keyed_line *>(b)->key;
+    return (ka > kb) - (ka < kb);
+}
+
+// LSD radix sort, 8 bits per pass, skipping passes where every key shares
+// the same byte
+void radix_sort (vector<keyed_line> & v, vector<keyed_line> & scratch) {
+    scratch.resize(v.size());
+    for (int shift = 0; shift < 32; shift += 8) {
+        size_t counts[257] = { 0 };
+        for (size_t i = 0; i < v.size(); ++i) {
+            counts[((v[i].key >> shift) & 0xff) + 1]++;
+        }
+        if (counts[((v[0].key >> shift) & 0xff) + 1] == v.size()) continue;
+        for (int b = 0; b < 256; ++b) counts[b + 1] += counts[b];
+        for (size_t i = 0; i < v.size(); ++i) {
+            scratch[counts[(v[i].key >> shift) & 0xff]++] = v[i];
+        }
+        v.swap(scratch);
+    }
+}
+
+// minimal B-tree (insert + in-order walk), enough to compare a cache
+// friendly search tree against the pointer-per-line AVL tree
+class key_btree {
+public:
+    key_btree () : root_ (new node) {}
+    ~key_btree () { destroy(root_); }
+
+    void insert (const keyed_line & item) {
+        if (root_->count == max_keys) {
+            node * old = root_;
+            root_ = new node;
+            root_->leaf = false;
+            root_->child[0] = old;
+            split_child(root_, 0);
+        }
+        insert_nonfull(root_, item);
+    }
+
+    template <typename Visit>
+    void walk (Visit visit) const { walk(root_, visit); }
+
+private:
+    static const int max_keys = 2 * btree_order - 1;
+
+    struct node {
+        node () : count(0), leaf(true) {}
+        int count;
+        bool leaf;
+        keyed_line items[max_keys];
+        node * child[max_keys + 1];
+    };
+
+    static void split_child (node * parent, int i) {
+        node * full = parent->child[i];
+        node * right = new node;
+        right->leaf = full->leaf;
+        right->count = btree_order - 1;
+        for (int k = 0; k < btree_order - 1; ++k) {
+            right->items[k] = full->items[k + btree_order];
+        }
+        if (!full->leaf) {
+            for (int k = 0; k < btree_order; ++k) {
+                right->child[k] = full->child[k + btree_order];
+            }
+        }
+        full->count = btree_order - 1;
+        for (int k = parent->count; k > i; --k) {
+            parent->child[k + 1] = parent->child[k];
+            parent->items[k] = parent->items[k - 1];
+        }
+        parent->child[i + 1] = right;
+        parent->items[i] = full->items[btree_order - 1];
+        parent->count++;
+    }
+
+    static void insert_nonfull (node * n, const keyed_line & item) {
+        while (true) {
+            int i = n->count - 1;
+            if (n->leaf) {
+                while (i >= 0 && n->items[i].key > item.key) {
+                    n->items[i + 1] = n->items[i];
+                    --i;
+                }
+                n->items[i + 1] = item;
+                n->count++;
+                return;
+            }
+            while (i >= 0 && n->items[i].key > item.key) --i;
+            ++i;
+            if (n->child[i]->count == max_keys) {
+                split_child(n, i);
+                if (item.key > n->items[i].key) ++i;
+            }
+            n = n->child[i];
+        }
+    }
+
+    template <typename Visit>
+    static void walk (const node * n, Visit & visit) {
+        for (int i = 0; i < n->count; ++i) {
+            if (!n->leaf) walk(n->child[i], visit);
+            visit(n->items[i]);
+        }
+        if (!n->leaf) walk(n->child[n->count], visit);
+    }
+
+    static void destroy (node * n) {
+        if (!n->leaf) {
+            for (int i = 0; i <= n->count; ++i) destroy(n->child[i]);
+        }
+        delete n;
+    }
+
+    node * root_;
+};
+
+// keys 0..n-1 either fully shuffled or as interleaved sorted runs (each
+// client returns its lines in order; the server sees them interleaved)
+vector<uint32_t> make_keys (size_t n, bool runs) {
+    vector<uint32_t> keys (n);
+    for (size_t i = 0; i < n; ++i) keys[i] = i;
+    xoshiro256 rng (input_seed);
+    fisher_yates(keys.begin(), keys.end(), rng);
+    if (!runs) {
+        return keys;
+    }
+
+    size_t per_run = (n + interleaved_runs - 1) / interleaved_runs;
+    vector<vector<uint32_t> > run (interleaved_runs);
+    for (size_t i = 0; i < n; ++i) run[i / per_run].push_back(keys[i]);
+    for (int r = 0; r < interleaved_runs; ++r) sort(run[r].begin(), run[r].end());
+
+    vector<uint32_t> out;
+    vector<size_t> pos (interleaved_runs, 0);
+    while (out.size() < n) {
+        int r = rng.bounded(interleaved_runs);
+        if (pos[r] < run[r].size()) out.push_back(run[r][pos[r]++]);
+    }
+    return out;
+}
+
+void bench_index () {
+    vector<size_t> sizes;
+    sizes.push_back(1000);
+    sizes.push_back(100000);
+    if (!config.quick) sizes.push_back(1000000);
+
+    for (size_t s = 0; s < sizes.size(); ++s) {
+        for (int runs = 0; runs < 2; ++runs) {
+            size_t n = sizes[s];
+            vector<uint32_t> keys = make_keys(n, runs);
+            string input = to_string(n) + (runs ? "/runs" : "/random");
+            size_t bytes = n * sizeof(keyed_line);
+
+            // the server's path: insert every line, then drain in order
+            measure("index", "avl", input, n, bytes, [&] {
+                struct btree * root = NULL;
+                for (size_t i = 0; i < n; ++i) {
+                    root = add(root, keys[i], NULL, 0);
+                }
+                long sum = 0;
+                while (root != NULL) {
+                    struct btree * min_node = find_min(root);
+                    sum += min_node->line_num;
+                    root = delete_node(root, min_node);
+                }
+                keep(sum);
+            });
+
+            vector<keyed_line> items (n);
+            vector<keyed_line> scratch;
+            auto reset = [&] {
+                for (size_t i = 0; i < n; ++i) {
+                    items[i].key = keys[i];
+                    items[i].line = NULL;
+                }
+            };
+
+            measure("index", "qsort", input, n, bytes, [&] {
+                qsort(&items[0], n, sizeof(keyed_line), compare_keyed);
+                keep(items[0]);
+            }, reset);
+
+            measure("index", "radix", input, n, bytes, [&] {
+                radix_sort(items, scratch);
+                keep(items[0]);
+            }, reset);
+
+            // direct index: line numbers are dense, so they can address an
+            // array; needs the maximum line number up front
+            vector<char *> slots;
+            vector<char> present;
+            measure("index", "direct", input, n, bytes, [&] {
+                slots.assign(n, NULL);
+                present.assign(n, 0);
+                for (size_t i = 0; i < n; ++i) {
+                    slots[keys[i]] = NULL;
+                    present[keys[i]] = 1;
+                }
+                long sum = 0;
+                for (size_t k = 0; k < n; ++k) {
+                    if (present[k]) sum += k;
+                }
+                keep(sum);
+            });
+
+            measure("index", "btree", input, n, bytes, [&] {
+                key_btree tree;
+                for (size_t i = 0; i < n; ++i) {
+                    keyed_line item = { keys[i], NULL };
+                    tree.insert(item);
+                }
+                long sum = 0;
+                tree.walk([&sum] (const keyed_line & item) { sum += item.key; });
+                keep(sum);
+            });
+
+            measure("index", "std::map", input, n, bytes, [&] {
+                map<uint32_t, char *> tree;
+                for (size_t i = 0; i < n; ++i) tree[keys[i]] = NULL;
+                long sum = 0;
+                for (map<uint32_t, char *>::const_iterator it = tree.begin();
+                     it != tree.end(); ++it) {
+                    sum += it->first;
+                }
+                keep(sum);
+            });
+        }
+    }
+}
+
+// ---------------------------------------------------------------- ingest
+
+int sum_line (void * arg, int line_num, char * line, int length) {
+    (void) length;
+    *static_cast<long *>(arg) += line_num;
+    free(line);
+    return 1;
+}
+
+// each thread inserts one client's sorted run, as the server's ingest
+// threads do with a batch of chunks; on a machine with fewer cores
+// than threads the larger cases only show the locking overhead
+void bench_ingest () {
+    size_t n = config.quick ? 100000 : 1000000;
+    string size = to_string(n);
+    unsigned int cores = thread::hardware_concurrency();
+
+    for (int threads = 1; threads <= max_ingest_threads; threads *= 2) {
+        string input = size + "/" + to_string(threads) + "t";
+        size_t bytes = n * sizeof(keyed_line);
+        if (static_cast<unsigned int>(threads) > cores && !config.json) {
+            cout << "# ingest/" << input << ": " << threads << " threads on "
+                 << cores << " cores" << endl;
+        }
+
+        measure("ingest", "sharded", input, n, bytes, [&] {
+            struct line_index index;
+            line_index_init(&index, threads > 1 ? LINE_INDEX_SHARDS : 1, 0);
+            vector<thread> workers;
+            for (int t = 0; t < threads; ++t) {
+                workers.push_back(thread([&index, n, threads, t] {
+                    for (size_t k = t; k < n; k += threads) {
+                        line_index_add(&index, k, NULL, 0);
+                    }
+                }));
+            }
+            for (size_t t = 0; t < workers.size(); ++t) workers[t].join();
+            long sum = 0;
+            line_index_take_all(&index, sum_line, &sum);
+            line_index_free(&index);
+            keep(sum);
+        });
+
+        measure("ingest", "avl+lock", input, n, bytes, [&] {
+            struct btree * root = NULL;
+            pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+            vector<thread> workers;
+            for (int t = 0; t < threads; ++t) {
+                workers.push_back(thread([&root, &lock, n, threads, t] {
+                    for (size_t k = t; k < n; k += threads) {
+                        pthread_mutex_lock(&lock);
+                        root = add(root, k, NULL, 0);
+                        pthread_mutex_unlock(&lock);
+                    }
+                }));
+            }
+            for (size_t t = 0; t < workers.size(); ++t) workers[t].join();
+            long sum = 0;
+            while (root != NULL) {
+                struct btree * min_node = find_min(root);
+                sum += min_node->line_num;
+                root = delete_node(root, min_node);
+            }
+            keep(sum);
+        });
+    }
+}
+
+// ---------------------------------------------------------------- split
+
+// the splitter's record type
+struct numbered_line {
+    numbered_line() : number(0) {}
+    int number;
+    string text;
+};
+
+void bench_split () {
+    size_t n = config.quick ? 100000 : 1000000;
+    unsigned threads = thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+
+    vector<numbered_line> lines (n);
+    size_t bytes = 0;
+    for (size_t i = 0; i < n; ++i) {
+        lines[i].number = i;
+        lines[i].text.assign(40 + i % 40, 'x');
+        bytes += lines[i].text.size() + 12;
+    }
+    string input = to_string(n);
+
+    vector<numbered_line> work;
+    auto reset = [&] { work = lines; };
+
+    measure("split", "fisher_yates", input, n, n * sizeof(numbered_line), [&] {
+        xoshiro256 rng (input_seed);
+        fisher_yates(work.begin(), work.end(), rng);
+    }, reset);
+    measure("split", "parallel_shuffle/1", input, n, n * sizeof(numbered_line), [&] {
+        parallel_shuffle(work, input_seed, 1);
+    }, reset);
+    if (threads > 1) {
+        measure("split", "parallel_shuffle/" + to_string(threads), input, n,
+                n * sizeof(numbered_line), [&] {
+            parallel_shuffle(work, input_seed, threads);
+        }, reset);
+    }
+
+    string path = config.tmp_dir + "/microbench_fragment." + to_string(getpid());
+
+    // the original write_fragment: one endl (and so one flush) per line
+    measure("split", "write_endl", input, n, bytes, [&] {
+        ofstream ofs (path.c_str());
+        for (size_t i = 0; i < n; ++i) {
+            ofs << lines[i].number << " " << lines[i].text << endl;
+        }
+    });
+    measure("split", "write_newline", input, n, bytes, [&] {
+        ofstream ofs (path.c_str());
+        for (size_t i = 0; i < n; ++i) {
+            ofs << lines[i].number << " " << lines[i].text << '\n';
+        }
+    });
+
+    vector<uint64_t> numbers (n);
+    vector<string> records (n);
+    for (size_t i = 0; i < n; ++i) {
+        numbers[i] = lines[i].number;
+        records[i] = to_string(lines[i].number) + " " + lines[i].text;
+    }
+    measure("split", "write_indexed", input, n, bytes, [&] {
+        write_indexed_fragment(numbers, records, path.c_str());
+    });
+
+    unlink(path.c_str());
+}
+
+// ---------------------------------------------------------------- main
+
+int main (int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--quick") {
+            config.quick = true;
+            config.min_seconds = 0.02;
+        } else if (arg == "--json") {
+            config.json = true;
+        } else if (arg == "--filter" && i + 1 < argc) {
+            config.filter = argv[++i];
+        } else if (arg == "--tmp-dir" && i + 1 < argc) {
+            config.tmp_dir = argv[++i];
+        } else {
+            cout << "usage: " << argv[0]
+                 << " [--filter <substring>] [--quick] [--json]"
+                 << " [--tmp-dir <dir>]" << endl;
+            return bad_option;
+        }
+    }
+
+    bench_scan();
+    bench_parse();
+    bench_grow();
+    bench_index();
+    bench_ingest();
+    bench_split();
+
+    return success;
+}
@@ -0,0 +1,129 @@
+/*
+permutation.c - indexing, ordering and encoding permutation results
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "permutation.h"
+#include "result_format.h"
+
+#define INITIAL_ENTRIES 1024
+
+size_t put_varint(unsigned char * out, uint64_t value)
+{
+    size_t n = 0;
+    while(value >= 0x80)
+    {
+        out[n++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    out[n++] = value;
+    return n;
+}
+
+int compare_index_entry(const void * a, const void * b)
+{
+    const struct fragment_index_entry * ea = a;
+    const struct fragment_index_entry * eb = b;
+    if(ea->line_num == eb->line_num)
+    {
+        return 0;
+    }
+    return (ea->line_num < eb->line_num) ? -1 : 1;
+}
+
+//the number at the start of a record, like sscanf "%d" but bounded
+//by the record since fragment data is not '\0' terminated
+//returns 0 if there is no number
+static int parse_line_num(const char * record, const char * end, uint64_t * line_num)
+{
+    const char * c = record;
+    while(c < end && (*c == ' ' || *c == '\t'))
+    {
+        c++;
+    }
+
+    uint64_t value = 0;
+    const char * digits = c;
+    while(c < end && *c >= '0' && *c <= '9' && value <= INT_MAX)
+    {
+        value = value * 10 + (*c - '0');
+        c++;
+    }
+    if(c == digits || value > INT_MAX)
+    {
+        return 0;
+    }
+    *line_num = value;
+    return 1;
+}
+
+uint64_t index_plain_fragment(const char * data, uint64_t size,
+                              struct fragment_index_entry ** entries)
+{
+    uint64_t count = 0;
+    uint64_t capacity = 0;
+    *entries = NULL;
+
+    uint64_t offset = 0;
+    while(offset < size)
+    {
+        const char * record = data + offset;
+        const char * newline = memchr(record, '\n', size - offset);
+        if(newline == NULL)
+        {
+            //an unterminated last record cannot be sent back
+            break;
+        }
+        uint64_t length = newline - record + 1;
+
+        uint64_t line_num;
+        if(parse_line_num(record, newline, &line_num))
+        {
+            if(count == capacity)
+            {
+                capacity = capacity ? capacity * 2 : INITIAL_ENTRIES;
+                *entries = realloc(*entries, sizeof(struct fragment_index_entry) * capacity);
+            }
+            (*entries)[count].line_num = line_num;
+            (*entries)[count].offset = offset;
+            (*entries)[count].length = length;
+            (*entries)[count].reserved = 0;
+            count++;
+        }
+        offset += length;
+    }
+    return count;
+}
+
+unsigned char * encode_permutation(struct fragment_index_entry * entries, uint64_t count,
+                                   uint64_t base, size_t * len)
+{
+    size_t max_bytes = RESULT_MAGIC_LEN + VARINT_MAX_BYTES * (1 + RESULT_FIELDS * count);
+    unsigned char * out = malloc(max_bytes);
+    if(!out)
+    {
+        return NULL;
+    }
+
+    memcpy(out, RESULT_MAGIC, RESULT_MAGIC_LEN);
+    size_t n = RESULT_MAGIC_LEN;
+    n += put_varint(out + n, count);
+
+    uint64_t prev_line = 0;
+    for(uint64_t i = 0; i < count; i++)
+    {
+        n += put_varint(out + n, entries[i].line_num - prev_line);
+        n += put_varint(out + n, base + entries[i].offset);
+        n += put_varint(out + n, entries[i].length);
+        prev_line = entries[i].line_num;
+    }
+
+    *len = n;
+    return out;
+}
@@ -0,0 +1,37 @@
+/*
+permutation.h - the sort kernels behind a permutation result: find
+where every line of a fragment is, order them by line number and
+encode them as result_format.h describes. Used by the client and by
+the server's local executor.
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#ifndef PERMUTATION_H
+#define PERMUTATION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fragment_format.h"
+
+//little endian base 128, returns the bytes used
+size_t put_varint(unsigned char * out, uint64_t value);
+
+//orders fragment_index_entry by line number
+int compare_index_entry(const void * a, const void * b);
+
+//where every "<num> <text>\n" record of a plain fragment is
+//records without a number are skipped; returns how many were found
+//*entries is malloc'd, or NULL if there were none
+uint64_t index_plain_fragment(const char * data, uint64_t size,
+                              struct fragment_index_entry ** entries);
+
+//encode entries already sorted by line number, without the "EOF\n"
+//'base' is added to each offset to make it relative to the start of
+//the fragment; returns a malloc'd buffer and sets *len, NULL on failure
+unsigned char * encode_permutation(struct fragment_index_entry * entries, uint64_t count,
+                                   uint64_t base, size_t * len);
+
+#endif
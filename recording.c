@@ -0,0 +1,208 @@
+/*
+recording.c - writing result streams to a recording and reading them back
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "recording.h"
+#include "permutation.h"
+#include "result_format.h"
+#include "stats.h"
+#include "log.h"
+
+//big stdio buffers so a recording is written in large sequential chunks
+#define RECORDING_BUFFER_SIZE 65536
+//a tag and three varints
+#define RECORD_HEADER_MAX (1 + 3 * VARINT_MAX_BYTES)
+#define NS_PER_US 1000ULL
+
+int recording_open(struct recording * rec, char * path)
+{
+    rec->failed = 0;
+    rec->last_ns = stats_now();
+    rec->file = fopen(path, "w");
+    if(rec->file == NULL)
+    {
+        return 0;
+    }
+    setvbuf(rec->file, NULL, _IOFBF, RECORDING_BUFFER_SIZE);
+    if(fwrite(RECORDING_MAGIC, 1, RECORDING_MAGIC_LEN, rec->file) != RECORDING_MAGIC_LEN)
+    {
+        fclose(rec->file);
+        rec->file = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+//the tag, connection and time of a record; returns the bytes used
+static size_t put_record_header(struct recording * rec, unsigned char * out, int kind, int conn)
+{
+    uint64_t now = stats_now();
+    size_t n = 0;
+    out[n++] = kind;
+    n += put_varint(out + n, conn);
+    n += put_varint(out + n, (now - rec->last_ns) / NS_PER_US);
+    //only whole microseconds are taken off, so rounding does not drift
+    rec->last_ns += (now - rec->last_ns) / NS_PER_US * NS_PER_US;
+    return n;
+}
+
+static void write_record(struct recording * rec, unsigned char * header, size_t header_len,
+                         const char * data, int len)
+{
+    if(fwrite(header, 1, header_len, rec->file) != header_len ||
+       (len > 0 && fwrite(data, 1, len, rec->file) != (size_t) len))
+    {
+        log_warn("Could not write the recording, no more is recorded: %s\n", strerror(errno));
+        rec->failed = 1;
+    }
+}
+
+void recording_start(struct recording * rec, int conn, int manifest_index)
+{
+    if(rec->failed)
+    {
+        return;
+    }
+    unsigned char header[RECORD_HEADER_MAX];
+    size_t n = put_record_header(rec, header, RECORD_OPEN, conn);
+    n += put_varint(header + n, manifest_index);
+    write_record(rec, header, n, NULL, 0);
+}
+
+void recording_chunk(struct recording * rec, int conn, const char * buf, int len)
+{
+    if(rec->failed)
+    {
+        return;
+    }
+    unsigned char header[RECORD_HEADER_MAX];
+    size_t n = put_record_header(rec, header, RECORD_DATA, conn);
+    n += put_varint(header + n, len);
+    write_record(rec, header, n, buf, len);
+}
+
+int recording_close(struct recording * rec)
+{
+    int ok = !rec->failed;
+    if(fclose(rec->file) != 0)
+    {
+        ok = 0;
+    }
+    rec->file = NULL;
+    return ok;
+}
+
+int recording_load(struct recording_reader * reader, char * path)
+{
+    memset(reader, 0, sizeof(*reader));
+    FILE * file = fopen(path, "r");
+    if(file == NULL)
+    {
+        return 0;
+    }
+
+    //read to the end rather than trusting a size up front
+    uint64_t capacity = RECORDING_BUFFER_SIZE;
+    reader->data = malloc(capacity);
+    size_t got;
+    while(reader->data != NULL &&
+          (got = fread(reader->data + reader->size, 1, capacity - reader->size, file)) > 0)
+    {
+        reader->size += got;
+        if(reader->size == capacity)
+        {
+            capacity *= 2;
+            char * grown = realloc(reader->data, capacity);
+            if(grown == NULL)
+            {
+                free(reader->data);
+            }
+            reader->data = grown;
+        }
+    }
+    int ok = reader->data != NULL && !ferror(file) && reader->size >= RECORDING_MAGIC_LEN &&
+             memcmp(reader->data, RECORDING_MAGIC, RECORDING_MAGIC_LEN) == 0;
+    fclose(file);
+    if(!ok)
+    {
+        recording_unload(reader);
+        return 0;
+    }
+    reader->pos = RECORDING_MAGIC_LEN;
+    return 1;
+}
+
+void recording_unload(struct recording_reader * reader)
+{
+    free(reader->data);
+    reader->data = NULL;
+    reader->size = 0;
+}
+
+//returns 0 if the varint runs past the end of the recording
+static int get_varint(struct recording_reader * reader, uint64_t * value)
+{
+    *value = 0;
+    for(int shift = 0; reader->pos < reader->size; shift += 7)
+    {
+        unsigned char byte = reader->data[reader->pos++];
+        //bits past 64 are dropped, as ingest.c does
+        if(shift < 64)
+        {
+            *value |= (uint64_t) (byte & 0x7f) << shift;
+        }
+        if(!(byte & 0x80))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int recording_next(struct recording_reader * reader, struct record * record)
+{
+    if(reader->pos == reader->size)
+    {
+        return RECORD_END;
+    }
+    record->kind = reader->data[reader->pos++];
+
+    uint64_t conn;
+    uint64_t us;
+    uint64_t value;
+    if(!get_varint(reader, &conn) || !get_varint(reader, &us) || !get_varint(reader, &value))
+    {
+        return RECORD_TRUNCATED;
+    }
+    reader->us += us;
+    record->conn = conn;
+    record->us = reader->us;
+    record->data = NULL;
+    record->len = 0;
+
+    switch(record->kind)
+    {
+        case RECORD_OPEN:
+            record->manifest_index = value;
+            return RECORD_OK;
+        case RECORD_DATA:
+            if(value > reader->size - reader->pos)
+            {
+                return RECORD_TRUNCATED;
+            }
+            record->data = reader->data + reader->pos;
+            record->len = value;
+            reader->pos += value;
+            return RECORD_OK;
+        default:
+            return RECORD_TRUNCATED;
+    }
+}
@@ -0,0 +1,95 @@
+/*
+recording.h - the result streams of a job as the server received
+them, written by --record and played back by ./replay.
+
+A recording is the magic, then one record per event, with every
+number a varint (permutation.h):
+
+    "REC1"
+    'o' conn  us  manifest index          a connection's first chunk
+                                          follows, it sorted this fragment
+    'd' conn  us  length  bytes           a chunk was read from it
+
+conn is the server's connection number and us the microseconds since
+the record before it (since --record opened the file for the first).
+Only chunks the server went on to ingest are recorded, in the order it
+read them, so consecutive chunks from different connections are the
+ones one pass of the event loop read together.
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define RECORDING_MAGIC "REC1"
+#define RECORDING_MAGIC_LEN 4
+
+#define RECORD_OPEN 'o'
+#define RECORD_DATA 'd'
+
+//recording_next return values
+#define RECORD_OK 0
+#define RECORD_END 1
+#define RECORD_TRUNCATED 2
+
+//the writing side, in the server
+struct recording
+{
+    FILE * file;
+    //stats_now() of the last record
+    uint64_t last_ns;
+    //a write failed and recording stopped
+    int failed;
+};
+
+//one record read back
+struct record
+{
+    int kind;
+    int conn;
+    //microseconds since the start of the recording
+    uint64_t us;
+    //RECORD_OPEN
+    int manifest_index;
+    //RECORD_DATA: the chunk, inside the loaded recording
+    char * data;
+    int len;
+};
+
+//the reading side: the whole file in memory, so replay times none
+//of the disk reads
+struct recording_reader
+{
+    char * data;
+    uint64_t size;
+    uint64_t pos;
+    uint64_t us;
+};
+
+//create or truncate 'path' and write the magic; returns 1 on success
+int recording_open(struct recording * rec, char * path);
+
+//connection 'conn' was given the fragment at 'manifest_index'
+void recording_start(struct recording * rec, int conn, int manifest_index);
+
+//connection 'conn' sent these bytes
+void recording_chunk(struct recording * rec, int conn, const char * buf, int len);
+
+//flush and close; returns 1 if every record made it to disk
+int recording_close(struct recording * rec);
+
+//read a recording into memory; returns 1 if it is one
+int recording_load(struct recording_reader * reader, char * path);
+
+void recording_unload(struct recording_reader * reader);
+
+//the next record; RECORD_END after the last one, RECORD_TRUNCATED
+//if the file stops inside a record or holds something else
+int recording_next(struct recording_reader * reader, struct record * record);
+
+#endif
@@ -0,0 +1,432 @@
+/*
+replay.c - plays a recording made with ./server --record through the
+server's side of a job with no sockets and no clients: the same line
+readers, line index, ingest pool and ordered output, fed the chunks
+the server read, in the order it read them. Consecutive chunks from
+different connections go in as one batch, as a pass of the event loop
+would have them.
+
+    --speed max         feed chunks as fast as they are ingested (default)
+    --speed recorded    wait for each batch until it came in on the server
+    --ingest-threads n  as on the server
+    --output file       where the merged output goes (default /dev/null)
+    --stats file        where the summary goes (default stdout)
+
+and at the end it writes the server's job summary as JSON, so the same
+recording can be timed against different builds on any machine. On
+stdout the summary comes after any warnings.
+
+Example:
+    ./server --record book.rec book.manifest 8080
+    ./replay --ingest-threads 4 book.rec book.manifest
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "alloc_profile.h"
+#include "fragment.h"
+#include "ingest.h"
+#include "ingest_pool.h"
+#include "line_index.h"
+#include "log.h"
+#include "recording.h"
+#include "stats.h"
+
+#define FALSE 0
+#define TRUE 1
+
+//main function return values
+#define SUCCESS 0
+#define INCORRECT_CMD_ARGS 1
+#define BAD_RECORDING 2
+#define BAD_MANIFEST 3
+#define NO_OUTPUT_FILE 4
+#define FAILED_TO_WRITE_OUTPUT_FILE 5
+
+#define EXPECTED_ARGS 2
+#define RECORDING_ARG 1
+#define MANIFEST_ARG 2
+
+#define DEFAULT_OUTPUT "/dev/null"
+#define RW_ACCESS 0666
+#define DECIMAL_NUM 10
+
+//the most chunks the server ingests in one pass, its MAX_EVENTS
+#define REPLAY_BATCH 1024
+#define INITIAL_CONNS 64
+
+#define NS_PER_US 1000ULL
+#define NS_PER_S 1000000000ULL
+
+//a connection of the recording
+struct replay_conn
+{
+    struct line_reader reader;
+    int opened;
+    //has a chunk in the batch being built
+    int in_batch;
+};
+
+struct replay_conns
+{
+    struct replay_conn * conns;
+    int count;
+};
+
+int usage(char * message)
+{
+    printf("Expected ./replay [--speed max|recorded] [--ingest-threads <n>] [--output <file>]\n"
+           "                  [--stats <json file>] <recording> <manifest>\n%s\n", message);
+    return INCORRECT_CMD_ARGS;
+}
+
+int string_to_int(int * num, char * str)
+{
+    char * end;
+    errno = 0;
+    long value = strtol(str, &end, DECIMAL_NUM);
+    if(errno != 0 || end == str || *end != '\0' || value < 0 || value > INT32_MAX)
+    {
+        return FALSE;
+    }
+    *num = value;
+    return TRUE;
+}
+
+//the connection numbered 'id', grown into as the recording names it
+//returns NULL for a number no server hands out, or if out of memory
+struct replay_conn * get_conn(struct replay_conns * conns, int id)
+{
+    if(id < 0 || id > INT32_MAX / 2)
+    {
+        return NULL;
+    }
+    if(id >= conns->count)
+    {
+        int count = conns->count ? conns->count : INITIAL_CONNS;
+        while(count <= id)
+        {
+            count *= 2;
+        }
+        struct replay_conn * grown = realloc(conns->conns, sizeof(struct replay_conn) * count);
+        if(grown == NULL)
+        {
+            return NULL;
+        }
+        memset(grown + conns->count, 0, sizeof(struct replay_conn) * (count - conns->count));
+        conns->conns = grown;
+        conns->count = count;
+    }
+    return &conns->conns[id];
+}
+
+//set a connection up for the fragment it sorted, mapped as the
+//server maps it so permutation results can be copied out of it
+//returns FALSE if the fragment is not in the manifest or will not open
+int open_conn(struct replay_conn * conn, int manifest_index, struct fragment_info * fragments,
+              int * by_manifest, int num_fragments)
+{
+    if(manifest_index < 0 || manifest_index >= num_fragments)
+    {
+        return FALSE;
+    }
+    struct fragment_info * fragment = &fragments[by_manifest[manifest_index]];
+    if(!open_fragment(fragment, NULL))
+    {
+        return FALSE;
+    }
+    map_fragment(fragment);
+    line_reader_init(&conn->reader);
+    line_reader_set_fragment(&conn->reader, fragment->data, fragment->size, NULL);
+    conn->opened = TRUE;
+    return TRUE;
+}
+
+//--speed recorded: sleep until 'us' into the replay
+void wait_until(uint64_t start_ns, uint64_t us)
+{
+    uint64_t target = start_ns + us * NS_PER_US;
+    uint64_t now = stats_now();
+    if(now >= target)
+    {
+        return;
+    }
+    struct timespec ts;
+    ts.tv_sec = (target - now) / NS_PER_S;
+    ts.tv_nsec = (target - now) % NS_PER_S;
+    while(nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
+
+int main(int argc, char * argv[])
+{
+    int recorded_speed = FALSE;
+    int ingest_threads = 1;
+    char * output_path = DEFAULT_OUTPUT;
+    char * stats_path = NULL;
+
+    static struct option long_options[] = {
+        {"speed", required_argument, NULL, 's'},
+        {"ingest-threads", required_argument, NULL, 'i'},
+        {"output", required_argument, NULL, 'o'},
+        {"stats", required_argument, NULL, 'j'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while((opt = getopt_long(argc, argv, "s:i:o:j:", long_options, NULL)) != -1)
+    {
+        switch(opt)
+        {
+            case 's':
+                if(strcmp(optarg, "max") == 0)
+                {
+                    recorded_speed = FALSE;
+                }
+                else if(strcmp(optarg, "recorded") == 0)
+                {
+                    recorded_speed = TRUE;
+                }
+                else
+                {
+                    return usage("--speed is max or recorded");
+                }
+                break;
+            case 'i':
+                if(!string_to_int(&ingest_threads, optarg) || ingest_threads < 1)
+                {
+                    return usage("--ingest-threads is a positive number");
+                }
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'j':
+                stats_path = optarg;
+                break;
+            default:
+                return usage("unknown option");
+        }
+    }
+
+    //positional arguments keep their original indexes
+    if(argc - optind != EXPECTED_ARGS)
+    {
+        return usage("you used incorrect num args");
+    }
+    argv += optind - 1;
+
+    //drains and stops itself at exit
+    log_init();
+
+    struct recording_reader reader;
+    if(!recording_load(&reader, argv[RECORDING_ARG]))
+    {
+        printf("%s is not a recording\n", argv[RECORDING_ARG]);
+        return BAD_RECORDING;
+    }
+
+    //the manifest's output file is left alone
+    char * manifest_output = NULL;
+    struct fragment_info * fragments = NULL;
+    int num_fragments = 0;
+    if(read_manifest(argv[MANIFEST_ARG], &manifest_output, &fragments, &num_fragments) != MANIFEST_OK)
+    {
+        printf("Could not read the manifest %s\n", argv[MANIFEST_ARG]);
+        recording_unload(&reader);
+        return BAD_MANIFEST;
+    }
+    free(manifest_output);
+
+    //fragments are listed largest first, the recording names them
+    //by their place in the manifest
+    int * by_manifest = malloc(sizeof(int) * (num_fragments ? num_fragments : 1));
+    for(int f = 0; f < num_fragments; f++)
+    {
+        by_manifest[fragments[f].manifest_index] = f;
+    }
+
+    int output = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, RW_ACCESS);
+    if(output == -1)
+    {
+        printf("Could not open the output file %s: %s\n", output_path, strerror(errno));
+        free(by_manifest);
+        close_fragments(num_fragments, fragments);
+        recording_unload(&reader);
+        return NO_OUTPUT_FILE;
+    }
+
+    struct line_index index;
+    line_index_init(&index, ingest_threads > 1 ? LINE_INDEX_SHARDS : 1, 0);
+    struct ingest_pool pool_engine;
+    struct ingest_pool * pool = NULL;
+    if(ingest_threads > 1 && ingest_pool_start(&pool_engine, ingest_threads - 1, &index))
+    {
+        pool = &pool_engine;
+    }
+    struct ingest_task * tasks = calloc(REPLAY_BATCH, sizeof(struct ingest_task));
+    struct replay_conns conns = {NULL, 0};
+
+    int ret = SUCCESS;
+    int next_line = 0;
+    uint64_t freed = 0;
+    struct server_stats stats;
+    stats_init(&stats);
+
+    struct record record;
+    int status = recording_next(&reader, &record);
+    while(status == RECORD_OK && ret == SUCCESS)
+    {
+        //one pass of the event loop: a chunk from each of several
+        //connections, up to the first connection seen twice
+        int num_tasks = 0;
+        while(status == RECORD_OK && num_tasks < REPLAY_BATCH)
+        {
+            struct replay_conn * conn = get_conn(&conns, record.conn);
+            if(conn == NULL)
+            {
+                printf("Could not set up connection %d\n", record.conn);
+                ret = BAD_RECORDING;
+                break;
+            }
+            if(record.kind == RECORD_OPEN)
+            {
+                if(!open_conn(conn, record.manifest_index, fragments, by_manifest, num_fragments))
+                {
+                    printf("Fragment %d of the recording is not in the manifest or will not open\n",
+                           record.manifest_index);
+                    ret = BAD_MANIFEST;
+                    break;
+                }
+                stats.connections++;
+            }
+            else
+            {
+                if(conn->in_batch)
+                {
+                    break;
+                }
+                if(!conn->opened)
+                {
+                    printf("Connection %d sends results before it was opened\n", record.conn);
+                    ret = BAD_RECORDING;
+                    break;
+                }
+                if(recorded_speed && num_tasks == 0)
+                {
+                    wait_until(stats.start_ns, record.us);
+                }
+
+                struct ingest_task * task = &tasks[num_tasks++];
+                task->owner = conn;
+                task->reader = &conn->reader;
+                task->buf = record.data;
+                task->len = record.len;
+                conn->in_batch = TRUE;
+                stats.bytes_in += record.len;
+            }
+            status = recording_next(&reader, &record);
+        }
+
+        if(pool != NULL)
+        {
+            ingest_pool_run(pool, tasks, num_tasks);
+        }
+        for(int t = 0; t < num_tasks && pool == NULL; t++)
+        {
+            ingest_task_run(&tasks[t], &index);
+        }
+
+        //the server's bookkeeping for each chunk, less the connections
+        for(int t = 0; t < num_tasks && ret == SUCCESS; t++)
+        {
+            struct ingest_task * task = &tasks[t];
+            struct replay_conn * conn = task->owner;
+            conn->in_batch = FALSE;
+
+            stats.lines += task->counts.lines;
+            stats.duplicates += task->counts.duplicates;
+            stats.malformed += task->counts.malformed;
+            stats.phases[PHASE_INSERT].ns += task->counts.insert_ns;
+            stats.phases[PHASE_INSERT].count += task->counts.lines;
+            stats.phases[PHASE_PARSE].ns += task->ns - task->counts.insert_ns;
+            stats.phases[PHASE_PARSE].count++;
+
+            uint64_t output_start = stats_now();
+            freed = 0;
+            if(!write_ready_output(&index, output, &next_line,
+                                   &stats.lines_written, &stats.bytes_written, &freed))
+            {
+                printf("Error Writing Output File: %s\n", strerror(errno));
+                ret = FAILED_TO_WRITE_OUTPUT_FILE;
+            }
+            if(freed > 0)
+            {
+                stats_phase_end(&stats, PHASE_OUTPUT, output_start);
+            }
+        }
+    }
+
+    //a server that was killed leaves the last record cut off
+    if(status == RECORD_TRUNCATED)
+    {
+        log_warn("The recording stops inside a record, replayed up to there\n");
+    }
+
+    uint64_t output_start = stats_now();
+    if(ret == SUCCESS && !write_output(&index, output, &stats.lines_written, &stats.bytes_written))
+    {
+        printf("Error Writing Output File: %s\n", strerror(errno));
+        ret = FAILED_TO_WRITE_OUTPUT_FILE;
+    }
+    stats_phase_end(&stats, PHASE_OUTPUT, output_start);
+
+    if(ret == SUCCESS)
+    {
+        FILE * stats_file = stats_path != NULL ? fopen(stats_path, "w") : stdout;
+        if(stats_file == NULL)
+        {
+            printf("Could not write stats to %s: %s\n", stats_path, strerror(errno));
+        }
+        else
+        {
+            //the log shares stdout
+            log_shutdown();
+            stats_write_json(stats_file, &stats, NULL, 0);
+            if(stats_file != stdout)
+            {
+                fclose(stats_file);
+            }
+        }
+        prof_report(stderr, "replay", stats.lines_written);
+    }
+
+    if(pool != NULL)
+    {
+        ingest_pool_stop(pool);
+    }
+    for(int c = 0; c < conns.count; c++)
+    {
+        if(conns.conns[c].opened)
+        {
+            line_reader_free(&conns.conns[c].reader);
+        }
+    }
+    free(conns.conns);
+    free(tasks);
+    line_index_free(&index);
+    close(output);
+    free(by_manifest);
+    close_fragments(num_fragments, fragments);
+    recording_unload(&reader);
+    return ret;
+}
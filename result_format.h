@@ -0,0 +1,41 @@
+/*
+result_format.h - layout of a permutation result.
+
+Instead of sending its sorted lines back as text, a client started
+with --permutation sends where each line is in the fragment it was
+given, in line order. The server already has the fragment, so it
+copies the text from there:
+
+    "PRM1"
+    varint line count
+    per line, in line order:
+        varint line number minus the previous one (the first minus 0)
+        varint offset of the record from the start of the fragment
+        varint record length including the trailing '\n'
+    "EOF\n"
+
+Varints are little endian base 128: seven bits per byte, low bits
+first, with the top bit set on every byte but the last.
+
+A text result starts with a digit or "EOF\n", so the server tells
+the two apart by the first bytes.
+
+Shared by client.c (writer) and ingest.c (reader).
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#ifndef RESULT_FORMAT_H
+#define RESULT_FORMAT_H
+
+#define RESULT_MAGIC "PRM1"
+#define RESULT_MAGIC_LEN 4
+
+//a 64 bit value takes at most this many varint bytes
+#define VARINT_MAX_BYTES 10
+
+//varints per line
+#define RESULT_FIELDS 3
+
+#endif
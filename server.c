@@ -23,6 +23,27 @@ Shawn Fong - f.shawn@wustl.edu
 #include <netdb.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <getopt.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "alloc_profile.h"
+#include "btree.h"
+#include "checkpoint.h"
+#include "daemon.h"
+#include "fragment.h"
+#include "ingest.h"
+#include "ingest_pool.h"
+#include "recording.h"
+#include "line_index.h"
+#include "line_util.h"
+#include "local_exec.h"
+#include "log.h"
+#include "shm_ring.h"
+#include "stats.h"
+#include "trace.h"
 
 #define FALSE 0
 #define TRUE 1
@@ -40,14 +61,25 @@ Shawn Fong - f.shawn@wustl.edu
 #define ERROR_EPOLL_SETUP 9
 #define FAILED_TO_CLOSE_SOCKET 10
 #define FAILED_TO_WRITE_OUTPUT_FILE 11
+#define BAD_CHECKPOINT 12
+#define NOT_RANGE_PARTITIONED 13
 
 #define EXPECTED_ARGS 2
+#define DAEMON_EXPECTED_ARGS 1
+
+//fragment cache of the daemon
+#define DEFAULT_CACHE_MB 256
+#define BYTES_PER_MB (1024ULL * 1024ULL)
+
+//the stats summary goes next to the output file unless --stats is given
+#define STATS_SUFFIX ".stats.json"
 
 #define RW_ACCCESS 0666
 
 //argv index of arguments
 #define FILE_ARG 1
 #define PORT_ARG 2
+#define DAEMON_PORT_ARG 1
 
 #define DECIMAL_NUM 10
 
@@ -59,251 +91,570 @@ Shawn Fong - f.shawn@wustl.edu
 
 #define DELIMITER '\n'
 
+//speculative re-execution: once SPEC_MIN_DONE_PCT of the fragments are
+//done, a fragment that has been out for SPEC_SLOWDOWN times the median
+//time per byte of the finished ones (and at least SPEC_MIN_ELAPSED_NS)
+//is queued again, up to SPEC_MAX_COPIES copies at once
+#define SPEC_MIN_DONE_PCT 50
+#define SPEC_SLOWDOWN 2.0
+#define SPEC_MIN_ELAPSED_NS 20000000ULL
+#define SPEC_MAX_COPIES 2
+#define SPEC_CHECK_MS 10
+
+#define BYTES_PER_KB 1024ULL
+
+//fragments are opened as they are dispatched: at most FD_CACHE_SIZE
+//fragment files are open at once, and the next PREFETCH_FRAGMENTS in
+//the queue are opened and read ahead of their turn
+#define FD_CACHE_SIZE 64
+#define PREFETCH_FRAGMENTS 4
+
+//events taken per epoll_wait, and connection slots to start with;
+//neither depends on the number of fragments
+#define MAX_EVENTS 1024
+#define INITIAL_CONN_SLOTS 64
+
+//where fragments are sorted
+enum exec_mode
+{
+    EXEC_REMOTE,
+    EXEC_LOCAL,
+    EXEC_AUTO
+};
+
+//--exec auto sorts a job this small entirely in the server
+#define EXEC_LOCAL_JOB_BYTES (4ULL * 1024ULL * 1024ULL)
+
+//--shm sizes a client's ring to hold its whole fragment, up to this;
+//a larger fragment goes round the ring as the client drains it
+#define SHM_RING_MAX_BYTES (64ULL * 1024ULL * 1024ULL)
+
+//bytes one read of a connection put in the tree, oldest first, so
+//they come off its count once the output has passed them
+struct inflight_chunk
+{
+    int last_line;
+    uint64_t bytes;
+};
+
+struct inflight
+{
+    struct inflight_chunk * chunks;
+    int head;
+    int count;
+    int capacity;
+    uint64_t bytes;
+};
+
+//flow control: 0 means no limit
+struct flow_limits
+{
+    //all received lines not written out yet
+    uint64_t total_bytes;
+    //lines of one connection not written out yet
+    uint64_t conn_bytes;
+    //connections paused at the last check
+    int num_paused;
+};
+
 //holds info about client
 //used for knowing 
 struct buff_info
 {
     int cfd;
-    int line_index;
-    int curr_len_line;
     int file_closed;
     int done_reading;
-    char * line;
+    //partial result line between reads
+    struct line_reader reader;
     int client_index;
+    //index into the fragments array of the fragment this client sorts
+    int fragment;
+    //closed because another copy of its fragment finished first
+    int cancelled;
+    //results as received, when checkpointing
+    FILE * spill;
+    //number of the last line received, -1 before the first
+    int last_line;
+    struct inflight inflight;
+    //EPOLLIN is off to push back on the client
+    int paused;
+    //the other end is one of the server's own sort threads
+    int local;
+    //listening sockets only: the Unix listener hangs off the TCP one
+    struct buff_info * next_listener;
+    //what was last read, until the batch it is in has been ingested
+    char * chunk;
+    //--concat: the result so far, handed to the fragment if it wins
+    struct concat_run * run;
+    struct client_stats stats;
+    uint64_t trace_accept_us;
 };
 
-//Balanced AVL Tree created partly by me and partly by chatgpt
+//set by SIGUSR1, checked by the event loop
+static volatile sig_atomic_t dump_stats_requested = 0;
 
-// AVL-balanced binary tree node. 'line' is caller-allocated; tree takes ownership.
-struct btree {
-    struct btree *left;
-    struct btree *right;
-    int line_num;
-    char *line;
-    int line_length;
-    int height;
-};
+void request_stats_dump(int sig)
+{
+    (void) sig;
+    dump_stats_requested = 1;
+}
 
-// Get height of a node (NULL -> 0)
-static int height(struct btree *n) {
-    return n ? n->height : 0;
+//gather the per-client stats of the n clients accepted so far
+//(buff_info_list[0] is the listening socket) and write them out
+void write_stats(FILE * out, struct server_stats * stats,
+                 struct buff_info ** buff_info_list, int n)
+{
+    struct client_stats ** clients = malloc(sizeof(struct client_stats *) * (n + 1));
+    for(int i = 0; i < n; i++)
+    {
+        clients[i] = &buff_info_list[i + 1]->stats;
+    }
+    stats_write_json(out, stats, clients, n);
+    free(clients);
 }
 
-// Return max of two ints
-static int max(int a, int b) {
-    return (a > b) ? a : b;
+//write the end of job summary to a file
+void save_stats(char * path, struct server_stats * stats,
+                struct buff_info ** buff_info_list, int n)
+{
+    FILE * out = fopen(path, "w");
+    if(out == NULL)
+    {
+        printf("Could not write stats to %s: %s\n", path, strerror(errno));
+        return;
+    }
+    write_stats(out, stats, buff_info_list, n);
+    fclose(out);
 }
 
-// Right rotate subtree rooted at y
-static struct btree *right_rotate(struct btree *y) {
-    struct btree *x = y->left;
-    struct btree *T2 = x->right;
+//only watch the listening sockets while there is a fragment to hand
+//out; otherwise a waiting connection would make them ready forever
+void set_accepting(int epfd, struct buff_info * sb, int accepting)
+{
+    for(struct buff_info * listener = sb; listener != NULL; listener = listener->next_listener)
+    {
+        struct epoll_event ev;
+        ev.events = accepting ? EPOLLIN : 0;
+        ev.data.ptr = listener;
+        if(epoll_ctl(epfd, EPOLL_CTL_MOD, listener->cfd, &ev) == -1)
+        {
+            log_error("Error Updating EPOLL: %s\n", strerror(errno));
+        }
+    }
+}
 
-    x->right = y;
-    y->left  = T2;
+void inflight_add(struct inflight * inflight, int last_line, uint64_t bytes)
+{
+    if(inflight->count == inflight->capacity)
+    {
+        //grow and unwrap the ring
+        int capacity = inflight->capacity ? inflight->capacity * 2 : 16;
+        struct inflight_chunk * chunks = malloc(sizeof(struct inflight_chunk) * capacity);
+        for(int i = 0; i < inflight->count; i++)
+        {
+            chunks[i] = inflight->chunks[(inflight->head + i) % inflight->capacity];
+        }
+        free(inflight->chunks);
+        inflight->chunks = chunks;
+        inflight->head = 0;
+        inflight->capacity = capacity;
+    }
+    inflight->chunks[(inflight->head + inflight->count) % inflight->capacity].last_line = last_line;
+    inflight->chunks[(inflight->head + inflight->count) % inflight->capacity].bytes = bytes;
+    inflight->count++;
+    inflight->bytes += bytes;
+}
 
-    // Update heights
-    y->height = max(height(y->left), height(y->right)) + 1;
-    x->height = max(height(x->left), height(x->right)) + 1;
+//a client sends its lines in order, so every read that ended below
+//the output's next line has been written out
+void inflight_release(struct inflight * inflight, int next_line)
+{
+    while(inflight->count > 0 && inflight->chunks[inflight->head].last_line < next_line)
+    {
+        inflight->bytes -= inflight->chunks[inflight->head].bytes;
+        inflight->head = (inflight->head + 1) % inflight->capacity;
+        inflight->count--;
+    }
+}
 
-    return x;
+//turn reading from a client on or off; while it is off the client's
+//sends back up in TCP. Nothing at all is watched, like the listening
+//socket, so a hang up is only seen once reading is back on
+void set_reading(int epfd, struct buff_info * cb, int reading)
+{
+    struct epoll_event ev;
+    ev.events = reading ? EPOLLIN | EPOLLRDHUP : 0;
+    ev.data.ptr = cb;
+    if(epoll_ctl(epfd, EPOLL_CTL_MOD, cb->cfd, &ev) == -1)
+    {
+        log_error("Error Updating EPOLL: %s\n", strerror(errno));
+    }
+    cb->paused = !reading;
 }
 
-// Left rotate subtree rooted at x
-static struct btree *left_rotate(struct btree *x) {
-    struct btree *y = x->right;
-    struct btree *T2 = y->left;
+//pause the connections that are ahead while too much is buffered.
+//The client with the lowest last line is never paused: the output is
+//waiting on a line no other client can still send below it, so it
+//always makes progress. 'cb' just added 'buffered' bytes
+void apply_backpressure(int epfd, struct buff_info * cb, struct buff_info ** buff_info_list, int num_conns,
+                        struct flow_limits * limits, uint64_t buffered, int next_line,
+                        struct server_stats * stats)
+{
+    int over = limits->total_bytes && buffered > limits->total_bytes;
+    if(limits->conn_bytes && cb != NULL)
+    {
+        inflight_release(&cb->inflight, next_line);
+        over = over || cb->inflight.bytes > limits->conn_bytes;
+    }
+    if(!over && limits->num_paused == 0)
+    {
+        return;
+    }
 
-    y->left  = x;
-    x->right = T2;
+    struct buff_info * lowest = NULL;
+    for(int i = 1; i <= num_conns; i++)
+    {
+        struct buff_info * conn = buff_info_list[i];
+        if(conn->cfd == -1 || conn->done_reading)
+        {
+            continue;
+        }
+        inflight_release(&conn->inflight, next_line);
+        if(lowest == NULL || conn->last_line < lowest->last_line)
+        {
+            lowest = conn;
+        }
+    }
 
-    // Update heights
-    x->height = max(height(x->left), height(x->right)) + 1;
-    y->height = max(height(y->left), height(y->right)) + 1;
+    int global_over = limits->total_bytes && buffered > limits->total_bytes;
+    limits->num_paused = 0;
+    for(int i = 1; i <= num_conns; i++)
+    {
+        struct buff_info * conn = buff_info_list[i];
+        if(conn->cfd == -1 || conn->done_reading)
+        {
+            continue;
+        }
 
-    return y;
+        int pause = conn != lowest &&
+                    (global_over || (limits->conn_bytes && conn->inflight.bytes > limits->conn_bytes));
+        if(pause != conn->paused)
+        {
+            set_reading(epfd, conn, !pause);
+            stats->pauses += pause;
+        }
+        limits->num_paused += pause;
+    }
 }
 
-// Compute balance factor of n: left height - right height
-static int get_balance(struct btree *n) {
-    return n ? height(n->left) - height(n->right) : 0;
+//throw away the partial results of a client that will not finish
+void drop_spill(struct checkpoint * cp, struct buff_info * cb, struct fragment_info * fragments)
+{
+    if(cb->spill != NULL)
+    {
+        checkpoint_spill_abort(cp, cb->spill, fragments[cb->fragment].manifest_index, cb->client_index);
+        cb->spill = NULL;
+        cb->reader.spill = NULL;
+    }
 }
 
-// Rebalance node if unbalanced, using child's balance
-static struct btree *rebalance(struct btree *node) {
-    int balance = get_balance(node);
-    
-    // Left heavy
-    if (balance > 1) {
-        if (get_balance(node->left) >= 0) {
-            // LL case
-            return right_rotate(node);
-        } else {
-            // LR case
-            node->left = left_rotate(node->left);
-            return right_rotate(node);
-        }
-    }
-    // Right heavy
-    if (balance < -1) {
-        if (get_balance(node->right) <= 0) {
-            // RR case
-            return left_rotate(node);
-        } else {
-            // RL case
-            node->right = right_rotate(node->right);
-            return left_rotate(node);
-        }
-    }
-    return node;
-}
+//a client went away before "EOF\n": drop the connection and put its
+//fragment back in the queue. The lines it already sent stay in the
+//tree, and add drops them as duplicates when the fragment comes back
+void requeue_fragment(int epfd, struct buff_info * sb, struct buff_info * cb, struct fragment_queue * pending,
+                      struct fragment_info * fragments, struct server_stats * stats, struct checkpoint * cp)
+{
+    log_warn("Client %d died before finishing fragment %d, requeueing it\n",
+             cb->client_index, fragments[cb->fragment].manifest_index);
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, cb->cfd, NULL);
+    close(cb->cfd);
+    cb->cfd = -1;
+    line_reader_free(&cb->reader);
+    concat_run_free(cb->run);
+    cb->run = NULL;
+
+    cb->stats.failed = 1;
+    drop_spill(cp, cb, fragments);
+
+    //a speculative copy may still be running, or may already have won
+    struct fragment_info * fragment = &fragments[cb->fragment];
+    fragment->running--;
+    if(fragment->done || fragment->running > 0 || fragment->queued)
+    {
+        return;
+    }
 
-// Create new node, taking ownership of 'line'
-struct btree *new_node(int line_num, char *line, int line_length) {
-    struct btree *n = malloc(sizeof(*n));
-    if (!n) return NULL;
-    n->line_num = line_num;
-    n->line     = line;
-    n->left = n->right = NULL;
-    n->line_length = line_length;
-    n->height = 1;
-    return n;
+    stats->requeued++;
+    if(pending->count == 0)
+    {
+        set_accepting(epfd, sb, 1);
+    }
+    queue_fragment(pending, fragments, cb->fragment);
 }
 
-// Insert a node, rebalance along the way
-struct btree *add(struct btree *root, int line_num, char *line, int line_length) {
-    if (!root)
-        return new_node(line_num, line, line_length);
+//the first copy of a fragment to finish wins: close every other
+//connection still working on it. Lines they already sent are the same
+//lines, so the tree needs no clean up
+void cancel_copies(int epfd, struct buff_info * winner, struct buff_info ** buff_info_list,
+                   int num_conns, struct fragment_info * fragments, struct server_stats * stats,
+                   struct checkpoint * cp)
+{
+    for(int i = 1; i <= num_conns; i++)
+    {
+        struct buff_info * cb = buff_info_list[i];
+        if(cb == winner || cb->fragment != winner->fragment || cb->cfd == -1 || cb->done_reading)
+        {
+            continue;
+        }
 
-    if (line_num < root->line_num) {
-        root->left  = add(root->left,  line_num, line, line_length);
-    } else if (line_num > root->line_num) {
-        root->right = add(root->right, line_num, line, line_length);
-    } else {
-        printf("Duplicate line number (%d) given. Skipping this node\n", line_num);
-        free(line);
-        return root;
+        log_info("Fragment %d finished on client %d, dropping the copy on client %d\n",
+                 fragments[cb->fragment].manifest_index, winner->client_index, cb->client_index);
+        epoll_ctl(epfd, EPOLL_CTL_DEL, cb->cfd, NULL);
+        close(cb->cfd);
+        cb->cfd = -1;
+        line_reader_free(&cb->reader);
+        concat_run_free(cb->run);
+        cb->run = NULL;
+        drop_spill(cp, cb, fragments);
+        cb->cancelled = TRUE;
+        cb->stats.cancelled = 1;
+        stats->cancelled++;
+        fragments[cb->fragment].running--;
     }
-
-    // update height
-    root->height = 1 + max(height(root->left), height(root->right));
-    // rebalance
-    return rebalance(root);
 }
 
-// Find node with minimum key
-struct btree *find_min(struct btree *root) {
-    while (root && root->left)
-        root = root->left;
-    return root;
+int compare_double(const void * a, const void * b)
+{
+    double da = *(const double *) a;
+    double db = *(const double *) b;
+    return (da > db) - (da < db);
 }
 
-// Delete node by key, rebalance, free line and node
-struct btree *delete_node(struct btree *root, struct btree *node) {
-    if (!root || !node) return root;
-
-    if (node->line_num < root->line_num) {
-        root->left = delete_node(root->left, node);
-    }
-    else if (node->line_num > root->line_num) {
-        root->right = delete_node(root->right, node);
+//queue a second copy of fragments that are running far behind the
+//finished ones. 'rates' holds the ns per byte of the 'num_done'
+//finished fragments; returns TRUE if anything was queued
+int speculate(struct fragment_queue * pending, struct fragment_info * fragments, int num_fragments,
+              double * rates, int num_done, struct server_stats * stats)
+{
+    if(num_done == 0 || num_done * 100 < num_fragments * SPEC_MIN_DONE_PCT)
+    {
+        return FALSE;
     }
-    else {
-        if (!root->left || !root->right) {
-            struct btree *temp = root->left ? root->left : root->right;
-            free(root->line);
-            free(root);
-            return temp;
-        }
-        else {
-            struct btree *succ = find_min(root->right);
-            if (root->line) {
-                free(root->line);
-                // No need to set root->line = NULL yet, it's about to be overwritten
-            }
 
-            // 2. Copy the inorder successor's data to this node
-            root->line_num    = succ->line_num;
-            root->line        = succ->line;        // Take ownership of successor's line pointer
-            root->line_length = succ->line_length; // Copy length too
+    double * sorted = malloc(sizeof(double) * num_done);
+    memcpy(sorted, rates, sizeof(double) * num_done);
+    qsort(sorted, num_done, sizeof(double), compare_double);
+    double median = sorted[num_done / 2];
+    free(sorted);
 
-            // 3. IMPORTANT: Nullify the original successor's line pointer.
-            //    This prevents the recursive delete call below from freeing
-            //    the memory that 'root' now points to.
-            succ->line        = NULL;
-            succ->line_length = 0; // Also reset length for consistency
+    uint64_t now = stats_now();
+    int queued = FALSE;
+    for(int f = 0; f < num_fragments; f++)
+    {
+        struct fragment_info * fragment = &fragments[f];
+        if(fragment->done || fragment->queued || fragment->running == 0 ||
+           fragment->copies >= SPEC_MAX_COPIES)
+        {
+            continue;
+        }
 
-            root->right = delete_node(root->right, succ);
+        double limit = SPEC_SLOWDOWN * median * (fragment->size ? fragment->size : 1);
+        uint64_t elapsed = now - fragment->start_ns;
+        if(elapsed < SPEC_MIN_ELAPSED_NS || elapsed < limit)
+        {
+            continue;
         }
+
+        log_info("Fragment %d is straggling (%.1f ms), queueing a copy\n",
+                 fragment->manifest_index, elapsed / 1e6);
+        queue_fragment(pending, fragments, f);
+        stats->speculated++;
+        queued = TRUE;
     }
+    return queued;
+}
 
-    root->height = 1 + max(height(root->left), height(root->right));
-    return rebalance(root);
+//open the fragments next in line and have the kernel read them in
+//while the ones ahead of them are sent
+void prefetch_pending(struct fragment_queue * pending, struct fragment_info * fragments, struct fd_cache * fds)
+{
+    for(int i = 0; i < pending->count && i < PREFETCH_FRAGMENTS; i++)
+    {
+        prefetch_fragment(&fragments[pending->items[(pending->head + i) % pending->capacity]], fds);
+    }
 }
 
-//if there is an error we want to free the tree
-void free_tree(struct btree * root)
+//start a run of 'fragment' on connection 'cfd' and watch it
+//*cb is set even if adding it to epoll fails, since it is in the
+//list for the clean up by then; returns FALSE in that case
+int start_run(int epfd, int cfd, int fragment_index, struct buff_info *** buff_info_list,
+              int * num_conns, int * list_capacity, struct fragment_info * fragments,
+              struct checkpoint * cp, int concat, struct server_stats * stats,
+              uint64_t phase_start, uint64_t trace_start, struct buff_info ** cbp)
 {
-    if(root == NULL)
+    prof_phase(PHASE_ACCEPT);
+    struct buff_info * cb = prof_malloc(ALLOC_SITE_CONN, sizeof(struct buff_info));
+    prof_phase(ALLOC_PHASE_OTHER);
+    cb->done_reading = 0;
+    cb->file_closed = 0;
+    cb->cfd = cfd;
+    line_reader_init(&cb->reader);
+    cb->last_line = -1;
+    memset(&cb->inflight, 0, sizeof(cb->inflight));
+    cb->paused = FALSE;
+    cb->local = FALSE;
+    cb->next_listener = NULL;
+    cb->chunk = NULL;
+    cb->run = concat ? concat_run_new() : NULL;
+    cb->client_index = *num_conns;
+    cb->fragment = fragment_index;
+    cb->cancelled = FALSE;
+    cb->spill = NULL;
+    memset(&cb->stats, 0, sizeof(cb->stats));
+    cb->stats.client_id = *num_conns;
+    cb->stats.fragment = fragments[fragment_index].manifest_index;
+    cb->stats.accept_ns = phase_start;
+    cb->trace_accept_us = trace_start;
+    stats->connections++;
+
+    if(*num_conns + 1 == *list_capacity)
     {
-        return;
+        *list_capacity *= 2;
+        *buff_info_list = realloc(*buff_info_list, sizeof(struct buff_info *) * *list_capacity);
+    }
+    (*buff_info_list)[*num_conns + 1] = cb;
+    (*num_conns)++;
+    *cbp = cb;
+
+    struct fragment_info * fragment = &fragments[fragment_index];
+    fragment->queued = FALSE;
+    if(cp != NULL)
+    {
+        cb->spill = checkpoint_spill_open(cp, fragment->manifest_index, cb->client_index);
     }
-    free_tree(root->left);
-    free_tree(root->right);
-    if(root->line)
+    //permutation results are copied out of the fragment
+    map_fragment(fragment);
+    line_reader_set_fragment(&cb->reader, fragment->data, fragment->size, cb->spill);
+    line_reader_set_run(&cb->reader, cb->run);
+    if(fragment->running == 0)
     {
-        free(root->line);
+        fragment->start_ns = phase_start;
+        fragment->copies = 0;
     }
-    free(root);
+    fragment->running++;
+    fragment->copies++;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = cb;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, cfd, &ev) == -1) {
+        log_error("Error Adding to EPOLL: %s\n", strerror(errno));
+        return FALSE;
+    }
+    return TRUE;
 }
 
-//get position of delim for messages
-int position_delim(char * str, int len, char delim)
+//cost model for --exec auto: a small job is sorted in the server
+//outright, since a round trip costs more than the sort. Otherwise the
+//server's threads count as that many more workers and get their share
+//of the bytes, smallest fragments first, while clients take the
+//largest from the front of the queue
+int run_locally(enum exec_mode exec, struct fragment_info * fragment, uint64_t job_bytes,
+                uint64_t local_bytes, int threads, int workers)
 {
-	for(int i = 0; i < len; i++)
-	{
-		if(str[i] == delim)
-		{
-			return i;
-		}
-	}
-	return -1;
+    if(exec != EXEC_AUTO)
+    {
+        return exec == EXEC_LOCAL;
+    }
+    if(job_bytes <= EXEC_LOCAL_JOB_BYTES)
+    {
+        return TRUE;
+    }
+    uint64_t share = job_bytes * threads / (threads + workers);
+    return local_bytes + fragment->size <= share;
 }
 
-//for writing to a string with a current length 
-//and an index where writing will happen (line_index)
-void get_mem_for_line(char ** line, int * line_index, int * curr_len_line, int amount)
+//hand pending fragments to the local threads while one is free and
+//the cost model picks them; returns FALSE if epoll failed
+int dispatch_local(int epfd, struct buff_info * sb, struct fragment_queue * pending,
+                   struct fragment_info * fragments, struct fd_cache * fds,
+                   struct local_exec * local, enum exec_mode exec,
+                   uint64_t job_bytes, uint64_t * local_bytes, struct buff_info *** buff_info_list,
+                   int * num_conns, int * list_capacity, struct checkpoint * cp, int concat,
+                   struct server_stats * stats)
 {
-    //case 1: line has nothing in it rn
-    if(*line == NULL)
+    if(local == NULL)
     {
-        *line_index = 0;
-        *curr_len_line = amount;
-
-        //1 additional char for end string '\0'
-        *line = malloc((*curr_len_line + 1) * sizeof(char));
-        
+        return TRUE;
     }
-    //case 2: line has something in it already
-    else
+
+    //clients sorting a fragment right now
+    int workers = 0;
+    for(int i = 1; i <= *num_conns; i++)
     {
-        *line_index = *curr_len_line;
-        *curr_len_line += amount;
+        struct buff_info * cb = (*buff_info_list)[i];
+        workers += cb->cfd != -1 && !cb->done_reading && !cb->local;
+    }
 
-        //should already have the additional char for end string '\0'
-        *line = realloc(*line, (*curr_len_line + 1) * sizeof(char));
+    while(pending->count > 0 && local_exec_busy(local) < local->num_threads)
+    {
+        //local-only runs keep the largest first order
+        int f = exec == EXEC_LOCAL ? pending->items[pending->head] : queue_back(pending);
+        struct fragment_info * fragment = &fragments[f];
+        if(fragment->done)
+        {
+            //a copy that finished while this one waited
+            fragment->queued = FALSE;
+            exec == EXEC_LOCAL ? queue_pop(pending) : queue_pop_back(pending);
+            continue;
+        }
+        if(!run_locally(exec, fragment, job_bytes, *local_bytes, local->num_threads, workers))
+        {
+            break;
+        }
+        if(!open_fragment(fragment, fds) || (!map_fragment(fragment) && fragment->size > 0))
+        {
+            //left for a client
+            break;
+        }
 
+        int sv[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+        {
+            log_warn("Could not start a local sort: %s\n", strerror(errno));
+            break;
+        }
+        exec == EXEC_LOCAL ? queue_pop(pending) : queue_pop_back(pending);
+
+        uint64_t phase_start = stats_now();
+        struct buff_info * cb;
+        int added = start_run(epfd, sv[0], f, buff_info_list, num_conns, list_capacity,
+                              fragments, cp, concat, stats, phase_start, trace_now_us(), &cb);
+        cb->local = TRUE;
+        cb->stats.local = TRUE;
+        fragment->shared_locally = TRUE;
+        stats->local_runs++;
+        if(!added)
+        {
+            close(sv[1]);
+            return FALSE;
+        }
+        //if it cannot be queued the closed socket fails the run
+        if(!local_exec_submit(local, sv[1], fragment))
+        {
+            close(sv[1]);
+        }
+        *local_bytes += fragment->size;
+        log_info("Sorting fragment %d in the server\n", fragment->manifest_index);
+        stats_client_latency(stats, &cb->stats, LATENCY_DISPATCH, stats_now());
     }
-}
 
-//close up to n fragments
-void close_fragments(int n, int * fragment_files)
-{
-    for(int i = 0; i < n; i++)
+    if(pending->count == 0)
     {
-        close(fragment_files[i]);
+        set_accepting(epfd, sb, 0);
     }
-    free(fragment_files);
+    return TRUE;
 }
 
 //free up to n buff_info structs
@@ -313,21 +664,34 @@ void close_fragments(int n, int * fragment_files)
 int cleanup_buffinfo(int n, struct buff_info ** buff_info_list)
 {
     int failed_to_close_a_socket = 0;
+    //the Unix listener is not in the list
+    struct buff_info * listener = buff_info_list[0]->next_listener;
+    while(listener != NULL)
+    {
+        struct buff_info * next = listener->next_listener;
+        if(close(listener->cfd) == -1)
+        {
+            failed_to_close_a_socket = 1;
+        }
+        prof_free(ALLOC_SITE_CONN, listener);
+        listener = next;
+    }
     //skip the listening socket info object
     for(int i = 0; i < n; i++)
     {
-        if(close(buff_info_list[i]->cfd) == -1)
+        //connections dropped for requeueing are already closed
+        if(buff_info_list[i]->cfd != -1 && close(buff_info_list[i]->cfd) == -1)
         {
             failed_to_close_a_socket = 1;
         }
         
         //check if line has not been put into tree yet
-        if(buff_info_list[i]->line)
-        {
-            free(buff_info_list[i]->line);
-        }
+        line_reader_free(&buff_info_list[i]->reader);
+        free(buff_info_list[i]->inflight.chunks);
+        free(buff_info_list[i]->chunk);
+        concat_run_free(buff_info_list[i]->run);
 
-        free(buff_info_list[i]);
+        prof_free(ALLOC_SITE_CONN, buff_info_list[i]);
     }
     free(buff_info_list);
 
@@ -342,16 +706,27 @@ int cleanup_buffinfo(int n, struct buff_info ** buff_info_list)
 //returns whether the sockets were all closed correctly
 //if something else didn't go wrong first we want to 
 //know if all the sockets closed properly
-int clean_all(struct buff_info ** buff_info_list, int n, int num_fragments, 
-               int * fragment_files, struct btree * root, int file_original,
-               struct epoll_event * evlist)
+int clean_all(struct local_exec * local, struct ingest_pool * pool, struct buff_info ** buff_info_list,
+               int n, int num_fragments, struct fragment_info * fragments, struct fd_cache * fds,
+               struct line_index * index, int file_original, struct epoll_event * evlist)
 {
     
     close(file_original);
     free(evlist);
-    close_fragments(num_fragments, fragment_files);
-    free_tree(root);
+    //closing the sockets first unblocks local threads still writing,
+    //and they are done with the fragments before those are unmapped
     int ret_val = cleanup_buffinfo(n, buff_info_list);
+    if(local != NULL)
+    {
+        local_exec_stop(local);
+    }
+    close_fragments(num_fragments, fragments);
+    fd_cache_free(fds);
+    if(pool != NULL)
+    {
+        ingest_pool_stop(pool);
+    }
+    line_index_free(index);
     
     return ret_val;
 }
@@ -359,7 +734,12 @@ int clean_all(struct buff_info ** buff_info_list, int n, int num_fragments,
 int usage(char * message)
 {
 
-    printf("Expected ./server <filename> <port>\n%s\n", message);
+    printf("Expected ./server [--stats <json file>] [--trace <trace file>] [--no-speculate]\n"
+           "                [--checkpoint <dir>] [--buffer-mb <n>] [--conn-buffer-kb <n>]\n"
+           "                [--exec local|remote|auto] [--local-threads <n>]\n"
+           "                [--unix <socket path> [--shm]] [--ingest-threads <n>] [--concat]\n"
+           "                [--record <file>] <filename> <port>\n"
+           "      or ./server --daemon <control socket> [--policy fair|priority] [--cache-mb <n>] <port>\n%s\n", message);
     return INCORRECT_CMD_ARGS;
 }
 
@@ -421,7 +801,7 @@ void print_socket_details(int sockfd) {
 
     // Retrieve the local socket address.
     if (getpeername(sockfd, (struct sockaddr *)&addr, &addr_len) != 0) {
-        printf("Error getting peer sock info: %s\n", strerror(errno));
+        log_warn("Error getting peer sock info: %s\n", strerror(errno));
         return;
     }
 
@@ -438,7 +818,7 @@ void print_socket_details(int sockfd) {
                           service, sizeof(service),
                           flags);
     if (res != 0) {
-        printf("getnameinfo: %s\n", gai_strerror(res));
+        log_warn("getnameinfo: %s\n", gai_strerror(res));
         return;
     }
 
@@ -457,184 +837,620 @@ void print_socket_details(int sockfd) {
     int port = atoi(service);
 
     // Print the details.
-    printf("IP Address: %s\n", ipstr);
-    printf("Port: %d\n", port);
+    log_info("IP Address: %s\n", ipstr);
+    log_info("Port: %d\n", port);
 
 }
 
-int main(int argc, char * argv[])
+//TCP socket the clients connect to, listening on every address
+//returns -1 if it could not be set up
+int open_listener(int port)
 {
-    int num_args = argc - 1;
+    int sfd = socket(AF_INET, SOCK_STREAM, 0);
 
-    if(num_args != EXPECTED_ARGS)
+    //check if valid socket file descriptor
+    if(sfd == -1)
     {
-        return usage("you used incorrect num args");
+        printf("Error Creating Socket: %s\n", strerror(errno));
+        return -1;
     }
 
-    int port;
-    if(!string_to_int(&port, argv[PORT_ARG]))
+    struct sockaddr_in addr;
+    //clear struct
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    //AF_INET domain address
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+
+    if(bind(sfd, (struct sockaddr *) &addr, sizeof(struct sockaddr_in)) == -1)
     {
-        return usage("the port you specified was not an int");
+        printf("Error Binding Socket: %s\n", strerror(errno));
+        close(sfd);
+        return -1;
     }
-    printf("PORT: %d\n", port);
 
-    FILE * file_cmd_input = fopen(argv[FILE_ARG], "r");
-    if(file_cmd_input == NULL)
+    if(listen(sfd, LISTENING_BACKLOG) == -1)
     {
-        printf("the file you specified does not exist");
-        return CMD_LINE_FILE_DNE;
+        printf("Error Setting up Socket to Listen: %s\n", strerror(errno));
+        close(sfd);
+        return -1;
     }
+    return sfd;
+}
 
-    //go through lines of file given file
-    char *line = NULL;
-    size_t size = 0;
-    ssize_t nread;
+//Unix stream socket for clients on the same host, next to the TCP one
+//returns -1 if it could not be set up
+int open_unix_listener(char * path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        printf("Unix socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
 
-    if((nread = getline(&line, &size, file_cmd_input)) == -1)
+    int ufd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(ufd == -1)
     {
-        printf("Could not create the output file %s\n", line);
-        fclose(file_cmd_input);
-        free(line);
-        return NO_ORIGINAL_FILE;
+        printf("Error Creating Socket: %s\n", strerror(errno));
+        return -1;
     }
 
-    //turn end of line char '\n' into '\0'
-    line[nread - 1] = '\0';
+    //a socket file left by an earlier run would make bind fail
+    unlink(path);
+    if(bind(ufd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+       listen(ufd, LISTENING_BACKLOG) == -1)
+    {
+        printf("Error Setting up Unix Socket %s: %s\n", path, strerror(errno));
+        close(ufd);
+        return -1;
+    }
+    return ufd;
+}
 
-    int file_original = open(line, O_WRONLY | O_CREAT | O_TRUNC, RW_ACCCESS);
-    if(file_original == -1)
+int main(int argc, char * argv[])
+{
+    char * stats_path = NULL;
+    char * trace_path = NULL;
+    int speculation = TRUE;
+    char * checkpoint_dir = NULL;
+    char * control_path = NULL;
+    enum daemon_policy policy = POLICY_FAIR;
+    int cache_mb = DEFAULT_CACHE_MB;
+    int buffer_mb = 0;
+    int conn_buffer_kb = 0;
+    enum exec_mode exec = EXEC_REMOTE;
+    int local_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    char * unix_path = NULL;
+    int shm = FALSE;
+    int ingest_threads = 1;
+    int concat = FALSE;
+    char * record_path = NULL;
+
+    static struct option long_options[] = {
+        {"stats", required_argument, NULL, 's'},
+        {"trace", required_argument, NULL, 't'},
+        {"no-speculate", no_argument, NULL, 'n'},
+        {"checkpoint", required_argument, NULL, 'c'},
+        {"daemon", required_argument, NULL, 'd'},
+        {"policy", required_argument, NULL, 'p'},
+        {"cache-mb", required_argument, NULL, 'm'},
+        {"buffer-mb", required_argument, NULL, 'b'},
+        {"conn-buffer-kb", required_argument, NULL, 'k'},
+        {"exec", required_argument, NULL, 'e'},
+        {"local-threads", required_argument, NULL, 'l'},
+        {"unix", required_argument, NULL, 'u'},
+        {"shm", no_argument, NULL, 'S'},
+        {"ingest-threads", required_argument, NULL, 'i'},
+        {"concat", no_argument, NULL, 'C'},
+        {"record", required_argument, NULL, 'r'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while((opt = getopt_long(argc, argv, "s:t:nc:d:p:m:b:k:e:l:u:Si:Cr:", long_options, NULL)) != -1)
     {
-        printf("OG File did not open\n");
-        free(line);
-        fclose(file_cmd_input);
-        return NO_ORIGINAL_FILE;
+        switch(opt)
+        {
+            case 's':
+                stats_path = optarg;
+                break;
+            case 't':
+                trace_path = optarg;
+                break;
+            case 'n':
+                speculation = FALSE;
+                break;
+            case 'c':
+                checkpoint_dir = optarg;
+                break;
+            case 'd':
+                control_path = optarg;
+                break;
+            case 'p':
+                if(strcmp(optarg, "fair") == 0)
+                {
+                    policy = POLICY_FAIR;
+                }
+                else if(strcmp(optarg, "priority") == 0)
+                {
+                    policy = POLICY_PRIORITY;
+                }
+                else
+                {
+                    return usage("--policy is fair or priority");
+                }
+                break;
+            case 'm':
+                if(!string_to_int(&cache_mb, optarg) || cache_mb < 0)
+                {
+                    return usage("--cache-mb is a number of megabytes, 0 to turn the cache off");
+                }
+                break;
+            case 'b':
+                if(!string_to_int(&buffer_mb, optarg) || buffer_mb < 0)
+                {
+                    return usage("--buffer-mb is a number of megabytes, 0 for no limit");
+                }
+                break;
+            case 'k':
+                if(!string_to_int(&conn_buffer_kb, optarg) || conn_buffer_kb < 0)
+                {
+                    return usage("--conn-buffer-kb is a number of kilobytes, 0 for no limit");
+                }
+                break;
+            case 'e':
+                if(strcmp(optarg, "remote") == 0)
+                {
+                    exec = EXEC_REMOTE;
+                }
+                else if(strcmp(optarg, "local") == 0)
+                {
+                    exec = EXEC_LOCAL;
+                }
+                else if(strcmp(optarg, "auto") == 0)
+                {
+                    exec = EXEC_AUTO;
+                }
+                else
+                {
+                    return usage("--exec is local, remote or auto");
+                }
+                break;
+            case 'l':
+                if(!string_to_int(&local_threads, optarg) || local_threads < 1)
+                {
+                    return usage("--local-threads is a positive number");
+                }
+                break;
+            case 'u':
+                unix_path = optarg;
+                break;
+            case 'S':
+                shm = TRUE;
+                break;
+            case 'i':
+                if(!string_to_int(&ingest_threads, optarg) || ingest_threads < 1)
+                {
+                    return usage("--ingest-threads is a positive number");
+                }
+                break;
+            case 'C':
+                concat = TRUE;
+                break;
+            case 'r':
+                record_path = optarg;
+                break;
+            default:
+                return usage("unknown option");
+        }
+    }
+
+    if(shm && unix_path == NULL)
+    {
+        return usage("--shm needs --unix, clients on other hosts cannot share memory");
+    }
+    //results wait whole in memory for their turn, with nothing to
+    //resume from and no lines for flow control to pace
+    if(concat && (checkpoint_dir != NULL || buffer_mb || conn_buffer_kb))
+    {
+        return usage("--concat does not go with --checkpoint, --buffer-mb or --conn-buffer-kb");
+    }
+    //replay puts the streams through the index
+    if(concat && record_path != NULL)
+    {
+        return usage("--concat does not go with --record");
     }
 
-    int * fragment_files = NULL;
-    int index = 0;
+    //positional arguments keep their original indexes
+    int num_args = argc - optind;
+    argv += optind - 1;
 
-    while ((nread = getline(&line, &size, file_cmd_input)) != -1) {
-        line[nread - 1] = '\0';
-        fragment_files = (int *) realloc(fragment_files, sizeof(int) * (index + 1));
-        fragment_files[index] = open(line, O_RDONLY);
-        
-        if(fragment_files[index] == -1)
+    //in daemon mode jobs come in on the control socket instead
+    if(control_path != NULL)
+    {
+        if(num_args != DAEMON_EXPECTED_ARGS)
         {
-            printf("Fragment[%d] did not open\nFile name given: %s\n", index, line);
+            return usage("daemon mode takes only a port");
+        }
+        if(stats_path != NULL || trace_path != NULL || checkpoint_dir != NULL || exec != EXEC_REMOTE ||
+           unix_path != NULL || ingest_threads != 1 || concat || record_path != NULL)
+        {
+            return usage("--stats, --trace, --checkpoint, --exec, --unix, --ingest-threads, --concat "
+                         "and --record only apply to a single job");
+        }
 
-            //file was not correctly given: we should close all opened files
-            free(line);
-            fclose(file_cmd_input);
-            close(file_original);
-            
-            //only close prev fragment files, so we there are just index files
-            close_fragments(index, fragment_files);
-            return BAD_FRAGMENT;
+        int port;
+        if(!string_to_int(&port, argv[DAEMON_PORT_ARG]))
+        {
+            return usage("the port you specified was not an int");
         }
-        
-        index++;
-    }
 
-    int num_fragment_files = index;
+        //drains and stops itself at exit
+        log_init();
 
-    //we are done looking through the cmd line file
-    free(line);
-    fclose(file_cmd_input);
+        int sfd = open_listener(port);
+        if(sfd == -1)
+        {
+            return SOCKET_ISSUE;
+        }
+        printf("PORT: %d\n", port);
+        return run_daemon(sfd, control_path, policy, (uint64_t) cache_mb * BYTES_PER_MB) == DAEMON_OK ?
+               SUCCESS : SOCKET_ISSUE;
+    }
 
-    line = NULL;
+    if(num_args != EXPECTED_ARGS)
+    {
+        return usage("you used incorrect num args");
+    }
 
-    print_host_network_info();
+    //drains and stops itself at exit
+    log_init();
 
-    //SOCKET TIME YO!
+    if(trace_path != NULL && !trace_open(trace_path, "server"))
+    {
+        printf("Could not open trace file %s: %s\n", trace_path, strerror(errno));
+        return usage("bad trace file");
+    }
+    trace_lane_name(0, "server");
 
-    int sfd = socket(AF_INET, SOCK_STREAM, 0);
+    //every result stream, for ./replay
+    struct recording recording;
+    struct recording * recp = NULL;
+    if(record_path != NULL)
+    {
+        if(!recording_open(&recording, record_path))
+        {
+            printf("Could not open recording %s: %s\n", record_path, strerror(errno));
+            return usage("bad recording file");
+        }
+        recp = &recording;
+    }
 
-    //check if valid socket file descriptor
-    if(sfd == -1)
+    int port;
+    if(!string_to_int(&port, argv[PORT_ARG]))
     {
-        
-        printf("Error Creating Socket: %s\n", strerror(errno));
+        return usage("the port you specified was not an int");
+    }
+    printf("PORT: %d\n", port);
 
-        //if there is a problem with socket, we still need to close the fragments
-        close_fragments(index, fragment_files);
-        close(file_original);
-        return SOCKET_ISSUE;
-    } 
+    char * output_path = NULL;
+    struct fragment_info * fragments = NULL;
+    int num_fragment_files = 0;
 
-    struct sockaddr_in addr;
-    //clear struct
-    memset(&addr, 0, sizeof(struct sockaddr_in));
-    //AF_INET domain address
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    addr.sin_addr.s_addr = INADDR_ANY;
+    switch(read_manifest(argv[FILE_ARG], &output_path, &fragments, &num_fragment_files))
+    {
+        case MANIFEST_MISSING:
+            printf("the file you specified does not exist");
+            return CMD_LINE_FILE_DNE;
+        case MANIFEST_NO_OUTPUT:
+            printf("Could not create the output file\n");
+            return NO_ORIGINAL_FILE;
+        case MANIFEST_BAD_FRAGMENT:
+            return BAD_FRAGMENT;
+    }
 
-    if(bind(sfd, (struct sockaddr *) &addr, sizeof(struct sockaddr_in)) == -1)
+    char default_stats_path[PATH_MAX];
+    if(stats_path == NULL)
     {
-        printf("Error Binding Socket: %s\n", strerror(errno));
-        close_fragments(index, fragment_files);
-        close(file_original);
-        close(sfd);
-        return SOCKET_ISSUE;
+        snprintf(default_stats_path, PATH_MAX, "%s%s", output_path, STATS_SUFFIX);
+        stats_path = default_stats_path;
+    }
+
+    int file_original = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, RW_ACCCESS);
+    free(output_path);
+    if(file_original == -1)
+    {
+        printf("OG File did not open\n");
+        close_fragments(num_fragment_files, fragments);
+        return NO_ORIGINAL_FILE;
     }
 
+    print_host_network_info();
 
-    if(listen(sfd, LISTENING_BACKLOG) == -1)
+    //SOCKET TIME YO!
+    int sfd = open_listener(port);
+    if(sfd == -1)
     {
-        printf("Error Setting up Socket to Listen: %s\n", strerror(errno));
-        close_fragments(index, fragment_files);
+        //if there is a problem with socket, we still need to close the fragments
+        close_fragments(num_fragment_files, fragments);
         close(file_original);
-        close(sfd);
         return SOCKET_ISSUE;
     }
 
     //Going to use epoll to wait for clients
     int epfd = epoll_create1(0);
 
-	struct epoll_event * evlist = (struct epoll_event *) malloc(sizeof(struct epoll_event) * (num_fragment_files + 1));
+	struct epoll_event * evlist = (struct epoll_event *) malloc(sizeof(struct epoll_event) * MAX_EVENTS);
 
 	//add event listener for stdin
 	struct epoll_event ev_server;
 	ev_server.events = EPOLLIN;
 
-    ev_server.data.ptr = malloc(sizeof(struct buff_info));
-
-    struct epoll_event ev;
+    ev_server.data.ptr = prof_malloc(ALLOC_SITE_CONN, sizeof(struct buff_info));
 
     struct buff_info * sb = (struct buff_info *) ev_server.data.ptr;
     sb->cfd = sfd;
     sb->client_index = -1;
-    sb->line = NULL;
-    sb->curr_len_line = 0;
+    sb->next_listener = NULL;
+    sb->chunk = NULL;
+    sb->run = NULL;
+    line_reader_init(&sb->reader);
+    memset(&sb->inflight, 0, sizeof(sb->inflight));
 
 	if (epoll_ctl(epfd, EPOLL_CTL_ADD, sfd, &ev_server) == -1)
 	{
 		printf("Error Setting up epoll STDIN: %s\n", strerror(errno));
-        close_fragments(index, fragment_files);
+        close_fragments(num_fragment_files, fragments);
         close(file_original);
         close(sfd);
-        free(ev_server.data.ptr);
+        prof_free(ALLOC_SITE_CONN, ev_server.data.ptr);
 		return ERROR_EPOLL_SETUP;
 	}
 
-    int file_index = 0;
+    //clients on this host can connect over a Unix socket as well
+    if(unix_path != NULL)
+    {
+        int ufd = open_unix_listener(unix_path);
+        struct buff_info * ub = prof_malloc(ALLOC_SITE_CONN, sizeof(struct buff_info));
+        ub->cfd = ufd;
+        ub->client_index = -1;
+        ub->next_listener = NULL;
+        ub->chunk = NULL;
+        ub->run = NULL;
+        line_reader_init(&ub->reader);
+        memset(&ub->inflight, 0, sizeof(ub->inflight));
+
+        struct epoll_event ev_unix;
+        ev_unix.events = EPOLLIN;
+        ev_unix.data.ptr = ub;
+        if(ufd == -1 || epoll_ctl(epfd, EPOLL_CTL_ADD, ufd, &ev_unix) == -1)
+        {
+            printf("Error Setting up the Unix socket: %s\n", strerror(errno));
+            close_fragments(num_fragment_files, fragments);
+            close(file_original);
+            close(sfd);
+            if(ufd != -1)
+            {
+                close(ufd);
+                unlink(unix_path);
+            }
+            prof_free(ALLOC_SITE_CONN, sb);
+            prof_free(ALLOC_SITE_CONN, ub);
+            free(evlist);
+            return SOCKET_ISSUE;
+        }
+        sb->next_listener = ub;
+        printf("UNIX: %s\n", unix_path);
+    }
+
+    //fragment files are opened as they come up for dispatch
+    struct fd_cache fds;
+    fd_cache_init(&fds, FD_CACHE_SIZE);
+
+    //connections accepted so far; buff_info_list holds this many plus the listening socket
+    int num_conns = 0;
+    int list_capacity = INITIAL_CONN_SLOTS;
     //int cont = 1;
     int cfd;
     int ret_val;
-    int num_clients_done = 0;
+    int num_fragments_done = 0;
+
+    //lines before next_line are in the output file already
+    int next_line = 0;
+    //--concat: manifest index of the fragment the output waits for,
+    //and the line it has to start with
+    int next_run = 0;
+    int next_run_line = 0;
+    //bytes of line text in the index
+    uint64_t buffered = 0;
+    uint64_t freed = 0;
+    struct flow_limits limits;
+    limits.total_bytes = (uint64_t) buffer_mb * BYTES_PER_MB;
+    limits.conn_bytes = (uint64_t) conn_buffer_kb * BYTES_PER_KB;
+    limits.num_paused = 0;
+    int flow_control = limits.total_bytes || limits.conn_bytes;
+
+    //the server's own sort threads, when it takes part in the sorting
+    struct local_exec local_engine;
+    struct local_exec * local = NULL;
+    uint64_t job_bytes = 0;
+    uint64_t local_bytes = 0;
+    for(int f = 0; f < num_fragment_files; f++)
+    {
+        job_bytes += fragments[f].size;
+    }
 
-    struct btree *root = NULL;
+    //the received lines; with more than one ingest thread the event
+    //loop is one of them and the pool has the rest. --concat keeps
+    //results in runs, so the index stays empty
+    struct line_index index;
+    line_index_init(&index, ingest_threads > 1 && !concat ? LINE_INDEX_SHARDS : 1, next_line);
+    struct ingest_pool pool_engine;
+    struct ingest_pool * pool = NULL;
+    if(ingest_threads > 1)
+    {
+        if(ingest_pool_start(&pool_engine, ingest_threads - 1, &index))
+        {
+            pool = &pool_engine;
+        }
+        else
+        {
+            printf("Could not start the ingest threads, ingesting on the event loop\n");
+        }
+    }
+    //a chunk has to be worth handing to another thread
+    int read_size = pool != NULL ? INGEST_CHUNK_BYTES : BUFFER_RW_SIZE;
+    //one chunk per ready connection per pass
+    struct ingest_task * tasks = calloc(MAX_EVENTS, sizeof(struct ingest_task));
+
+    struct server_stats stats;
+    stats_init(&stats);
+
+    //no SA_RESTART: the signal should wake epoll_wait so the dump is prompt
+    struct sigaction sa_usr1;
+    memset(&sa_usr1, 0, sizeof(sa_usr1));
+    sa_usr1.sa_handler = request_stats_dump;
+    sigaction(SIGUSR1, &sa_usr1, NULL);
+
+    //a client that dies mid-send should give us EPIPE, not kill the job
+    signal(SIGPIPE, SIG_IGN);
 
     //keep track of buff_info structs to clean them up if anything goes wrong
-    struct buff_info ** buff_info_list = malloc(sizeof(struct buff_info *) * (num_fragment_files + 1));
+    //it grows past the fragment count when fragments are requeued
+    struct buff_info ** buff_info_list = malloc(sizeof(struct buff_info *) * list_capacity);
     buff_info_list[0] = sb;
 
-    ssize_t bytesWritten;
+    //pick up the results a previous run already saved
+    struct checkpoint cp;
+    struct checkpoint * cpp = NULL;
+    if(checkpoint_dir != NULL)
+    {
+        if(!checkpoint_open(&cp, checkpoint_dir, num_fragment_files))
+        {
+            free(tasks);
+            clean_all(local, pool, buff_info_list, 1, num_fragment_files, fragments, &fds, &index, file_original, evlist);
+            return BAD_CHECKPOINT;
+        }
+        cpp = &cp;
+
+        for(int e = 0; e < cp.num_entries; e++)
+        {
+            struct checkpoint_entry * entry = &cp.entries[e];
+            int f = 0;
+            while(f < num_fragment_files && fragments[f].manifest_index != entry->manifest_index)
+            {
+                f++;
+            }
+            if(fragments[f].done || fragments[f].size != entry->fragment_bytes ||
+               !checkpoint_load(&cp, entry, &index, &stats.lines))
+            {
+                continue;
+            }
+            fragments[f].done = TRUE;
+            stats.resumed++;
+            num_fragments_done++;
+        }
+        if(stats.resumed > 0)
+        {
+            printf("Resumed %llu fragments from %s\n", (unsigned long long) stats.resumed, checkpoint_dir);
+        }
+
+        //resumed lines from the start of the file can go out right away
+        buffered = line_index_bytes(&index);
+        stats.peak_buffered = buffered;
+        if(!write_ready_output(&index, file_original, &next_line,
+                               &stats.lines_written, &stats.bytes_written, &freed))
+        {
+            printf("Error Writing Output File: %s\n", strerror(errno));
+            checkpoint_close(cpp);
+            free(tasks);
+            clean_all(local, pool, buff_info_list, 1, num_fragment_files, fragments, &fds, &index, file_original, evlist);
+            return FAILED_TO_WRITE_OUTPUT_FILE;
+        }
+        buffered -= freed;
+    }
+
+    //every fragment not done yet starts out pending, largest first
+    struct fragment_queue pending;
+    queue_init(&pending, num_fragment_files);
+    for(int f = 0; f < num_fragment_files; f++)
+    {
+        if(!fragments[f].done)
+        {
+            queue_fragment(&pending, fragments, f);
+        }
+    }
+    if(pending.count == 0)
+    {
+        set_accepting(epfd, sb, 0);
+    }
+    prefetch_pending(&pending, fragments, &fds);
+
+    //ns per byte of each finished fragment, for the straggler threshold
+    double * done_rates = malloc(sizeof(double) * (num_fragment_files + 1));
+    int num_done_rates = 0;
+    uint64_t last_spec_check = 0;
+
+    if(exec != EXEC_REMOTE)
+    {
+        if(local_threads < 1)
+        {
+            local_threads = 1;
+        }
+        if(local_exec_start(&local_engine, local_threads))
+        {
+            local = &local_engine;
+        }
+        else if(exec == EXEC_LOCAL)
+        {
+            printf("Could not start the local sort threads, waiting for clients instead\n");
+        }
+    }
+
     ssize_t bytesRead;
 
-    while(num_clients_done < num_fragment_files)
+    while(num_fragments_done < num_fragment_files)
 	{
-        int num_events = epoll_wait(epfd, evlist, num_fragment_files + 1, -1);
+        int num_tasks = 0;
+
+        if(!dispatch_local(epfd, sb, &pending, fragments, &fds, local, exec, job_bytes, &local_bytes,
+                           &buff_info_list, &num_conns, &list_capacity, cpp, concat, &stats))
+        {
+            free(pending.items);
+            free(done_rates);
+            free(tasks);
+            clean_all(local, pool, buff_info_list, num_conns + 1, num_fragment_files, fragments, &fds, &index, file_original, evlist);
+            return EPOLL_ISSUE;
+        }
+
+        //near the end, wake up now and then to look for stragglers
+        int timeout = -1;
+        if(speculation && num_done_rates * 100 >= num_fragment_files * SPEC_MIN_DONE_PCT)
+        {
+            timeout = SPEC_CHECK_MS;
+        }
+        int num_events = epoll_wait(epfd, evlist, MAX_EVENTS, timeout);
+
+        if(speculation && stats_now() - last_spec_check >= SPEC_CHECK_MS * 1000000ULL)
+        {
+            last_spec_check = stats_now();
+            int was_empty = pending.count == 0;
+            if(speculate(&pending, fragments, num_fragment_files, done_rates, num_done_rates, &stats) && was_empty)
+            {
+                set_accepting(epfd, sb, 1);
+            }
+        }
+
+        if(dump_stats_requested)
+        {
+            dump_stats_requested = 0;
+            write_stats(stderr, &stats, buff_info_list, num_conns);
+        }
 
         for(int i = 0; i < num_events; i++)
         {
@@ -644,120 +1460,151 @@ int main(int argc, char * argv[])
             int fd = cb->cfd;
 			uint32_t events = evlist[i].events;
 
+            //dropped earlier in this batch
+            if(fd == -1)
+            {
+                continue;
+            }
+
+            int listener = cb->client_index == -1;
+
             //New Connection!
-            if ((fd == sfd) && (events & EPOLLIN) && file_index < num_fragment_files) {
-				struct sockaddr_in c_addr;
-                socklen_t clen = sizeof(struct sockaddr_in);
-                cfd = accept(sfd, (struct sockaddr *) &c_addr, &clen );
+            if(listener)
+            {
+                prune_queue(&pending, fragments);
+                if(pending.count == 0)
+                {
+                    set_accepting(epfd, sb, 0);
+                }
+            }
+            if (listener && (events & EPOLLIN) && pending.count > 0) {
+				struct sockaddr_storage c_addr;
+                socklen_t clen = sizeof(c_addr);
+                uint64_t phase_start = stats_now();
+                uint64_t trace_start = trace_now_us();
+                cfd = accept(fd, (struct sockaddr *) &c_addr, &clen );
 
                 if(cfd == -1)
                 {
                     //if there is a connection error we will wait for more connections
-                    printf("Error Accepting Connection: %s\n", strerror(errno));
+                    log_error("Error Accepting Connection: %s\n", strerror(errno));
                     continue;
                 }
-                printf("Made new connection\n");
-
-                print_socket_details(cfd);
+                log_info("Made new connection\n");
 
-                ev.events = EPOLLIN | EPOLLRDHUP;
-                ev.data.ptr = malloc(sizeof(struct buff_info));
-
-                struct buff_info * cb = (struct buff_info *) ev.data.ptr;
-                cb->line_index = 0;
-                cb->curr_len_line = 0;
-                cb->done_reading = 0;
-                cb->file_closed = 0;
-                cb->cfd = cfd;
-                cb->line = NULL;
-                cb->client_index = file_index;
-
-                buff_info_list[file_index + 1] = cb;
+                //a Unix socket peer has no address to show
+                int same_host = cb != sb;
+                if(!same_host)
+                {
+                    print_socket_details(cfd);
+                }
 
-                int total_clients = file_index + 1;
+                //opened now if the prefetch did not get to it
+                int next_fragment = queue_pop(&pending);
+                if(!open_fragment(&fragments[next_fragment], &fds))
+                {
+                    close(cfd);
+                    free(pending.items);
+                    free(done_rates);
+                    free(tasks);
+                    clean_all(local, pool, buff_info_list, num_conns + 1, num_fragment_files, fragments, &fds, &index, file_original, evlist);
+                    return BAD_FRAGMENT;
+                }
+                prefetch_pending(&pending, fragments, &fds);
 
-                if (epoll_ctl(epfd, EPOLL_CTL_ADD, cfd, &ev) == -1) {
-                    printf("Error Adding to EPOLL: %s\n", strerror(errno));
-                    clean_all(buff_info_list, total_clients + 1, num_fragment_files, fragment_files, root, file_original, evlist);
+                struct buff_info * cb;
+                int added = start_run(epfd, cfd, next_fragment, &buff_info_list, &num_conns,
+                                      &list_capacity, fragments, cpp, concat, &stats, phase_start, trace_start, &cb);
+                if(pending.count == 0)
+                {
+                    set_accepting(epfd, sb, 0);
+                }
+                if(!added)
+                {
+                    free(pending.items);
+                    free(done_rates);
+                    free(tasks);
+                    clean_all(local, pool, buff_info_list, num_conns + 1, num_fragment_files, fragments, &fds, &index, file_original, evlist);
                     return EPOLL_ISSUE;
                 }
-                ev.data.ptr = NULL;
+                struct fragment_info * fragment = &fragments[cb->fragment];
+                phase_start = stats_phase_end(&stats, PHASE_ACCEPT, phase_start);
 
-                //send data from current file to client
-                int file_to_send_fd = fragment_files[file_index];
-                char buffer[BUFFER_RW_SIZE];
-                memset(buffer, 0, BUFFER_RW_SIZE);
+                //each connection gets its own lane in the timeline
+                if(trace_enabled())
+                {
+                    char lane_name[32];
+                    snprintf(lane_name, sizeof(lane_name), "client %d", cb->client_index);
+                    trace_lane_name(cb->client_index + 1, lane_name);
+                }
+                trace_span("accept", "server", cb->client_index + 1, trace_start, NULL, 0);
+                trace_start = trace_now_us();
 
-                printf("Sending file fragment %d to a client\n", file_index);
-                while ((bytesRead = read(file_to_send_fd, buffer, BUFFER_RW_SIZE)) != 0) {
-                    
-                    if(bytesRead == -1)
+                //send data from current file to client
+                log_info("Sending file fragment %d to a client\n", fragment->manifest_index);
+                //with --shm a client on this host gets the fragment through
+                //shared memory; if the ring cannot be set up the socket is used
+                struct shm_ring ring;
+                struct shm_ring * ringp = NULL;
+                if(shm && same_host)
+                {
+                    uint64_t capacity = fragment->size + strlen("EOF\n");
+                    if(capacity > SHM_RING_MAX_BYTES)
                     {
-                        if(errno == EINTR)
-                        {
-                            continue;
-                        }
-                        printf("Error Reading from a fragment file: %s\n", strerror(errno));
-                        clean_all(buff_info_list, total_clients + 1, num_fragment_files, fragment_files, root, file_original, evlist);
-                        return ERROR_READING_FILE;
+                        capacity = SHM_RING_MAX_BYTES;
                     }
-
-                    ssize_t bytesWrittenTotal = 0;
-                    while(bytesWrittenTotal != bytesRead)
+                    if(shm_ring_offer(&ring, cfd, capacity))
                     {
-                        bytesWritten = write(cfd, buffer + bytesWrittenTotal, bytesRead - bytesWrittenTotal);
-                        if(bytesWritten == -1)
-                        {
-                            if(errno == EINTR)
-                            {
-                                continue;
-                            }
-                            printf("Error Writing to Client: %s\n", strerror(errno));
-                            clean_all(buff_info_list, total_clients + 1, num_fragment_files, fragment_files, root, file_original, evlist);
-                            return SOCKET_ISSUE;
-                        }
-                        
-                        bytesWrittenTotal += bytesWritten;
-                        
+                        ringp = &ring;
                     }
-
-                    memset(buffer, 0, bytesRead);
                 }
-
-                char * end_message = "EOF\n";
-                ssize_t bytesWrittenTotal = 0;
-
-                while(bytesWrittenTotal != strlen(end_message))
+                ret_val = send_fragment(cfd, ringp, fragment);
+                if(ret_val == SEND_OK && !send_end_message(cfd, ringp))
                 {
-                    bytesWritten = write(cfd, end_message + bytesWrittenTotal, strlen(end_message) - bytesWrittenTotal);
-                    if(bytesWritten == -1)
-                    {
-                        if(errno == EINTR)
-                        {
-                            continue;
-                        }
-                        printf("Error Writing to Client: %s\n", strerror(errno));
-                        clean_all(buff_info_list, total_clients + 1, num_fragment_files, fragment_files, root, file_original, evlist);
-                        return SOCKET_ISSUE;
-                    }
-
-                    bytesWrittenTotal += bytesWritten;
+                    ret_val = SEND_WRITE_FAILED;
                 }
-                
-                //increment file index to prepare sending next file
-                file_index++;
-                
+                //the client keeps its own mapping of what is left to read
+                if(ringp != NULL)
+                {
+                    shm_ring_close(ringp);
+                }
+                if(ret_val == SEND_WRITE_FAILED)
+                {
+                    //the client went away, someone else can have it
+                    requeue_fragment(epfd, sb, cb, &pending, fragments, &stats, cpp);
+                    continue;
+                }
+                if(ret_val != SEND_OK)
+                {
+                    free(pending.items);
+                    free(done_rates);
+                    free(tasks);
+                    clean_all(local, pool, buff_info_list, num_conns + 1, num_fragment_files, fragments, &fds, &index, file_original, evlist);
+                    return ERROR_READING_FILE;
+                }
+
+                cb->stats.bytes_out = fragment->size + strlen("EOF\n");
+                stats.bytes_out += cb->stats.bytes_out;
+                phase_start = stats_phase_end(&stats, PHASE_SEND, phase_start);
+                stats_client_latency(&stats, &cb->stats, LATENCY_DISPATCH, phase_start);
+                trace_span("send fragment", "server", cb->client_index + 1, trace_start,
+                           "fragment", fragment->manifest_index);
+
 			}
 
             //Receiving Info from client!
-            if((fd != sfd) && (events & EPOLLIN))
+            //the chunk is ingested below, with the rest of the batch
+            if(!listener && (events & EPOLLIN))
             {
-                int index;
-                int last_index = 0;
-
-                char buf[BUFFER_RW_SIZE];
-                memset(buf, 0, BUFFER_RW_SIZE);
-                while((bytesRead = read(fd, buf, BUFFER_RW_SIZE)) == -1)
+                struct ingest_task * task = &tasks[num_tasks];
+                if(cb->chunk == NULL)
+                {
+                    cb->chunk = malloc(read_size);
+                }
+                task->buf = cb->chunk;
+                uint64_t phase_start = stats_now();
+                uint64_t trace_start = trace_now_us();
+                while((bytesRead = read(fd, task->buf, read_size)) == -1)
                 {
                     if(bytesRead == -1)
                     {
@@ -765,181 +1612,269 @@ int main(int argc, char * argv[])
                         {
                             continue;
                         }
-                        printf("Error Reading from Client: %s\n", strerror(errno));
-                        clean_all(buff_info_list, file_index + 1, num_fragment_files, fragment_files, root, file_original, evlist);
-                        return SOCKET_ISSUE;
+                        log_warn("Error Reading from Client: %s\n", strerror(errno));
+                        break;
                     }          
                 }
 
                 //if the file is closed prematurely ie we get 0 before "EOF\n"
-                //then there is an error with the connection between a client
-                if(bytesRead == 0 && !cb->done_reading)
+                //or the connection failed, the fragment goes to another client
+                if(!cb->done_reading && (bytesRead == -1 || bytesRead == 0))
                 {
-                    printf("Socket Closed Prematurely: %s\n", strerror(errno));
-                    clean_all(buff_info_list, file_index + 1, num_fragment_files, fragment_files, root, file_original, evlist);
-                    return SOCKET_ISSUE;
+                    requeue_fragment(epfd, sb, cb, &pending, fragments, &stats, cpp);
+                    continue;
+                }
+                //after "EOF\n" an error is only a hang up; the socket is
+                //closed and the fragment counted below
+                if(bytesRead == -1)
+                {
+                    cb->file_closed = 1;
+                    continue;
                 }
 
-                int skip = 0;
-
-
-                //each time we find the next delim, we start where we left off by adding last_index
-                while ((index = position_delim(buf + last_index, bytesRead - last_index, DELIMITER)) != -1) {
-
+                phase_start = stats_phase_end(&stats, PHASE_RECV, phase_start);
+                cb->stats.bytes_in += bytesRead;
+                if(bytesRead > 0)
+                {
+                    stats_client_latency(&stats, &cb->stats, LATENCY_FIRST_RESULT, phase_start);
+                }
+                stats.bytes_in += bytesRead;
 
-                    //index does not start from beggining every time
-                    //so the indexes need to be accumulated
-                    index += last_index;
+                trace_span("recv chunk", "server", cb->client_index + 1, trace_start, "bytes", bytesRead);
 
-                    get_mem_for_line(&cb->line, &cb->line_index, &cb->curr_len_line, index - last_index + 1);
+                if(!cb->done_reading)
+                {
+                    if(recp != NULL)
+                    {
+                        if(cb->stats.bytes_in == (uint64_t) bytesRead)
+                        {
+                            recording_start(recp, cb->client_index, cb->stats.fragment);
+                        }
+                        recording_chunk(recp, cb->client_index, task->buf, bytesRead);
+                    }
+                    task->owner = cb;
+                    task->reader = &cb->reader;
+                    task->len = bytesRead;
+                    num_tasks++;
+                }
+            }
 
-                    cb->line[cb->curr_len_line] = '\0';
+            //Client Disconnecting!
+            if(!listener && (events & EPOLLRDHUP))
+            {
+                log_info("Client disconnected!\n");
+				
+				cb->file_closed = 1;
+                
+            }
 
-                    // Copy the message fragment that ends at the delimiter.
-                    memcpy(cb->line + cb->line_index, buf + last_index, index - last_index + 1);
+        }
 
-                    
-                    if(strcmp(cb->line, "EOF\n") == 0)
-                    {
-                        cb->done_reading = 1;
-                        
-                        free(cb->line);
-                        cb->line = NULL;
-                        last_index = index + 1;
+        //parse and insert the chunks of this pass, on the pool's
+        //threads when there is one
+        if(num_tasks > 0)
+        {
+            uint64_t trace_start = trace_now_us();
+            if(pool != NULL)
+            {
+                ingest_pool_run(pool, tasks, num_tasks);
+            }
+            for(int t = 0; t < num_tasks && pool == NULL; t++)
+            {
+                ingest_task_run(&tasks[t], &index);
+            }
+            trace_span("ingest batch", "server", 0, trace_start, "chunks", num_tasks);
+        }
 
-                        skip = 1;
-                        break;
-                    }
+        //then take stock of each chunk in order, as if it had been
+        //ingested right after it was read
+        for(int t = 0; t < num_tasks; t++)
+        {
+            struct ingest_task * task = &tasks[t];
+            struct buff_info * cb = task->owner;
+            struct ingest_counts counts = task->counts;
+
+            //a copy cancelled by a chunk before this one in the batch:
+            //its lines are in the index all the same
+            int live = cb->cfd != -1;
+            if(live && task->finished)
+            {
+                cb->done_reading = 1;
+                stats_client_latency(&stats, &cb->stats, LATENCY_TURNAROUND, stats_now());
+
+                struct fragment_info * fragment = &fragments[cb->fragment];
+                fragment->running--;
+                fragment->done = TRUE;
+                done_rates[num_done_rates++] = (double) (stats_now() - cb->stats.accept_ns) /
+                                               (fragment->size ? fragment->size : 1);
+                cancel_copies(epfd, cb, buff_info_list, num_conns, fragments, &stats, cpp);
+                release_fragment(fragment);
+
+                if(cb->spill != NULL)
+                {
+                    checkpoint_commit(cpp, cb->spill, fragment->manifest_index, cb->client_index, fragment->size);
+                    cb->spill = NULL;
+                }
+                trace_span("connection", "server", cb->client_index + 1, cb->trace_accept_us,
+                           "lines", cb->stats.lines + counts.lines);
 
-                    int line_num;
-                    if(sscanf(cb->line, "%d", &line_num) == 1)
-                    {
-                        //add the line to the tree data structure
-                        root = add(root, line_num, cb->line, cb->curr_len_line);
-                        cb->line = NULL;
-                        
-                    }
-                    else
+                //--concat: the result is the fragment's range, appended
+                //once every fragment before it in the manifest is out
+                if(cb->run != NULL)
+                {
+                    fragment->run = cb->run;
+                    cb->run = NULL;
+                    uint64_t output_start = stats_now();
+                    int written = write_concat_output(fragments, num_fragment_files, file_original, &next_run,
+                                                      &next_run_line, &stats.lines_written, &stats.bytes_written);
+                    if(written != CONCAT_OK)
                     {
-                        //badly formatted input
-                        printf("received badly formatted line (skipping): %s\n", cb->line);
-                        free(cb->line);
-                        cb->line = NULL;
+                        if(written == CONCAT_NOT_RANGES)
+                        {
+                            printf("The fragments are not ranges in manifest order, run without --concat\n");
+                        }
+                        else
+                        {
+                            printf("Error Writing Output File: %s\n", strerror(errno));
+                        }
+                        free(pending.items);
+                        free(done_rates);
+                        free(tasks);
+                        clean_all(local, pool, buff_info_list, num_conns + 1, num_fragment_files, fragments, &fds, &index, file_original, evlist);
+                        return written == CONCAT_NOT_RANGES ? NOT_RANGE_PARTITIONED : FAILED_TO_WRITE_OUTPUT_FILE;
                     }
-                    
-                    // Reset for a new message.
-                    cb->line_index = 0;
-                    cb->curr_len_line = 0;
-
-                    //move past the delim
-                    last_index = index + 1;
+                    stats_phase_end(&stats, PHASE_OUTPUT, output_start);
                 }
-                
+            }
 
-                if (!skip && last_index < bytesRead) {
-                    int buffer_size;
-                
-                    // search only the valid remainder, not the full BUFFER_RW_SIZE
-                    index = position_delim(buf + last_index,
-                                            bytesRead - last_index,
-                                            DELIMITER);
-                    if (index == -1) {
-                        // no delimiter found in what we read
-                        buffer_size = bytesRead;
-                    } else {
-                        // index is relative to buf+last_index, so add last_index for absolute
-                        buffer_size = last_index + index;
-                    }
-                
-                    // only copy if there’s something new
-                    if (last_index < buffer_size) {
-                        int copy_len = buffer_size - last_index;
-                        // grow our line buffer by exactly copy_len bytes
-                        get_mem_for_line(&cb->line,
-                                            &cb->line_index,
-                                            &cb->curr_len_line,
-                                            copy_len);
-                        // copy just those bytes
-                        memcpy(cb->line + cb->line_index,
-                                buf + last_index,
-                                copy_len);
-                        cb->line_index += copy_len;
-                    }
+            cb->stats.lines += counts.lines;
+            stats.lines += counts.lines;
+            cb->stats.duplicates += counts.duplicates;
+            stats.duplicates += counts.duplicates;
+            cb->stats.malformed += counts.malformed;
+            stats.malformed += counts.malformed;
+            stats.phases[PHASE_INSERT].ns += counts.insert_ns;
+            stats.phases[PHASE_INSERT].count += counts.lines;
+
+            //parse time is the chunk's time less the inserts inside it
+            stats.phases[PHASE_PARSE].ns += task->ns - counts.insert_ns;
+            stats.phases[PHASE_PARSE].count++;
+
+            buffered += counts.bytes;
+            if(counts.bytes > 0 && live)
+            {
+                cb->last_line = counts.last_line;
+                if(limits.conn_bytes)
+                {
+                    inflight_add(&cb->inflight, counts.last_line, counts.bytes);
                 }
+            }
+            if(buffered > stats.peak_buffered)
+            {
+                stats.peak_buffered = buffered;
+            }
 
-                //set the buf back to '\0' chars
-                memset(buf, 0, BUFFER_RW_SIZE);
+            //write out whatever the index now holds in order
+            uint64_t output_start = stats_now();
+            freed = 0;
+            if(!write_ready_output(&index, file_original, &next_line,
+                                   &stats.lines_written, &stats.bytes_written, &freed))
+            {
+                printf("Error Writing Output File: %s\n", strerror(errno));
+                free(pending.items);
+                free(done_rates);
+                free(tasks);
+                clean_all(local, pool, buff_info_list, num_conns + 1, num_fragment_files, fragments, &fds, &index, file_original, evlist);
+                return FAILED_TO_WRITE_OUTPUT_FILE;
+            }
+            buffered -= freed;
+            if(freed > 0)
+            {
+                stats_phase_end(&stats, PHASE_OUTPUT, output_start);
             }
 
-            //Client Disconnecting!
-            if((fd != sfd) && (events & EPOLLRDHUP))
+            if(flow_control && live)
             {
-                printf("Client disconnected!\n");
-				
-				cb->file_closed = 1;
-                
+                apply_backpressure(epfd, cb, buff_info_list, num_conns, &limits, buffered, next_line, &stats);
             }
+        }
 
-            if((fd != sfd) && cb->file_closed && cb->done_reading)
+        //connections that are finished and have hung up
+        for(int i = 0; i < num_events; i++)
+        {
+            struct buff_info * cb = (struct buff_info *) evlist[i].data.ptr;
+            if(cb->client_index == -1 || cb->cfd == -1)
+            {
+                continue;
+            }
+
+            if(cb->file_closed && cb->done_reading)
             {
                 //ev.events = EPOLLIN | EPOLLRDHUP;
                 if(epoll_ctl(epfd, EPOLL_CTL_DEL, cb->cfd, &evlist[i]) == -1) {
-                    printf("Error Adding to EPOLL: %s\n", strerror(errno));
-                    clean_all(buff_info_list, file_index + 1, num_fragment_files, fragment_files, root, file_original, evlist);
+                    log_error("Error Adding to EPOLL: %s\n", strerror(errno));
+                    free(pending.items);
+                    free(done_rates);
+                    free(tasks);
+                    clean_all(local, pool, buff_info_list, num_conns + 1, num_fragment_files, fragments, &fds, &index, file_original, evlist);
                     return EPOLL_ISSUE;
                 }
+                //closed now rather than at the end, so a job with many
+                //fragments does not hold a socket for each
+                if(close(cb->cfd) == -1)
+                {
+                    log_warn("Error Closing Socket: %s\n", strerror(errno));
+                }
+                cb->cfd = -1;
                 
-                num_clients_done++;
+                num_fragments_done++;
+
+                //the lowest connection may have just finished
+                if(flow_control)
+                {
+                    apply_backpressure(epfd, NULL, buff_info_list, num_conns, &limits, buffered, next_line, &stats);
+                }
             }
         }
 
     }
 
 
-    int curr_len_line;
-    int line_index;
-
     //print out recombined file
-    while(root != NULL)
+    uint64_t output_start = stats_now();
+    uint64_t trace_output_start = trace_now_us();
+    if(!write_output(&index, file_original, &stats.lines_written, &stats.bytes_written))
     {
-        //get lowest line number node
-        struct btree * min_node = find_min(root);
-
-        //print the line to the terminal
-        printf("%s", min_node->line);
-
-        //find index of space
-        int index = position_delim(min_node->line, min_node->line_length + 1, ' ');
-
-        if(index != -1)
-        {
-            //write to output file
-            int total_write = min_node->line_length - index - 1;
-            char * start_ptr = min_node->line + index + 1;
-            ssize_t totalBytesWritten = 0;
-            while(totalBytesWritten < total_write)
-            {
-                ssize_t bytesWritten = write(file_original, start_ptr + totalBytesWritten, total_write - totalBytesWritten);
-                if(bytesWritten == -1)
-                {
-                    if(errno == EINTR)
-                    {
-                        continue;
-                    }
-                    return FAILED_TO_WRITE_OUTPUT_FILE;
-                }
-
-                totalBytesWritten += bytesWritten;
-            }
-        }
-        
-        //delete and free lowest line number node
-        root = delete_node(root, min_node);
+        printf("Error Writing Output File: %s\n", strerror(errno));
+        free(pending.items);
+        free(done_rates);
+        free(tasks);
+        clean_all(local, pool, buff_info_list, num_conns + 1, num_fragment_files, fragments, &fds, &index, file_original, evlist);
+        return FAILED_TO_WRITE_OUTPUT_FILE;
     }
 
-    printf("Finished Writing to Original File\n");
+    log_info("Finished Writing to Original File\n");
+    if(unix_path != NULL)
+    {
+        unlink(unix_path);
+    }
 
+    stats_phase_end(&stats, PHASE_OUTPUT, output_start);
+    trace_span("output", "server", 0, trace_output_start, "lines", stats.lines_written);
+    if(recp != NULL && !recording_close(recp))
+    {
+        printf("Could not write all of recording %s\n", record_path);
+    }
+    save_stats(stats_path, &stats, buff_info_list, num_conns);
+    prof_report(stderr, "server", stats.lines_written);
+    free(pending.items);
+    free(done_rates);
+    free(tasks);
+    if(cpp != NULL)
+    {
+        checkpoint_close(cpp);
+    }
 
-    return clean_all(buff_info_list, file_index + 1, num_fragment_files, fragment_files, root, file_original, evlist);
+    return clean_all(local, pool, buff_info_list, num_conns + 1, num_fragment_files, fragments, &fds, &index, file_original, evlist);
 
 }
\ No newline at end of file
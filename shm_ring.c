@@ -0,0 +1,327 @@
+/*
+shm_ring.c - shared memory transport for a client on the same host
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include "shm_ring.h"
+#include "log.h"
+
+#define FALSE 0
+#define TRUE 1
+
+//memfd, data_event, space_event
+#define SHM_FDS 3
+
+static void ring_clear(struct shm_ring * ring)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->data_event = -1;
+    ring->space_event = -1;
+    ring->peer_fd = -1;
+}
+
+static int map_ring(struct shm_ring * ring, int memfd, size_t map_size)
+{
+    void * map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if(map == MAP_FAILED)
+    {
+        return FALSE;
+    }
+    ring->header = map;
+    ring->data = (char *) map + sizeof(struct shm_ring_header);
+    ring->map_size = map_size;
+    return TRUE;
+}
+
+static void signal_event(int event_fd)
+{
+    uint64_t one = 1;
+    //the counter only saturates after 2^64 - 2 signals, so a failed
+    //write can only mean the descriptor is gone
+    if(write(event_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+    {
+        log_warn("Shared memory ring signal failed: %s\n", strerror(errno));
+    }
+}
+
+//wait for event_fd to be signalled; returns 0 if the peer went away
+static int wait_event(int event_fd, int peer_fd)
+{
+    struct pollfd fds[2];
+    fds[0].fd = event_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = peer_fd;
+    fds[1].events = POLLRDHUP;
+
+    while(poll(fds, 2, -1) == -1)
+    {
+        if(errno != EINTR)
+        {
+            return FALSE;
+        }
+    }
+    if(fds[0].revents & POLLIN)
+    {
+        //the events are non-blocking, so this only resets the counter
+        uint64_t count;
+        if(read(event_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+        {
+            return FALSE;
+        }
+        return TRUE;
+    }
+    return !(fds[1].revents & (POLLRDHUP | POLLHUP | POLLERR | POLLNVAL));
+}
+
+int shm_ring_offer(struct shm_ring * ring, int peer_fd, uint64_t capacity)
+{
+    ring_clear(ring);
+    ring->peer_fd = peer_fd;
+
+    size_t map_size = sizeof(struct shm_ring_header) + capacity;
+    int memfd = memfd_create("shm_ring", MFD_CLOEXEC);
+    if(memfd == -1)
+    {
+        log_error("Could not create shared memory ring: %s\n", strerror(errno));
+        return FALSE;
+    }
+    if(ftruncate(memfd, map_size) == -1 || !map_ring(ring, memfd, map_size))
+    {
+        log_error("Could not size shared memory ring: %s\n", strerror(errno));
+        close(memfd);
+        return FALSE;
+    }
+    //a new memfd is zero filled, so both positions start at 0
+    ring->header->capacity = capacity;
+    ring->capacity = capacity;
+
+    ring->data_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    ring->space_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(ring->data_event == -1 || ring->space_event == -1)
+    {
+        log_error("Could not create ring events: %s\n", strerror(errno));
+        close(memfd);
+        shm_ring_close(ring);
+        return FALSE;
+    }
+
+    int fds[SHM_FDS] = {memfd, ring->data_event, ring->space_event};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+
+    char hello = SHM_HELLO;
+    struct iovec iov = {&hello, 1};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t sent;
+    do
+    {
+        sent = sendmsg(peer_fd, &msg, MSG_NOSIGNAL);
+    } while(sent == -1 && errno == EINTR);
+
+    //the mapping keeps the memory, and the client has its own memfd
+    close(memfd);
+    if(sent != 1)
+    {
+        log_error("Could not send shared memory ring: %s\n", strerror(errno));
+        shm_ring_close(ring);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+//take up the ring in a hello message; returns 1 on success
+static int attach(struct shm_ring * ring, int peer_fd, struct msghdr * msg)
+{
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(msg);
+    int fds[SHM_FDS];
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    ring->peer_fd = peer_fd;
+    ring->data_event = fds[1];
+    ring->space_event = fds[2];
+
+    struct stat st;
+    if(fstat(fds[0], &st) == -1 || (size_t) st.st_size < sizeof(struct shm_ring_header) ||
+       !map_ring(ring, fds[0], st.st_size))
+    {
+        log_error("Could not map shared memory ring: %s\n", strerror(errno));
+        close(fds[0]);
+        return FALSE;
+    }
+    close(fds[0]);
+
+    if(ring->header->capacity != ring->map_size - sizeof(struct shm_ring_header))
+    {
+        log_error("Shared memory ring has the wrong size\n");
+        return FALSE;
+    }
+    ring->capacity = ring->header->capacity;
+    return TRUE;
+}
+
+ssize_t shm_ring_accept(struct shm_ring * ring, int peer_fd, char * buf, size_t len, int * attached)
+{
+    ring_clear(ring);
+    *attached = FALSE;
+
+    int fds[SHM_FDS];
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = {buf, len};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t got;
+    do
+    {
+        got = recvmsg(peer_fd, &msg, MSG_CMSG_CLOEXEC);
+    } while(got == -1 && errno == EINTR);
+
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    if(got <= 0 || cmsg == NULL)
+    {
+        //a plain stream; what was read is the start of the fragment
+        return got;
+    }
+
+    if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+       cmsg->cmsg_len != CMSG_LEN(sizeof(fds)) || (msg.msg_flags & MSG_CTRUNC) ||
+       got != 1 || buf[0] != SHM_HELLO)
+    {
+        log_error("Unexpected descriptors from the server\n");
+        errno = EPROTO;
+        return -1;
+    }
+    if(!attach(ring, peer_fd, &msg))
+    {
+        shm_ring_close(ring);
+        errno = EPROTO;
+        return -1;
+    }
+    *attached = TRUE;
+    return 0;
+}
+
+int shm_ring_write_all(struct shm_ring * ring, const char * buf, size_t n)
+{
+    uint64_t capacity = ring->capacity;
+    uint64_t head = atomic_load_explicit(&ring->header->head, memory_order_relaxed);
+
+    while(n > 0)
+    {
+        uint64_t tail = atomic_load_explicit(&ring->header->tail, memory_order_acquire);
+        if(head - tail > capacity)
+        {
+            //the positions are shared with the other process
+            errno = EPROTO;
+            return FALSE;
+        }
+        uint64_t space = capacity - (head - tail);
+        if(space == 0)
+        {
+            if(!wait_event(ring->space_event, ring->peer_fd))
+            {
+                errno = EPIPE;
+                return FALSE;
+            }
+            continue;
+        }
+
+        size_t chunk = n < space ? n : space;
+        uint64_t at = head % capacity;
+        size_t first = chunk < capacity - at ? chunk : capacity - at;
+        memcpy(ring->data + at, buf, first);
+        memcpy(ring->data, buf + first, chunk - first);
+
+        head += chunk;
+        atomic_store_explicit(&ring->header->head, head, memory_order_release);
+        signal_event(ring->data_event);
+        buf += chunk;
+        n -= chunk;
+    }
+    return TRUE;
+}
+
+ssize_t shm_ring_read(struct shm_ring * ring, char * buf, size_t len)
+{
+    uint64_t capacity = ring->capacity;
+    uint64_t tail = atomic_load_explicit(&ring->header->tail, memory_order_relaxed);
+
+    while(TRUE)
+    {
+        uint64_t head = atomic_load_explicit(&ring->header->head, memory_order_acquire);
+        uint64_t avail = head - tail;
+        if(avail > capacity)
+        {
+            //the positions are shared with the other process
+            errno = EPROTO;
+            return -1;
+        }
+        if(avail > 0)
+        {
+            size_t chunk = len < avail ? len : avail;
+            uint64_t at = tail % capacity;
+            size_t first = chunk < capacity - at ? chunk : capacity - at;
+            memcpy(buf, ring->data + at, first);
+            memcpy(buf + first, ring->data, chunk - first);
+
+            atomic_store_explicit(&ring->header->tail, tail + chunk, memory_order_release);
+            signal_event(ring->space_event);
+            return chunk;
+        }
+
+        //the server is gone; anything it wrote first was seen above
+        if(!wait_event(ring->data_event, ring->peer_fd) &&
+           atomic_load_explicit(&ring->header->head, memory_order_acquire) == head)
+        {
+            return 0;
+        }
+    }
+}
+
+void shm_ring_close(struct shm_ring * ring)
+{
+    if(ring->header != NULL)
+    {
+        munmap(ring->header, ring->map_size);
+    }
+    if(ring->data_event != -1)
+    {
+        close(ring->data_event);
+    }
+    if(ring->space_event != -1)
+    {
+        close(ring->space_event);
+    }
+    ring_clear(ring);
+}
@@ -0,0 +1,79 @@
+/*
+shm_ring.h - shared memory transport for a client on the same host.
+
+The server sends a fragment to a client that connected over a Unix
+socket through a byte ring in a memfd instead of the socket. The
+memfd and two eventfds go to the client as SCM_RIGHTS on a one byte
+message, then the fragment and its "EOF\n" are copied into the ring:
+
+    struct shm_ring_header     producer and consumer positions
+    data [capacity]            the ring
+
+There is one producer and one consumer. The producer writes to
+data_event after adding bytes and waits on space_event while the ring
+is full; the consumer does the reverse. Both also watch the socket,
+so either side going away ends a wait. Results still come back over
+the socket: they are small with --permutation.
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+#define SHM_CACHE_LINE 64
+
+//what the message carrying the descriptors says
+#define SHM_HELLO 'S'
+
+//positions only grow; they are taken modulo the capacity
+struct shm_ring_header
+{
+    _Atomic uint64_t head;
+    char head_pad[SHM_CACHE_LINE - sizeof(uint64_t)];
+    _Atomic uint64_t tail;
+    char tail_pad[SHM_CACHE_LINE - sizeof(uint64_t)];
+    uint64_t capacity;
+};
+
+struct shm_ring
+{
+    struct shm_ring_header * header;
+    char * data;
+    size_t map_size;
+    //this side's copy of header->capacity, which the other side could
+    //change under it
+    uint64_t capacity;
+    //written to after bytes are added, and after bytes are taken
+    int data_event;
+    int space_event;
+    //the connection's socket, to notice the other side going away
+    int peer_fd;
+};
+
+//server: a ring of 'capacity' bytes for the connection 'peer_fd',
+//with its descriptors sent to the client; returns 1 on success
+int shm_ring_offer(struct shm_ring * ring, int peer_fd, uint64_t capacity);
+
+//client: read from a Unix socket like read(), but take up a ring if
+//the server offered one. *attached is set when that happened, in
+//which case nothing was read and the fragment is in the ring
+ssize_t shm_ring_accept(struct shm_ring * ring, int peer_fd, char * buf, size_t len, int * attached);
+
+//copy all n bytes in, waiting for room; returns 1 on success
+int shm_ring_write_all(struct shm_ring * ring, const char * buf, size_t n);
+
+//take up to len bytes out, waiting for some; like read() it returns
+//0 once the other side has gone and the ring is empty
+ssize_t shm_ring_read(struct shm_ring * ring, char * buf, size_t len);
+
+//unmap and close this side's descriptors, but not peer_fd
+void shm_ring_close(struct shm_ring * ring);
+
+#endif
@@ -0,0 +1,209 @@
+// File: shuffle_engine.h
+// Purpose: seeded, reproducible shuffling for the splitter (and anything
+//          else that needs to generate the same data twice).  Provides the
+//          xoshiro256** generator, an unbiased bounded draw, Fisher-Yates,
+//          and a parallel shuffle built from a partitioned scatter followed
+//          by a local Fisher-Yates in each partition.
+//
+//          For a given seed every function here produces the same output
+//          no matter how many threads are used: work is cut into chunks
+//          and buckets whose sizes depend only on the input size, and each
+//          chunk or bucket draws from its own generator stream.
+
+#ifndef SHUFFLE_ENGINE_H
+#define SHUFFLE_ENGINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <utility>
+
+// inputs shorter than this are shuffled on the calling thread
+const size_t parallel_shuffle_threshold = 1 << 18;
+
+// elements tagged by one generator stream during the scatter phase
+const size_t shuffle_chunk_size = 1 << 16;
+
+// bounds on the number of partitions the scatter phase targets
+const size_t min_shuffle_buckets = 2;
+const size_t max_shuffle_buckets = 1024;
+
+// splitmix64, used to expand a single 64-bit seed into generator state
+inline uint64_t splitmix64 (uint64_t & state) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// xoshiro256** (Blackman and Vigna): small state, fast, and good enough
+// statistically for shuffling
+class xoshiro256 {
+public:
+    typedef uint64_t result_type;
+
+    explicit xoshiro256 (uint64_t seed = 0) {
+        uint64_t sm = seed;
+        for (int i = 0; i < 4; ++i) {
+            s[i] = splitmix64(sm);
+        }
+    }
+
+    // generator for stream 'stream' of 'seed'
+    static xoshiro256 stream (uint64_t seed, uint64_t stream) {
+        uint64_t sm = seed ^ (stream * 0xd1342543de82ef95ULL);
+        xoshiro256 rng (splitmix64(sm));
+        return rng;
+    }
+
+    static result_type min () { return 0; }
+    static result_type max () { return ~static_cast<result_type>(0); }
+
+    result_type operator() () { return next(); }
+
+    uint64_t next () {
+        const uint64_t result = rotl(s[1] * 5, 7) * 9;
+        const uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    // uniform draw from [0, bound) without modulo bias (Lemire's method)
+    uint64_t bounded (uint64_t bound) {
+        unsigned __int128 m = static_cast<unsigned __int128>(next()) * bound;
+        uint64_t low = static_cast<uint64_t>(m);
+        if (low < bound) {
+            uint64_t threshold = -bound % bound;
+            while (low < threshold) {
+                m = static_cast<unsigned __int128>(next()) * bound;
+                low = static_cast<uint64_t>(m);
+            }
+        }
+        return static_cast<uint64_t>(m >> 64);
+    }
+
+private:
+    static uint64_t rotl (uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    uint64_t s[4];
+};
+
+// classic in-place Fisher-Yates over [first, last)
+template <typename Iter>
+void fisher_yates (Iter first, Iter last, xoshiro256 & rng) {
+    size_t n = last - first;
+    for (size_t i = n; i > 1; --i) {
+        size_t j = rng.bounded(i);
+        std::swap(first[i - 1], first[j]);
+    }
+}
+
+// runs task(0) .. task(count - 1) on up to 'threads' threads; the mapping
+// of tasks to threads is dynamic, so tasks must not depend on it
+template <typename Task>
+void run_parallel (size_t count, unsigned threads, Task task) {
+    if (threads <= 1 || count <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            task(i);
+        }
+        return;
+    }
+    if (threads > count) {
+        threads = count;
+    }
+
+    std::atomic<size_t> next (0);
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; ++t) {
+        pool.push_back(std::thread([&next, count, &task] () {
+            size_t i;
+            while ((i = next.fetch_add(1)) < count) {
+                task(i);
+            }
+        }));
+    }
+    for (size_t t = 0; t < pool.size(); ++t) {
+        pool[t].join();
+    }
+}
+
+// shuffles v uniformly at random.  Small inputs get a plain Fisher-Yates;
+// large ones are scattered chunk by chunk into random buckets (tagging and
+// scattering run in parallel, one generator stream per chunk), and each
+// bucket is then Fisher-Yates shuffled in parallel with its own stream.
+// Random bucket assignment followed by a uniform in-bucket shuffle is a
+// uniform permutation of the whole input.
+template <typename T, typename Alloc>
+void parallel_shuffle (std::vector<T, Alloc> & v, uint64_t seed, unsigned threads) {
+    const size_t n = v.size();
+    if (n < parallel_shuffle_threshold) {
+        xoshiro256 rng (seed);
+        fisher_yates(v.begin(), v.end(), rng);
+        return;
+    }
+
+    size_t buckets = n / shuffle_chunk_size;
+    if (buckets < min_shuffle_buckets) buckets = min_shuffle_buckets;
+    if (buckets > max_shuffle_buckets) buckets = max_shuffle_buckets;
+    const size_t chunks = (n + shuffle_chunk_size - 1) / shuffle_chunk_size;
+
+    // phase 1: tag each element with its bucket, counting per chunk
+    std::vector<uint16_t> tags (n);
+    std::vector<size_t> counts (chunks * buckets, 0);
+    run_parallel(chunks, threads, [&] (size_t c) {
+        xoshiro256 rng = xoshiro256::stream(seed, c);
+        size_t begin = c * shuffle_chunk_size;
+        size_t end = begin + shuffle_chunk_size < n ? begin + shuffle_chunk_size : n;
+        size_t * chunk_counts = &counts[c * buckets];
+        for (size_t i = begin; i < end; ++i) {
+            uint16_t b = static_cast<uint16_t>(rng.bounded(buckets));
+            tags[i] = b;
+            chunk_counts[b]++;
+        }
+    });
+
+    // phase 2: bucket-major prefix sums give every chunk a private write
+    // cursor into each bucket
+    std::vector<size_t> bucket_start (buckets + 1, 0);
+    std::vector<size_t> cursors (chunks * buckets);
+    size_t offset = 0;
+    for (size_t b = 0; b < buckets; ++b) {
+        bucket_start[b] = offset;
+        for (size_t c = 0; c < chunks; ++c) {
+            cursors[c * buckets + b] = offset;
+            offset += counts[c * buckets + b];
+        }
+    }
+    bucket_start[buckets] = offset;
+
+    // phase 3: scatter
+    std::vector<T, Alloc> out (n);
+    run_parallel(chunks, threads, [&] (size_t c) {
+        size_t begin = c * shuffle_chunk_size;
+        size_t end = begin + shuffle_chunk_size < n ? begin + shuffle_chunk_size : n;
+        size_t * chunk_cursors = &cursors[c * buckets];
+        for (size_t i = begin; i < end; ++i) {
+            out[chunk_cursors[tags[i]]++] = std::move(v[i]);
+        }
+    });
+
+    // phase 4: local Fisher-Yates in each bucket
+    run_parallel(buckets, threads, [&] (size_t b) {
+        xoshiro256 rng = xoshiro256::stream(seed, chunks + b);
+        fisher_yates(out.begin() + bucket_start[b],
+                     out.begin() + bucket_start[b + 1], rng);
+    });
+
+    v.swap(out);
+}
+
+#endif // SHUFFLE_ENGINE_H
@@ -0,0 +1,235 @@
+/*
+stats.c - per-phase counters and timers for the server
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+#define NS_PER_S 1000000000ULL
+
+static const char * phase_names[NUM_PHASES] = {
+    "accept", "send", "recv", "parse", "insert", "output"
+};
+
+static const char * latency_names[NUM_LATENCIES] = {
+    "dispatch", "first_result", "turnaround"
+};
+
+uint64_t stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+void stats_init(struct server_stats * stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->start_ns = stats_now();
+}
+
+uint64_t stats_phase_end(struct server_stats * stats, enum stats_phase phase, uint64_t start)
+{
+    uint64_t now = stats_now();
+    stats->phases[phase].ns += now - start;
+    stats->phases[phase].count++;
+    return now;
+}
+
+void stats_client_latency(struct server_stats * stats, struct client_stats * client,
+                          enum stats_latency latency, uint64_t now)
+{
+    if(client->latency_ns[latency] != 0)
+    {
+        return;
+    }
+    client->latency_ns[latency] = now;
+    hist_record(&stats->latencies[latency], now - client->accept_ns);
+}
+
+//values below HIST_SUB_BUCKETS get a bucket each, above that the
+//top HIST_SUB_BITS bits after the leading one pick the bucket
+static int hist_index(uint64_t ns)
+{
+    if(ns < HIST_SUB_BUCKETS)
+    {
+        return (int) ns;
+    }
+    int msb = 63 - __builtin_clzll(ns);
+    int shift = msb - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB_BUCKETS + (int) ((ns >> shift) & (HIST_SUB_BUCKETS - 1));
+}
+
+static uint64_t hist_midpoint(int index)
+{
+    if(index < HIST_SUB_BUCKETS)
+    {
+        return index;
+    }
+    int shift = index / HIST_SUB_BUCKETS - 1;
+    uint64_t low = (uint64_t) (HIST_SUB_BUCKETS + index % HIST_SUB_BUCKETS) << shift;
+    return low + ((1ULL << shift) >> 1);
+}
+
+void hist_record(struct latency_hist * hist, uint64_t ns)
+{
+    hist->buckets[hist_index(ns)]++;
+    hist->count++;
+    if(ns > hist->max_ns)
+    {
+        hist->max_ns = ns;
+    }
+}
+
+uint64_t hist_percentile(struct latency_hist * hist, double q)
+{
+    if(hist->count == 0)
+    {
+        return 0;
+    }
+
+    //rank of the wanted value, counting from 1
+    uint64_t rank = (uint64_t) (q * hist->count + 0.5);
+    if(rank < 1)
+    {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for(int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += hist->buckets[i];
+        if(seen >= rank)
+        {
+            uint64_t mid = hist_midpoint(i);
+            return mid < hist->max_ns ? mid : hist->max_ns;
+        }
+    }
+    return hist->max_ns;
+}
+
+static double ns_to_ms(uint64_t ns)
+{
+    return (double) ns / 1000000.0;
+}
+
+//client latency in ns, or 0 if it has not got there yet
+static uint64_t client_latency(struct client_stats * c, enum stats_latency latency)
+{
+    return c->latency_ns[latency] ? c->latency_ns[latency] - c->accept_ns : 0;
+}
+
+void stats_write_json(FILE * out, struct server_stats * stats,
+                      struct client_stats ** clients, int num_clients)
+{
+    uint64_t elapsed = stats_now() - stats->start_ns;
+
+    fprintf(out, "{\n  \"elapsed_s\": %.6f,\n", (double) elapsed / NS_PER_S);
+    fprintf(out, "  \"connections\": %llu, \"local_runs\": %llu, \"requeued\": %llu, \"speculated\": %llu, \"cancelled\": %llu,\n",
+            (unsigned long long) stats->connections,
+            (unsigned long long) stats->local_runs,
+            (unsigned long long) stats->requeued,
+            (unsigned long long) stats->speculated,
+            (unsigned long long) stats->cancelled);
+    fprintf(out, "  \"resumed\": %llu, \"bytes_in\": %llu, \"bytes_out\": %llu,\n",
+            (unsigned long long) stats->resumed,
+            (unsigned long long) stats->bytes_in,
+            (unsigned long long) stats->bytes_out);
+    fprintf(out, "  \"lines\": %llu, \"duplicates\": %llu, \"malformed\": %llu,\n",
+            (unsigned long long) stats->lines,
+            (unsigned long long) stats->duplicates,
+            (unsigned long long) stats->malformed);
+    fprintf(out, "  \"lines_written\": %llu, \"bytes_written\": %llu,\n",
+            (unsigned long long) stats->lines_written,
+            (unsigned long long) stats->bytes_written);
+    fprintf(out, "  \"peak_buffered_bytes\": %llu, \"pauses\": %llu,\n",
+            (unsigned long long) stats->peak_buffered,
+            (unsigned long long) stats->pauses);
+
+    fprintf(out, "  \"phases\": {");
+    for(int p = 0; p < NUM_PHASES; p++)
+    {
+        fprintf(out, "%s\n    \"%s\": {\"s\": %.6f, \"count\": %llu}",
+                p ? "," : "", phase_names[p],
+                (double) stats->phases[p].ns / NS_PER_S,
+                (unsigned long long) stats->phases[p].count);
+    }
+    fprintf(out, "\n  },\n");
+
+    fprintf(out, "  \"latency_ms\": {");
+    for(int l = 0; l < NUM_LATENCIES; l++)
+    {
+        struct latency_hist * h = &stats->latencies[l];
+        fprintf(out, "%s\n    \"%s\": {\"count\": %llu, \"p50\": %.3f, \"p99\": %.3f, "
+                "\"p999\": %.3f, \"max\": %.3f}",
+                l ? "," : "", latency_names[l],
+                (unsigned long long) h->count,
+                ns_to_ms(hist_percentile(h, 0.50)),
+                ns_to_ms(hist_percentile(h, 0.99)),
+                ns_to_ms(hist_percentile(h, 0.999)),
+                ns_to_ms(h->max_ns));
+    }
+    fprintf(out, "\n  },\n");
+
+    //slowest clients by turnaround, picked by repeated selection
+    //since STATS_SLOWEST is small
+    int slowest[STATS_SLOWEST];
+    int num_slowest = 0;
+    while(num_slowest < STATS_SLOWEST)
+    {
+        int pick = -1;
+        for(int i = 0; i < num_clients; i++)
+        {
+            uint64_t t = client_latency(clients[i], LATENCY_TURNAROUND);
+            int taken = 0;
+            for(int j = 0; j < num_slowest; j++)
+            {
+                taken |= slowest[j] == i;
+            }
+            if(t != 0 && !taken && (pick == -1 || t > client_latency(clients[pick], LATENCY_TURNAROUND)))
+            {
+                pick = i;
+            }
+        }
+        if(pick == -1)
+        {
+            break;
+        }
+        slowest[num_slowest++] = pick;
+    }
+
+    fprintf(out, "  \"slowest_clients\": [");
+    for(int i = 0; i < num_slowest; i++)
+    {
+        fprintf(out, "%s%d", i ? ", " : "", clients[slowest[i]]->client_id);
+    }
+    fprintf(out, "],\n");
+
+    fprintf(out, "  \"clients\": [");
+    for(int i = 0; i < num_clients; i++)
+    {
+        struct client_stats * c = clients[i];
+        fprintf(out, "%s\n    {\"id\": %d, \"fragment\": %d, \"bytes_in\": %llu, \"bytes_out\": %llu, "
+                "\"lines\": %llu, \"duplicates\": %llu, \"malformed\": %llu, "
+                "\"failed\": %s, \"cancelled\": %s, \"local\": %s, \"dispatch_ms\": %.3f, \"first_result_ms\": %.3f, \"turnaround_ms\": %.3f}",
+                i ? "," : "", c->client_id, c->fragment,
+                (unsigned long long) c->bytes_in,
+                (unsigned long long) c->bytes_out,
+                (unsigned long long) c->lines,
+                (unsigned long long) c->duplicates,
+                (unsigned long long) c->malformed,
+                c->failed ? "true" : "false",
+                c->cancelled ? "true" : "false",
+                c->local ? "true" : "false",
+                ns_to_ms(client_latency(c, LATENCY_DISPATCH)),
+                ns_to_ms(client_latency(c, LATENCY_FIRST_RESULT)),
+                ns_to_ms(client_latency(c, LATENCY_TURNAROUND)));
+    }
+    fprintf(out, "\n  ]\n}\n");
+    fflush(out);
+}
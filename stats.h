@@ -0,0 +1,133 @@
+/*
+stats.h - per-phase counters and monotonic timers for the
+server, plus per-client byte and line counts. Everything is
+plain integer adds and one clock read at each phase boundary,
+so it stays on in normal runs.
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+//phases of a job that get their own timer
+enum stats_phase
+{
+    PHASE_ACCEPT,
+    PHASE_SEND,
+    PHASE_RECV,
+    PHASE_PARSE,
+    PHASE_INSERT,
+    PHASE_OUTPUT,
+    NUM_PHASES
+};
+
+struct phase_timer
+{
+    uint64_t ns;
+    uint64_t count;
+};
+
+//log-bucketed latency histogram: each power of two is split into
+//HIST_SUB_BUCKETS linear buckets, so a recorded value is kept to
+//within about 6% at any magnitude with a fixed, small table
+#define HIST_SUB_BITS 4
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+struct latency_hist
+{
+    uint64_t count;
+    uint64_t max_ns;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+//per-client latencies, all measured from accept
+enum stats_latency
+{
+    LATENCY_DISPATCH,       //last fragment byte sent
+    LATENCY_FIRST_RESULT,   //first result byte received
+    LATENCY_TURNAROUND,     //"EOF\n" received
+    NUM_LATENCIES
+};
+
+//how many of the slowest clients the report names
+#define STATS_SLOWEST 5
+
+//counts for one connection
+struct client_stats
+{
+    int client_id;
+    int fragment;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t lines;
+    uint64_t duplicates;
+    uint64_t malformed;
+    //died before sending all its results
+    int failed;
+    //dropped because another copy of its fragment finished first
+    int cancelled;
+    //sorted by the server's own threads
+    int local;
+
+    //timestamps from stats_now(), 0 until reached
+    uint64_t accept_ns;
+    uint64_t latency_ns[NUM_LATENCIES];
+};
+
+//counts and timers for the whole job
+struct server_stats
+{
+    uint64_t start_ns;
+    struct phase_timer phases[NUM_PHASES];
+    struct latency_hist latencies[NUM_LATENCIES];
+    uint64_t connections;
+    //runs sorted by the server's own threads, out of connections
+    uint64_t local_runs;
+    uint64_t requeued;
+    uint64_t speculated;
+    uint64_t cancelled;
+    //fragments whose results came from a checkpoint
+    uint64_t resumed;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t lines;
+    uint64_t duplicates;
+    uint64_t malformed;
+    uint64_t lines_written;
+    uint64_t bytes_written;
+    //most bytes of received lines waiting in the tree at once, and
+    //how often a connection was paused to keep it down
+    uint64_t peak_buffered;
+    uint64_t pauses;
+};
+
+//CLOCK_MONOTONIC in nanoseconds
+uint64_t stats_now(void);
+
+void stats_init(struct server_stats * stats);
+
+//charge the time since 'start' to a phase
+//returns the current time so phases can be chained
+uint64_t stats_phase_end(struct server_stats * stats, enum stats_phase phase, uint64_t start);
+
+//record a client reaching a latency point at time 'now'
+//only the first call per client and point counts
+void stats_client_latency(struct server_stats * stats, struct client_stats * client,
+                          enum stats_latency latency, uint64_t now);
+
+void hist_record(struct latency_hist * hist, uint64_t ns);
+
+//value at quantile q (0 to 1), as the midpoint of its bucket
+uint64_t hist_percentile(struct latency_hist * hist, double q);
+
+//write the job summary, with one entry per client, as JSON
+void stats_write_json(FILE * out, struct server_stats * stats,
+                      struct client_stats ** clients, int num_clients);
+
+#endif
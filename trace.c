@@ -0,0 +1,82 @@
+/*
+trace.c - Chrome trace event output, one event per line
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+static FILE * trace_file = NULL;
+static int trace_pid;
+
+uint64_t trace_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+int trace_open(const char * path, const char * process_name)
+{
+    trace_file = fopen(path, "w");
+    if(trace_file == NULL)
+    {
+        return 0;
+    }
+    trace_pid = getpid();
+    atexit(trace_close);
+
+    //metadata goes first once merged since its timestamp is 0
+    fprintf(trace_file, "{\"ts\":0,\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"name\":\"process_name\","
+            "\"args\":{\"name\":\"%s %d\"}}\n", trace_pid, process_name, trace_pid);
+    return 1;
+}
+
+void trace_close(void)
+{
+    if(trace_file != NULL)
+    {
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+}
+
+int trace_enabled(void)
+{
+    return trace_file != NULL;
+}
+
+void trace_lane_name(int lane, const char * name)
+{
+    if(trace_file == NULL)
+    {
+        return;
+    }
+    fprintf(trace_file, "{\"ts\":0,\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"name\":\"thread_name\","
+            "\"args\":{\"name\":\"%s\"}}\n", trace_pid, lane, name);
+}
+
+void trace_span(const char * name, const char * category, int lane, uint64_t start_us,
+                const char * arg_name, long long arg)
+{
+    if(trace_file == NULL)
+    {
+        return;
+    }
+    uint64_t dur = trace_now_us() - start_us;
+    fprintf(trace_file, "{\"ts\":%llu,\"ph\":\"X\",\"dur\":%llu,\"pid\":%d,\"tid\":%d,"
+            "\"name\":\"%s\",\"cat\":\"%s\"",
+            (unsigned long long) start_us, (unsigned long long) dur,
+            trace_pid, lane, name, category);
+    if(arg_name != NULL)
+    {
+        fprintf(trace_file, ",\"args\":{\"%s\":%lld}", arg_name, arg);
+    }
+    fputs("}\n", trace_file);
+}
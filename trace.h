@@ -0,0 +1,49 @@
+/*
+trace.h - opt-in timeline tracing in the Chrome trace event format
+
+Each process writes its own file with one event per line, every line
+starting with {"ts": so that trace_merge.sh can merge the server and
+client files by timestamp into one JSON file for Perfetto or
+chrome://tracing. Timestamps are CLOCK_REALTIME microseconds so that
+processes on one machine share a timeline.
+
+When no trace file is open every call returns straight away.
+
+Jeremy Robin - j.i.robin@wustl.edu
+Shawn Fong - f.shawn@wustl.edu
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//open the trace file and name this process in the timeline
+//returns 1 on success
+int trace_open(const char * path, const char * process_name);
+
+//also run at exit
+void trace_close(void);
+
+int trace_enabled(void);
+
+//CLOCK_REALTIME in microseconds
+uint64_t trace_now_us(void);
+
+//name a lane (thread id) of this process, e.g. one per connection
+void trace_lane_name(int lane, const char * name);
+
+//one span from 'start_us' until now on a lane, with an optional integer argument
+//pass arg_name NULL to leave it out
+void trace_span(const char * name, const char * category, int lane, uint64_t start_us,
+                const char * arg_name, long long arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
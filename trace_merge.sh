@@ -0,0 +1,24 @@
+#!/bin/sh
+#
+# trace_merge.sh - merge server and client --trace files into one
+# Chrome trace JSON file, ordered by timestamp
+#
+#   ./trace_merge.sh job.json server.trace client_*.trace
+#
+# Jeremy Robin - j.i.robin@wustl.edu
+# Shawn Fong - f.shawn@wustl.edu
+
+if [ $# -lt 2 ]; then
+    echo "Expected ./trace_merge.sh <output> <trace file> [trace file ...]"
+    exit 1
+fi
+
+out=$1
+shift
+
+# every event line starts with {"ts":<number>, so the second ':' field sorts them
+{
+    echo '{"traceEvents":['
+    cat "$@" | sort -t: -k2,2n | sed '$!s/$/,/'
+    echo ']}'
+} > "$out"